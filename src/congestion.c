@@ -0,0 +1,349 @@
+#include "congestion.h"
+
+#include <math.h>
+#include <string.h>
+
+#define HISTORY 2048            /* sent packets remembered, by sequence number */
+#define GROUP_US 5000           /* packets sent this close together form a group */
+#define TREND_WINDOW 20         /* group deltas the delay trend is fitted over */
+#define TREND_SMOOTHING 0.9
+#define TREND_GAIN 4.0
+#define OVERUSE_MS 10.0         /* the trend has to stay over the threshold this long */
+#define THRESHOLD_UP 0.0087     /* adaptive threshold gains, per ms */
+#define THRESHOLD_DOWN 0.039
+#define ACKED 2048              /* arrivals the incoming rate is measured over */
+#define ACKED_WINDOW_US 500000
+#define DECREASE_US 200000      /* at most one decrease per this long */
+#define BETA 0.85
+
+typedef struct
+{
+	unsigned short seq;
+	unsigned int bytes;
+	unsigned long long send_us;
+} SENT;
+
+typedef struct
+{
+	int valid;
+	unsigned long long first_send_us;
+	unsigned long long last_send_us;
+	unsigned long long last_arrival_us;
+} GROUP;
+
+enum usage { USAGE_NORMAL, USAGE_OVER, USAGE_UNDER };
+enum rate_state { RATE_HOLD, RATE_INCREASE, RATE_DECREASE };
+
+static SENT sent[HISTORY];
+
+/* receiver clock, unwrapped to 64 bits */
+static int have_arrival;
+static unsigned int last_arrival32;
+static unsigned long long last_arrival_us;
+
+static GROUP current, previous;
+
+/* trendline over the smoothed accumulated delay */
+static double accumulated_ms, smoothed_ms;
+static double trend_x[TREND_WINDOW], trend_y[TREND_WINDOW];
+static unsigned int trend_n, trend_next, deltas;
+static unsigned long long first_group_us;
+
+/* overuse detector */
+static double threshold = 12.5;
+static double previous_trend;
+static double overuse_ms;
+static unsigned long long last_detect_us;
+static enum usage usage;
+
+/* incoming rate, from the arrivals */
+static unsigned long long acked_us[ACKED];
+static unsigned int acked_bytes[ACKED];
+static unsigned int acked_head, acked_count;
+static unsigned long long acked_sum;
+
+/* rate controller */
+static enum rate_state rate_state = RATE_INCREASE;
+static double delay_kbps, loss_kbps, last_decrease_kbps;
+static double min_kbps, max_kbps;
+static double average_bytes = 1200;
+static unsigned long long last_update_us, last_decrease_us;
+
+void cc_init(
+	unsigned int start_kbps,
+	unsigned int min,
+	unsigned int max )
+{
+	memset(sent, 0, sizeof(sent));
+	delay_kbps = loss_kbps = start_kbps;
+	min_kbps = min;
+	max_kbps = max;
+	last_decrease_kbps = 0;
+	rate_state = RATE_INCREASE;
+	usage = USAGE_NORMAL;
+	threshold = 12.5;
+	have_arrival = 0;
+	current.valid = previous.valid = 0;
+	trend_n = trend_next = deltas = 0;
+	accumulated_ms = smoothed_ms = 0;
+	first_group_us = 0;
+	acked_head = acked_count = 0;
+	acked_sum = 0;
+	last_update_us = last_decrease_us = 0;
+}
+
+void cc_limits(
+	unsigned int min,
+	unsigned int max )
+{
+	min_kbps = min;
+	max_kbps = max;
+
+	if( delay_kbps < min_kbps )
+		delay_kbps = min_kbps;
+	if( delay_kbps > max_kbps )
+		delay_kbps = max_kbps;
+	if( loss_kbps < min_kbps )
+		loss_kbps = min_kbps;
+	if( loss_kbps > max_kbps )
+		loss_kbps = max_kbps;
+}
+
+void cc_sent(
+	unsigned short seq,
+	unsigned int bytes,
+	unsigned long long send_us )
+{
+	SENT *s = &sent[seq % HISTORY];
+
+	/* duplicate mode sends every packet twice back to back; the receiver
+	 * reports the first copy, so keep the first send time */
+	if( s->seq == seq && s->send_us && send_us - s->send_us < GROUP_US )
+		return;
+
+	s->seq = seq;
+	s->bytes = bytes;
+	s->send_us = send_us;
+	average_bytes = 0.95 * average_bytes + 0.05 * bytes;
+}
+
+static void detect(
+	double trend,
+	unsigned long long now_us )
+{
+	double m = (deltas < 60 ? deltas : 60) * trend * TREND_GAIN;
+	double dt_ms = last_detect_us ? (now_us - last_detect_us) / 1000.0 : 0;
+
+	if( dt_ms > 100 )
+		dt_ms = 100;
+	last_detect_us = now_us;
+
+	if( m > threshold ) {
+		overuse_ms += dt_ms;
+		if( overuse_ms > OVERUSE_MS && trend >= previous_trend )
+			usage = USAGE_OVER;
+	} else if( m < -threshold ) {
+		overuse_ms = 0;
+		usage = USAGE_UNDER;
+	} else {
+		overuse_ms = 0;
+		usage = USAGE_NORMAL;
+	}
+	previous_trend = trend;
+
+	/* the threshold follows the trend so that concurrent TCP flows, which
+	 * keep the queue full, don't starve us; spikes far above it are left out */
+	if( fabs(m) <= threshold + 15 ) {
+		threshold += (fabs(m) < threshold ? THRESHOLD_DOWN : THRESHOLD_UP) *
+			(fabs(m) - threshold) * dt_ms;
+		if( threshold < 6 )
+			threshold = 6;
+		if( threshold > 600 )
+			threshold = 600;
+	}
+}
+
+static void group_delta(
+	const GROUP *a,
+	const GROUP *b )
+{
+	double send_ms = (double)(b->last_send_us - a->last_send_us) / 1000.0;
+	double arrival_ms = ((double)b->last_arrival_us - (double)a->last_arrival_us) / 1000.0;
+	double mx = 0, my = 0, num = 0, den = 0;
+	unsigned int i;
+
+	if( !first_group_us )
+		first_group_us = b->last_arrival_us;
+
+	accumulated_ms += arrival_ms - send_ms;
+	smoothed_ms = TREND_SMOOTHING * smoothed_ms + (1 - TREND_SMOOTHING) * accumulated_ms;
+
+	trend_x[trend_next] = (double)(b->last_arrival_us - first_group_us) / 1000.0;
+	trend_y[trend_next] = smoothed_ms;
+	trend_next = (trend_next + 1) % TREND_WINDOW;
+	if( trend_n < TREND_WINDOW )
+		trend_n++;
+	deltas++;
+
+	if( trend_n < TREND_WINDOW )
+		return;
+
+	for( i = 0; i < trend_n; i++ ) {
+		mx += trend_x[i];
+		my += trend_y[i];
+	}
+	mx /= trend_n;
+	my /= trend_n;
+	for( i = 0; i < trend_n; i++ ) {
+		num += (trend_x[i] - mx) * (trend_y[i] - my);
+		den += (trend_x[i] - mx) * (trend_x[i] - mx);
+	}
+	if( den > 0 )
+		detect(num / den, b->last_arrival_us);
+}
+
+void cc_arrival(
+	unsigned short seq,
+	unsigned int arrival32 )
+{
+	SENT *s = &sent[seq % HISTORY];
+	unsigned long long arrival_us;
+
+	if( s->seq != seq || !s->send_us )
+		return;
+
+	if( !have_arrival ) {
+		have_arrival = 1;
+		last_arrival_us = arrival32;
+	} else {
+		last_arrival_us += (long long)(int)(arrival32 - last_arrival32);
+	}
+	last_arrival32 = arrival32;
+	arrival_us = last_arrival_us;
+
+	/* incoming rate over the last ACKED_WINDOW_US of arrivals */
+	if( acked_count == ACKED ) {
+		acked_sum -= acked_bytes[acked_head];
+		acked_count--;
+		acked_head = (acked_head + 1) % ACKED;
+	}
+	acked_us[(acked_head + acked_count) % ACKED] = arrival_us;
+	acked_bytes[(acked_head + acked_count) % ACKED] = s->bytes;
+	acked_sum += s->bytes;
+	acked_count++;
+	while( acked_count > 1 && arrival_us > acked_us[acked_head] + ACKED_WINDOW_US ) {
+		acked_sum -= acked_bytes[acked_head];
+		acked_count--;
+		acked_head = (acked_head + 1) % ACKED;
+	}
+
+	/* reordered behind the current group, too late to say anything */
+	if( current.valid && s->send_us < current.first_send_us )
+		return;
+
+	if( current.valid && s->send_us - current.first_send_us > GROUP_US ) {
+		if( previous.valid )
+			group_delta(&previous, &current);
+		previous = current;
+		current.valid = 0;
+	}
+
+	if( !current.valid ) {
+		current.valid = 1;
+		current.first_send_us = current.last_send_us = s->send_us;
+		current.last_arrival_us = arrival_us;
+	} else {
+		if( s->send_us > current.last_send_us )
+			current.last_send_us = s->send_us;
+		if( arrival_us > current.last_arrival_us )
+			current.last_arrival_us = arrival_us;
+	}
+}
+
+unsigned int cc_acked_kbps(void)
+{
+	unsigned long long span;
+
+	if( acked_count < 2 )
+		return 0;
+	span = acked_us[(acked_head + acked_count - 1) % ACKED] - acked_us[acked_head];
+	if( span < ACKED_WINDOW_US / 4 )
+		return 0;
+	return (unsigned int)(acked_sum * 8000 / span);
+}
+
+void cc_loss(
+	unsigned int lost,
+	unsigned int total )
+{
+	double fraction;
+
+	if( !total )
+		return;
+	fraction = (double)lost / total;
+
+	if( fraction > 0.10 )
+		loss_kbps = cc_target_kbps() * (1 - 0.5 * fraction);
+	else if( fraction < 0.02 )
+		loss_kbps = loss_kbps * 1.05 + 1;
+
+	if( loss_kbps < min_kbps )
+		loss_kbps = min_kbps;
+	if( loss_kbps > max_kbps )
+		loss_kbps = max_kbps;
+}
+
+void cc_update(
+	unsigned long long now_us )
+{
+	double dt = last_update_us ? (now_us - last_update_us) / 1e6 : 0;
+	double acked = cc_acked_kbps();
+
+	if( dt > 1 )
+		dt = 1;
+	last_update_us = now_us;
+
+	switch( usage ) {
+	case USAGE_OVER:
+		if( now_us - last_decrease_us > DECREASE_US ) {
+			delay_kbps = BETA * (acked ? acked : delay_kbps);
+			last_decrease_kbps = delay_kbps;
+			last_decrease_us = now_us;
+		}
+		rate_state = RATE_DECREASE;
+		break;
+	case USAGE_UNDER:
+		/* the queue is draining, let it */
+		rate_state = RATE_HOLD;
+		break;
+	case USAGE_NORMAL:
+		rate_state = RATE_INCREASE;
+		break;
+	}
+
+	if( rate_state == RATE_INCREASE ) {
+		double before = delay_kbps;
+
+		/* near the rate that last overused go up additively, about a
+		 * packet per response time, else multiplicatively by 8% a second */
+		if( last_decrease_kbps && delay_kbps > 0.9 * last_decrease_kbps &&
+			delay_kbps < 1.2 * last_decrease_kbps )
+			delay_kbps += dt * average_bytes * 8 / 300.0;
+		else
+			delay_kbps *= pow(1.08, dt);
+
+		/* don't run away from what is actually getting through */
+		if( acked && delay_kbps > 1.5 * acked + 10 )
+			delay_kbps = before > 1.5 * acked + 10 ? before : 1.5 * acked + 10;
+	}
+
+	if( delay_kbps < min_kbps )
+		delay_kbps = min_kbps;
+	if( delay_kbps > max_kbps )
+		delay_kbps = max_kbps;
+}
+
+unsigned int cc_target_kbps(void)
+{
+	return (unsigned int)(delay_kbps < loss_kbps ? delay_kbps : loss_kbps);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+/* Sender side congestion control after Google Congestion Control
+ * (draft-ietf-rmcat-gcc-02). The delay based part groups packets by send
+ * time and compares how far apart groups were sent with how far apart the
+ * receiver saw them arrive; a growing difference means a queue is building
+ * somewhere on the path, long before it overflows into loss. A trendline
+ * over that delay drives an overuse detector with an adaptive threshold,
+ * which in turn drives an AIMD rate controller. The loss based part backs
+ * off on heavy loss from the receiver reports. The target is the lower of
+ * the two. Times are in us, rates in kbps. */
+
+void cc_init(
+	unsigned int start_kbps,
+	unsigned int min_kbps,
+	unsigned int max_kbps );
+
+/* moves the bounds of a running controller, the receiver asked for another
+ * bitrate; the estimates are kept, clamped to the new bounds */
+void cc_limits(
+	unsigned int min,
+	unsigned int max );
+
+/* a packet left, first sends and resends alike */
+void cc_sent(
+	unsigned short seq,
+	unsigned int bytes,
+	unsigned long long send_us );
+
+/* the receiver saw seq arrive at arrival_us on its own clock, low 32 bits;
+ * only differences between arrivals are used, so the clocks needn't agree */
+void cc_arrival(
+	unsigned short seq,
+	unsigned int arrival_us );
+
+/* lost out of total packets since the last receiver report */
+void cc_loss(
+	unsigned int lost,
+	unsigned int total );
+
+/* runs the rate controller on what arrived since the last call */
+void cc_update(
+	unsigned long long now_us );
+
+unsigned int cc_target_kbps(void);
+
+/* the rate the receiver is getting packets at, 0 until known */
+unsigned int cc_acked_kbps(void);
+
+#endif/*CONGESTION_H*/
@@ -24,15 +24,21 @@
 #include <stdio.h>
 #include <ctype.h>  //for tolower
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 
 extern "C" {
 #include "rtp.h"
+#include "ivf.h"
+#include "y4m.h"
+#include "stats.h"
+#include "congestion.h"
 #define VPX_CODEC_DISABLE_COMPAT 1
 #include "vpx/vpx_encoder.h"
 #include "vpx/vp8cx.h"
 #include <libuvc/libuvc.h>
 }
+#include <libyuv/scale.h>
 
 
 const int size_buffer = 1680;
@@ -44,8 +50,8 @@ bool buffer_has_frame = false;
 long long last_time_in_nanoseconds = 0;
 int request_recovery = 1;
 vpx_codec_ctx_t encoder;
-int gold_recovery_seq = 0;
-int altref_recovery_seq = 0;
+vpx_codec_enc_cfg_t cfg;
+unsigned short recovery_seq = 0;    // first packet of the newest key or recovery frame
 
 int display_width = 800;
 int display_height = 600;
@@ -53,12 +59,36 @@ int capture_frame_rate = 30;
 int video_bitrate = 400;
 int fec_numerator = 6;
 int fec_denominator = 5;
+const char *impairment_spec = NULL;
+const char *stats_path = NULL;
 unsigned short send_port = 1407;
 unsigned short recv_port = 1408;
+int path_mtu = 0;
+int udp_gso = 0;
+int uring_depth = 0;
+int resend_budget = 25;
+int adaptive_fec = 1;
+int congestion_control = 1;
+int temporal_layers = 1;
+int multicast_ttl = 1;
+
+// what the congestion controller allows, in kbps; the encoder and the resend
+// budget follow it
+unsigned int target_bitrate = 0;
 
 #define PS 2048
 #define PSM  (PS - 1)
 #define MAX_NUMERATOR 16
+#define MAX_DUPLICATES 4            // copies of a packet with duplicate FEC
+
+// the most a session request may ask for, it sizes the capture and encoder
+#define SESSION_MAX_WIDTH  4096
+#define SESSION_MAX_HEIGHT 4096
+#define SESSION_MAX_FPS    120
+#define SESSION_MAX_KBPS   1000000
+
+// what one UDP_SEGMENT send may carry, below the 64k datagram limit
+#define GSO_MAX_BYTES 65000
 
 typedef enum {
 	NONE,
@@ -71,6 +101,7 @@ typedef struct {
 	FEC_TYPE	fecType;
 	unsigned int	fec_numerator;
 	unsigned int	fec_denominator;
+	unsigned int	new_fec_numerator;
 	unsigned int	new_fec_denominator;
 	unsigned int	count;
 	unsigned int	add_ptr;
@@ -79,11 +110,132 @@ typedef struct {
 	unsigned int	fec_count;
 	unsigned short	seq;
 	PACKET		packet[PS];
+	unsigned char	*store;
 } PACKETIZER;
 
 PACKETIZER packetizer;
 tc8 one_packet[8192];
 
+// latency probes by packet store slot, for the first packet of each frame
+typedef struct {
+	unsigned int	timestamp;
+	LATENCY_PROBE	probe;
+} FRAME_PROBE;
+
+int latency_probe = 0;
+FRAME_PROBE probes[PS];
+
+// what goes on the wire, agreed on when the session is set up
+int wire_version = WIRE_VERSION_RAW;
+
+// retransmission cache by sequence number: the store slot a packet went out
+// from (duplicates share a sequence number, so it isn't always seq & PSM),
+// when it first went out and how often it was resent since
+typedef struct {
+	unsigned short	seq;
+	unsigned short	resends;
+	unsigned short	queued;
+	unsigned int	slot;
+	unsigned long long sent_us;
+	unsigned long long resent_us;
+} RTX_ENTRY;
+
+#define RTX_QUEUE 256
+#define RTX_MAX_RESENDS 3
+#define RTX_MAX_AGE_US 500000
+
+RTX_ENTRY rtx_cache[PS];
+unsigned short rtx_queue[RTX_QUEUE];
+unsigned int rtx_head = 0;
+unsigned int rtx_count = 0;
+long long rtx_tokens = 0;
+unsigned long long rtx_refill_us = 0;
+
+// first sequence number of the newest key frame, resends from before it are moot
+unsigned short rtx_key_seq = 0;
+int fresh_key = 0;
+
+// multicast: -i names a group and every packet goes out once for all the
+// receivers that joined it. They are told apart by the address their
+// requests come from. A reference counts as acknowledged once every receiver
+// heard from lately acknowledged it, and one resend answers all requests
+// for a packet that come in while it is on its way.
+#define MAX_MEMBERS 32
+#define MEMBER_TIMEOUT_US 5000000
+#define RTX_HOLDOFF_US 40000
+
+typedef struct {
+	union vpx_sockaddr_x	feedback;
+	unsigned long long	heard_us;
+} MEMBER;
+
+int          multicast = 0;
+MEMBER       members[MAX_MEMBERS];
+unsigned int last_announce = 0;
+
+// the members heard from lately, a bit each
+unsigned int members_active(void)
+{
+	unsigned long long now = get_time_us();
+	unsigned int mask = 0;
+
+	for( unsigned int m = 0; m < MAX_MEMBERS; m++ ) {
+		if( members[m].heard_us && now - members[m].heard_us < MEMBER_TIMEOUT_US ) {
+			mask |= 1u << m;
+		}
+	}
+
+	return mask;
+}
+
+// simulcast: smaller resolutions encoded from the same capture, each by its
+// own encoder on its own thread into its own packet store
+#define MAX_SIMULCAST 3
+
+typedef struct {
+	unsigned int	width;
+	unsigned int	height;
+	vpx_codec_enc_cfg_t cfg;
+	vpx_codec_ctx_t	encoder;
+	vpx_image_t	image;
+	PACKETIZER	packetizer;
+	int		request_key;
+	unsigned int	frame;
+	pthread_t	thread;
+} SIMULCAST;
+
+const char  *simulcast_spec = NULL;
+SIMULCAST    simulcast[MAX_SIMULCAST];
+unsigned int simulcast_count = 0;
+
+// the frame the layers scale and encode while the full resolution one
+// encodes, and how many layers are done with it
+vpx_image_t    *simulcast_img = NULL;
+unsigned int    simulcast_timestamp = 0;
+unsigned int    simulcast_generation = 0;
+unsigned int    simulcast_done = 0;
+int             simulcast_quit = 0;
+pthread_mutex_t simulcast_mtx;
+pthread_cond_t  simulcast_cnd;
+
+// receivers beyond the one the session was set up with (-o); each gets the
+// stream closest to the size it asked for, and is told apart by the address
+// its requests come from
+#define MAX_RECEIVERS 16
+
+typedef struct {
+	union vpx_sockaddr_x	data;
+	union vpx_sockaddr_x	feedback;
+	int			joined;
+	SIMULCAST	       *layer;      // NULL for the full resolution stream
+	unsigned int		invite_at;
+	unsigned int		retry_ms;
+} RECEIVER;
+
+const char  *receivers_spec = NULL;
+RECEIVER     receivers[MAX_RECEIVERS];
+unsigned int receiver_count = 0;
+
 void ctx_exit_on_error(vpx_codec_ctx_t *ctx, const char *s)
 {
 	if (ctx->err) {
@@ -97,12 +249,20 @@ int create_packetizer(
 	PACKETIZER  *packetizer,
 	FEC_TYPE     fecType,
 	unsigned int fec_numerator,
-	unsigned int fec_denominator )
+	unsigned int fec_denominator,
+	unsigned int packet_size )
 {
-	packetizer->size = PACKET_SIZE;
+	// payload slots for the negotiated packet size
+	packetizer->store = packets_alloc(packetizer->packet, PS, packet_size);
+	if( !packetizer->store ) {
+		return -1;
+	}
+
+	packetizer->size = packet_size;
 	packetizer->fecType = fecType;
 	packetizer->fec_numerator = fec_numerator;
 	packetizer->fec_denominator = fec_denominator;
+	packetizer->new_fec_numerator = fec_numerator;
 	packetizer->new_fec_denominator = fec_denominator;
 	packetizer->max       = PS;
 	packetizer->count     = 0;
@@ -115,6 +275,15 @@ int create_packetizer(
 	return 0; // SUCCESS
 }
 
+// a group is sent whole under the FEC it started with, the next one takes
+// up what choose_fec or a reconfigure asked for since
+void fec_next_group(PACKETIZER *p)
+{
+	p->fec_numerator = p->new_fec_numerator;
+	p->fec_denominator = p->new_fec_denominator;
+	p->fec_count = p->fec_denominator;
+}
+
 int make_redundant_packet (
 	PACKETIZER   *p,
 	unsigned int  end_frame,
@@ -126,41 +295,51 @@ int make_redundant_packet (
 	unsigned int i, j;
 	unsigned int max_size = 0;
 	unsigned int max_round;
+	unsigned long long start = get_time_ns();
+
+	// a group closed early at the end of a frame covers fewer packets
+	unsigned int group = p->fec_denominator - p->fec_count;
 
 	// make a number of exact duplicates of this packet
 	if (p->fec_denominator == 1) {
 		int dups = p->fec_numerator - p->fec_denominator;
-		void *duplicand = (void *)&p->packet[(p->add_ptr - 1) & PSM];
+		PACKET *duplicand = &p->packet[(p->add_ptr - 1) & PSM];
 
 		while (dups) {
-			memcpy((void *)&p->packet[p->add_ptr], duplicand, sizeof(PACKET));
+			packet_copy(&p->packet[p->add_ptr], duplicand, p->size);
 			dups--;
 			p->add_ptr++;
 			p->add_ptr &= PSM;
 		}
 
-		p->fec_denominator = p->new_fec_denominator;
-		p->fec_count = p->fec_denominator;
+		stats_add(STAT_FEC_PACKETS, p->fec_numerator - p->fec_denominator);
+		fec_next_group(p);
 		p->count++;
+		stats_since(HIST_FEC, start);
 		return 0;
 	}
 
 	p->packet[p->add_ptr].timestamp = time;
 	p->packet[p->add_ptr].seq = p->seq;
-	p->packet[p->add_ptr].size = max_size;
 	p->packet[p->add_ptr].type = XORPACKET;
-	p->packet[p->add_ptr].redundant_count = p->fec_denominator;
+	p->packet[p->add_ptr].redundant_count = group;
 	p->packet[p->add_ptr].new_frame = 0;
 	p->packet[p->add_ptr].end_frame = end_frame;
 	p->packet[p->add_ptr].frame_type = frametype;
+	p->packet[p->add_ptr].layer = p->packet[(p->add_ptr - 1) & PSM].layer;
+	p->packet[p->add_ptr].tl0_index = p->packet[(p->add_ptr - 1) & PSM].tl0_index;
 
 	// find address of last denominator packets data store in in ptr
-	for (i = 0; i < p->fec_denominator; i++) {
+	for (i = 0; i < group; i++) {
 		int ptr = ((p->add_ptr - i - 1) & PSM);
 		in[i] = (long long *)p->packet[ptr].data;;
 		max_size = (max_size > p->packet[ptr].size ? max_size : p->packet[ptr].size);
 	}
 
+	// the parity is as long as the longest packet it covers, the receiver
+	// zero pads the shorter ones the same way
+	p->packet[p->add_ptr].size = max_size;
+
 	// go through a full packet size
 	max_round = (max_size + sizeof(long long) - 1) / sizeof(long long);
 
@@ -169,7 +348,7 @@ int make_redundant_packet (
 		*out = *(in[0]);
 
 		// xor all the older packets with out
-		for (i = 1; i < p->fec_denominator; i++) {
+		for (i = 1; i < group; i++) {
 			*out ^= *(in[i]);
 			in[i]++;
 		}
@@ -187,11 +366,13 @@ int make_redundant_packet (
 	// add one to our packet count
 	p->count++;
 
+	stats_add(STAT_FEC_PACKETS, 1);
+	stats_since(HIST_FEC, start);
+
 	if (p->count > p->max)
 		return -1;  // filled up our packet buffer
 
-	p->fec_denominator = p->new_fec_denominator;
-	p->fec_count = p->fec_denominator;
+	fec_next_group(p);
 	return 0;
 }
 
@@ -200,13 +381,20 @@ int packetize(
 	unsigned int   time,
 	unsigned char *data,
 	unsigned int   size,
-	unsigned int   frame_type )
+	unsigned int   frame_type,
+	unsigned int   layer,
+	unsigned char  tl0_index )
 {
 	int new_frame = 1;
 
 	// more bytes to copy around
 	while (size > 0) {
 		unsigned int psize = (p->size < size ? p->size : size);
+
+		// with temporal layers the FEC group ends with the frame, so each
+		// layer's parity covers its own packets only
+		unsigned int close_group = temporal_layers > 1 && psize == size && p->fec_denominator > 1;
+
 		p->packet[p->add_ptr].timestamp = time;
 		p->packet[p->add_ptr].seq = p->seq;
 		p->packet[p->add_ptr].size = psize;
@@ -214,11 +402,15 @@ int packetize(
 
 		if (p->fec_denominator == 1)
 			p->packet[p->add_ptr].redundant_count = 2;
+		else if (close_group)
+			p->packet[p->add_ptr].redundant_count = 1;
 		else
 			p->packet[p->add_ptr].redundant_count = p->fec_count;
 
 		p->packet[p->add_ptr].new_frame = new_frame;
 		p->packet[p->add_ptr].frame_type = frame_type;
+		p->packet[p->add_ptr].layer = layer;
+		p->packet[p->add_ptr].tl0_index = tl0_index;
 		//vpxlog_dbg(SKIP, "%c", (frame_type==NORMAL?'N':'O'));
 
 		new_frame = 0;
@@ -245,69 +437,1595 @@ int packetize(
 		// time for redundancy?
 		p->fec_count--;
 
-		if (!p->fec_count)
+		if (!p->fec_count || close_group)
 			make_redundant_packet(p, (size == 0), time, frame_type);
 	}
 
 	return 0;
 }
 
+// the path got narrower than negotiated (a tunnel, a route change),
+// packetize to the MTU the router reported from the next frame on. What is
+// queued or cached was cut for the old size and would bounce the same way,
+// so drop the queue, stop resending from the cache and start over from a
+// key frame
+void path_mtu_dropped(union vpx_sockaddr_x address)
+{
+	tc32 mtu;
+
+	if( vpx_net_path_mtu(vpx_IPv4, &address, &mtu) == TC_OK
+	 && packet_size_for_mtu(mtu, 0) < packetizer.size ) {
+		packetizer.size = packet_size_for_mtu(mtu, 0);
+		vpxlog_dbg(ERRORS, "Path MTU dropped to %d, packets now %d bytes\n", mtu, packetizer.size);
+
+		packetizer.send_ptr = packetizer.add_ptr;
+		packetizer.count = 0;
+		stats_set(STAT_SEND_QUEUE, 0);
+		rtx_key_seq = packetizer.seq;
+
+		if( request_recovery != KEY ) {
+			request_recovery = KEY;
+			stats_add(STAT_RECOVERY_KEY, 1);
+		}
+	}
+}
+
+// serializes the header in front of the payload and sends both in one go,
+// returns the datagram's length or 0 if it didn't go out
+tc32 send_wire(struct vpxsocket *vpxSock, PACKET *pkt, const LATENCY_PROBE *probe, union vpx_sockaddr_x address)
+{
+	tc32 bytes_sent;
+	tc32 head = packet_write_header(pkt, probe, wire_version);
+	TCRV rv = vpx_net_sendto(vpxSock,
+		(tc8 *)pkt->data - head,
+		head + pkt->size,
+		&bytes_sent,
+		address );
+
+	if( rv == TC_MSG_TOO_LARGE ) {
+		path_mtu_dropped(address);
+	}
+	if( rv != TC_OK ) {
+		return 0;
+	}
+
+	cc_sent(pkt->seq, head + pkt->size, get_time_us());
+
+	return head + pkt->size;
+}
+
+// sends the next packet, or with udp_gso the longest run of equal sized
+// datagrams from the queue in one call (only the last one may be shorter)
+// which the kernel or the NIC cuts back apart
 int send_packet(PACKETIZER *p, struct vpxsocket *vpxSock, union vpx_sockaddr_x address)
 {
-	TCRV rc;
+	tc8 *buffers[vpx_NET_MAX_SEGMENTS];
+	tc32 lengths[vpx_NET_MAX_SEGMENTS];
+	tc32 count = 0, total = 0, bytes_sent;
+	unsigned int ptr = p->send_ptr;
+
+	if (p->send_ptr == p->add_ptr)
+		return -1;
+
+	unsigned long long start = get_time_ns();
+
+	do {
+		PACKET *pkt = &p->packet[ptr];
+		FRAME_PROBE *fp = &probes[ptr];
+		LATENCY_PROBE *probe = NULL;
+		tc32 head;
+
+		// the first packet of a frame carries the latency probe, stamped as it leaves
+		if (latency_probe && pkt->new_frame && pkt->type == DATAPACKET
+		 && fp->timestamp == pkt->timestamp && fp->probe.capture_us) {
+			fp->probe.sent_us = get_time_us();
+			probe = &fp->probe;
+		}
+
+		pkt->ssrc = 411;
+		head = packet_write_header(pkt, probe, wire_version);
+
+		// longer than the run's segment size, it starts the next run
+		if (count && head + (tc32)pkt->size > lengths[0])
+			break;
+
+		vpxlog_dbg(LOG_PACKET,
+			"Sent Packet %d, %d, %d : new=%d \n",
+			pkt->seq,
+			pkt->timestamp,
+			pkt->frame_type,
+			pkt->new_frame );
+
+		buffers[count] = (tc8 *)pkt->data - head;
+		lengths[count] = head + (tc32)pkt->size;
+		total += lengths[count++];
+		fp->probe.capture_us = 0;
+
+		RTX_ENTRY *e = &rtx_cache[pkt->seq & PSM];
+		if( e->seq != pkt->seq || !e->sent_us ) {
+			e->seq = pkt->seq;
+			e->slot = ptr;
+			e->resends = 0;
+			e->queued = 0;
+			e->sent_us = get_time_us();
+			e->resent_us = 0;
+		}
+
+		ptr = (ptr + 1) & PSM;
+	} while( udp_gso
+	 && ptr != p->add_ptr
+	 && count < vpx_NET_MAX_SEGMENTS
+	 && lengths[count - 1] == lengths[0]
+	 && total + lengths[0] <= GSO_MAX_BYTES );
+
+	TCRV rv = vpx_net_sendto_segments(vpxSock, buffers, lengths, count, &bytes_sent, address);
+
+	// the same run to the other receivers of the full resolution stream
+	for( unsigned int i = 0; i < receiver_count; i++ ) {
+		if( receivers[i].joined && !receivers[i].layer ) {
+			vpx_net_sendto_segments(vpxSock, buffers, lengths, count, &bytes_sent, receivers[i].data);
+		}
+	}
+
+	// only what left counts towards the congestion controller
+	if( rv == TC_OK ) {
+		unsigned long long now = get_time_us();
+		for( tc32 i = 0; i < count; i++ ) {
+			cc_sent(p->packet[(p->send_ptr + i) & PSM].seq, lengths[i], now);
+		}
+
+		stats_add(STAT_PACKETS_SENT, count);
+		stats_add(STAT_BYTES_SENT, total);
+	}
+
+	stats_since(HIST_SEND, start);
+
+	p->send_ptr = ptr;
+	p->count -= count;
+
+	stats_set(STAT_SEND_QUEUE, (p->add_ptr - p->send_ptr) & PSM);
+
+	// after the run is off the queue, dropping the rest is the last word
+	if( rv == TC_MSG_TOO_LARGE ) {
+		path_mtu_dropped(address);
+	}
+
+	return 0;
+}
+
+
+
+
+// the packet seq went out as, or NULL once its slot has been reused
+PACKET *rtx_packet(unsigned short seq)
+{
+	RTX_ENTRY *e = &rtx_cache[seq & PSM];
+
+	if( e->seq != seq
+	 || !e->sent_us
+	 || packetizer.packet[e->slot].seq != seq ) {
+		return NULL;
+	}
+
+	return &packetizer.packet[e->slot];
+}
+
+// queues a resend for the pacer, checking the cache still holds seq
+int rtx_request(unsigned short seq)
+{
+	RTX_ENTRY *e = &rtx_cache[seq & PSM];
+
+	if( !rtx_packet(seq) ) {
+		stats_add(STAT_RESENDS_STALE, 1);
+		vpxlog_dbg(SKIP, "Resend of %d: no longer in the store\n", seq);
+		return -1;
+	}
+
+	if( e->queued ) {
+		return 0;
+	}
+
+	// the resend that just went to the group answers this request too
+	if( multicast
+	 && e->resent_us
+	 && get_time_us() - e->resent_us < RTX_HOLDOFF_US ) {
+		stats_add(STAT_NACKS_SUPPRESSED, 1);
+		return 0;
+	}
+
+	if( e->resends >= RTX_MAX_RESENDS
+	 || rtx_count == RTX_QUEUE ) {
+		stats_add(STAT_RESENDS_LIMITED, 1);
+		vpxlog_dbg(SKIP, "Resend of %d: limited after %d\n", seq, e->resends);
+		return -1;
+	}
+
+	rtx_queue[(rtx_head + rtx_count++) % RTX_QUEUE] = seq;
+	e->queued = 1;
+	stats_set(STAT_RESEND_QUEUE, rtx_count);
+	return 0;
+}
+
+// sends queued resends as far as the budget, resend_budget percent of the
+// target bitrate, allows; the rest waits for the next frame
+void rtx_drain(struct vpxsocket *vpxSock, union vpx_sockaddr_x address)
+{
+	unsigned long long now = get_time_us();
+	// 200 ms of kbps * 1000 / 8 bytes a second at percent / 100
+	long long burst = (long long)target_bitrate * resend_budget / 4;
+
+	// bytes per us is kbps * 1000 / 8 / 1000000 * percent / 100
+	rtx_tokens += (long long)(now - rtx_refill_us) * target_bitrate * resend_budget / 800000;
+	rtx_refill_us = now;
+
+	// 200 ms worth, but always room for a couple of packets
+	if( burst < 2 * (long long)packetizer.size ) {
+		burst = 2 * packetizer.size;
+	}
+	if( rtx_tokens > burst ) {
+		rtx_tokens = burst;
+	}
+
+	while( rtx_count ) {
+		unsigned short seq = rtx_queue[rtx_head];
+		RTX_ENTRY *e = &rtx_cache[seq & PSM];
+		PACKET *pkt = rtx_packet(seq);
+
+		if( pkt
+		 && now - e->sent_us < RTX_MAX_AGE_US
+		 && (short)(seq - rtx_key_seq) >= 0 ) {
+			if( rtx_tokens < (long long)pkt->size ) {
+				break;
+			}
+
+			rtx_tokens -= send_wire(vpxSock, pkt, NULL, address);
+			e->resends++;
+			e->resent_us = now;
+			stats_add(STAT_PACKETS_RESENT, 1);
+			vpxlog_dbg(SKIP, "Sent recovery packet %d:%d,%d\n", pkt->frame_type, seq, pkt->timestamp);
+		} else {
+			stats_add(STAT_RESENDS_STALE, 1);
+			vpxlog_dbg(SKIP, "Resend of %d: too late\n", seq);
+		}
+
+		e->queued = 0;
+		rtx_head = (rtx_head + 1) % RTX_QUEUE;
+		rtx_count--;
+	}
+
+	stats_set(STAT_RESEND_QUEUE, rtx_count);
+}
+
+// loss the receiver reports, smoothed over the last few reports, in permille
+unsigned int loss_permille = 0;
+unsigned int burst_permille = 0;    // loss runs of 3 or more, of all runs
+unsigned int rebuild_permille = 1000;
+int fec_reports = 0;
+
+void fec_report(const RECEIVER_REPORT *r)
+{
+	unsigned int total = r->received + r->lost;
+	unsigned int runs = r->bursts[0] + r->bursts[1] + r->bursts[2] + r->bursts[3];
+
+	if( !total ) {
+		return;
+	}
+
+	loss_permille = (fec_reports ? 3 * loss_permille : 0) + r->lost * 1000 / total;
+	loss_permille /= fec_reports ? 4 : 1;
+
+	if( runs ) {
+		burst_permille = (3 * burst_permille + (r->bursts[2] + r->bursts[3]) * 1000 / runs) / 4;
+	}
+
+	if( r->lost ) {
+		unsigned int rebuilt = r->rebuilt < r->lost ? r->rebuilt : r->lost;
+		rebuild_permille = (3 * rebuild_permille + rebuilt * 1000 / r->lost) / 4;
+	}
+
+	fec_reports++;
+	vpxlog_dbg(STATS, "Report: %d received, %d lost, %d rebuilt: loss %d bursts %d rebuilt %d permille\n",
+		r->received, r->lost, r->rebuilt, loss_permille, burst_permille, rebuild_permille);
+}
+
+// XOR group for the reported loss: one parity packet per that many packets
+static const struct {
+	unsigned int	loss_permille;
+	unsigned int	group;
+} fec_steps[] = {
+	{    5, 15 },
+	{   10, 10 },
+	{   20,  6 },
+	{   50,  4 },
+	{  100,  3 },
+	{ 1001,  2 },
+};
+
+// sizes the FEC for the next frame, it takes effect at the next group, with
+// temporal layers right away since groups end with the frame
+void choose_fec(PACKETIZER *p, int frame_type, unsigned int layer)
+{
+	unsigned int group = 2;
+	unsigned int i;
+
+	if( adaptive_fec
+	 && fec_reports ) {
+		for( i = 0; i < sizeof(fec_steps) / sizeof(fec_steps[0]); i++ ) {
+			if( loss_permille < fec_steps[i].loss_permille ) {
+				group = fec_steps[i].group;
+				break;
+			}
+		}
+	} else if( temporal_layers > 1
+	        && fec_denominator > 1 ) {
+		group = fec_denominator;
+	} else {
+		return;
+	}
+
+	// key and recovery frames, and with temporal layers every base layer
+	// frame, are what the next frames are predicted from, they get twice the
+	// protection; plain inter frames the lighter one, and the top layer,
+	// which the decoder can do without, half that
+	if( temporal_layers > 1
+	 && layer == (unsigned int)temporal_layers - 1 ) {
+		group = group * 2 < MAX_NUMERATOR - 1 ? group * 2 : MAX_NUMERATOR - 1;
+	} else if( frame_type != NORMAL
+	        || (temporal_layers > 1 && layer == 0) ) {
+		group = group / 2 < 2 ? 2 : group / 2;
+
+		// a parity packet can't repair runs of losses, send them twice
+		if( loss_permille >= 20
+		 && (burst_permille > 500 || rebuild_permille < 500) ) {
+			group = 1;
+		}
+	}
+
+	// the version 1 header counts groups in 3 bits
+	if( wire_version == WIRE_VERSION_RAW
+	 && group > 7 ) {
+		group = 7;
+	}
+
+	p->new_fec_denominator = group;
+	p->new_fec_numerator = group == 1 ? 2 : group + 1;
+	stats_set(STAT_FEC_GROUP, group);
+
+	if( p->fec_count == p->fec_denominator ) {
+		fec_next_group(p);
+	}
+}
+
+// a recovery frame references only the buffer the receiver acknowledged and
+// leaves it alone, so a lost recovery frame can be retried from it
+unsigned int const recovery_flags[] = {
+	0,                                              //   NORMAL, see reference_flags
+	VPX_EFLAG_FORCE_KF,                             //   KEY,
+	VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF |
+	VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_REF_ARF,   //   GOLD = 2,
+	VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF |
+	VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_REF_GF     //   ALTREF = 3
+};
+
+// what the encoder holds in its last (NORMAL), golden (GOLD) and altref
+// (ALTREF) buffers: the frame that last updated each, its packets, and
+// whether the receiver acknowledged decoding it
+typedef struct {
+	unsigned int	timestamp;
+	unsigned short	first_seq;
+	unsigned short	end_seq;
+	int		acked;
+	unsigned int	acked_by;   // multicast members, a bit each
+} REFERENCE;
+
+// golden and altref take turns holding a recent frame, one of them refreshed
+// this often so that a recovery never has to reach back far
+#define REFRESH_FRAMES 30
+
+REFERENCE references[ALTREF + 1];
+unsigned int frames_since_refresh = 0;
+
+// the receiver holds the buffer: it said so, or the buffer was updated since
+// the last key or recovery frame, from frames that build on that one
+int reference_usable(int ref)
+{
+	return references[ref].acked
+	    || (short)(references[ref].first_seq - recovery_seq) >= 0;
+}
+
+// encoder flags for a normal frame: it updates only the last frame buffer,
+// except every REFRESH_FRAMES frames when it refreshes golden or altref
+// while the other one stays acknowledged, and doesn't reference a buffer
+// the receiver may not hold. Enhancement layer frames update nothing, not
+// even the entropy context, so the receiver can drop them.
+unsigned int reference_flags(unsigned int layer)
+{
+	unsigned int flags = 0;
+	int ref = (int)(references[GOLD].timestamp - references[ALTREF].timestamp) <= 0 ? GOLD : ALTREF;
+
+	if( !reference_usable(ALTREF) ) {
+		flags |= VP8_EFLAG_NO_REF_ARF;
+		ref = ALTREF;
+	}
+	if( !reference_usable(GOLD) ) {
+		flags |= VP8_EFLAG_NO_REF_GF;
+		ref = GOLD;
+	}
+
+	if( layer ) {
+		return flags | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF
+			| VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY;
+	}
+
+	// peers without acknowledgements can't tell us, refresh regardless
+	if( ++frames_since_refresh >= REFRESH_FRAMES
+	 && (references[GOLD + ALTREF - ref].acked || wire_version < WIRE_VERSION_ACKS) ) {
+		frames_since_refresh = 0;
+		return flags | (ref == GOLD
+			? VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF
+			: VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF);
+	}
+
+	return flags | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+}
+
+// records which buffers an encoded frame went into
+void update_references(unsigned int flags, unsigned int timestamp, unsigned short first_seq, unsigned short end_seq)
+{
+	int updates[ALTREF + 1];
+
+	updates[NORMAL] = !(flags & VP8_EFLAG_NO_UPD_LAST) || (flags & VPX_EFLAG_FORCE_KF);
+	updates[KEY] = 0;
+	updates[GOLD] = (flags & (VP8_EFLAG_FORCE_GF | VPX_EFLAG_FORCE_KF)) != 0;
+	updates[ALTREF] = (flags & (VP8_EFLAG_FORCE_ARF | VPX_EFLAG_FORCE_KF)) != 0;
+
+	for( int ref = NORMAL; ref <= ALTREF; ref++ ) {
+		if( updates[ref] ) {
+			references[ref].timestamp = timestamp;
+			references[ref].first_seq = first_seq;
+			references[ref].end_seq = end_seq;
+			references[ref].acked = 0;
+			references[ref].acked_by = 0;
+		}
+	}
+}
+
+// the receiver decoded the frame with this timestamp
+void reference_acked(unsigned int timestamp, int member)
+{
+	stats_add(STAT_FRAME_ACKS_RECEIVED, 1);
+
+	for( int ref = NORMAL; ref <= ALTREF; ref++ ) {
+		if( references[ref].timestamp != timestamp ) {
+			continue;
+		}
+
+		if( !multicast ) {
+			references[ref].acked = 1;
+		} else if( member >= 0 ) {
+			unsigned int active = members_active();
+
+			references[ref].acked_by |= 1u << member;
+			references[ref].acked = (references[ref].acked_by & active) == active;
+		}
+	}
+}
+
+// the newest of golden and altref the receiver holds, KEY if neither; peers
+// without acknowledgements are assumed to hold what went out before the
+// packet they gave up on
+int recovery_reference(unsigned short lost_seq)
+{
+	int best = KEY;
+
+	for( int ref = GOLD; ref <= ALTREF; ref++ ) {
+		REFERENCE *r = &references[ref];
+
+		if( wire_version >= WIRE_VERSION_ACKS
+			? !r->acked
+			: (short)(lost_seq - r->end_seq) <= 0 || !reference_usable(ref) ) {
+			continue;
+		}
+
+		if( best == KEY
+		 || (int)(r->timestamp - references[best].timestamp) > 0 ) {
+			best = ref;
+		}
+	}
+
+	return best;
+}
+
+// the group member requests from this address come from, -1 when the group
+// is full. A newcomer holds none of the references the others acknowledged,
+// so they all count as unacknowledged until it acknowledges them too.
+int member_of(union vpx_sockaddr_x *from)
+{
+	unsigned long long now = get_time_us();
+	int slot = -1;
+
+	for( int m = 0; m < MAX_MEMBERS; m++ ) {
+		if( members[m].heard_us
+		 && members[m].feedback.sa_in.sin_addr.s_addr == from->sa_in.sin_addr.s_addr
+		 && members[m].feedback.sa_in.sin_port == from->sa_in.sin_port ) {
+			members[m].heard_us = now;
+			return m;
+		}
+		if( slot < 0
+		 && (!members[m].heard_us || now - members[m].heard_us >= MEMBER_TIMEOUT_US) ) {
+			slot = m;
+		}
+	}
+
+	if( slot < 0 ) {
+		return -1;
+	}
+
+	members[slot].feedback = *from;
+	members[slot].heard_us = now;
+
+	for( int ref = NORMAL; ref <= ALTREF; ref++ ) {
+		references[ref].acked = 0;
+		references[ref].acked_by &= ~(1u << slot);
+	}
+
+	stats_set(STAT_MEMBERS, __builtin_popcount(members_active()));
+	vpxlog_dbg(FRAME, "Receiver %d joined the group\n", slot);
+	return slot;
+}
+
+// the session as confirmed to the receiver that set it up, and the address
+// its requests come from
+SESSION              session;
+union vpx_sockaddr_x session_peer;
+unsigned int         decoder_threads = 1;
+
+void session_send(struct vpxsocket *vpxSock, union vpx_sockaddr_x address, const SESSION *s)
+{
+	unsigned char buffer[SESSION_SIZE];
 	tc32 bytes_sent;
 
-	if (p->send_ptr == p->add_ptr)
-		return -1;
+	vpx_net_sendto(vpxSock, (tc8 *)buffer, session_write(s, buffer), &bytes_sent, address);
+}
+
+// what this sender can do, the receiver requests within it
+void session_offer(SESSION *offer)
+{
+	memset(offer, 0, sizeof(*offer));
+	offer->type = SESSION_OFFER;
+	offer->wire_version = WIRE_VERSION;
+	offer->codecs = SESSION_CODEC_VP8;
+	offer->fec = SESSION_FEC_XOR | SESSION_FEC_DUPLICATE | (adaptive_fec ? SESSION_FEC_ADAPTIVE : 0);
+	offer->fec_numerator = fec_numerator;
+	offer->fec_denominator = fec_denominator;
+	offer->layers = temporal_layers;
+	offer->threads = cfg.g_threads;
+	offer->width = display_width;
+	offer->height = display_height;
+	offer->frame_rate = capture_frame_rate;
+	offer->packet_size = path_mtu ? packet_size_for_mtu(path_mtu, 0) : PACKET_SIZE;
+	offer->kbps = video_bitrate;
+}
+
+// an FEC ratio the packetizer makes: one parity packet per group of up to
+// 15 packets, 7 in the version 1 header, or up to 4 copies of each packet
+int fec_valid(unsigned int numerator, unsigned int denominator, int wire)
+{
+	if( denominator == 1 ) {
+		return numerator >= 1 && numerator <= MAX_DUPLICATES;
+	}
+
+	return denominator >= 2
+	    && denominator <= (wire == WIRE_VERSION_RAW ? 7 : MAX_NUMERATOR - 1)
+	    && (numerator == denominator || numerator == denominator + 1);
+}
+
+// takes the receiver's request as the session's settings, -1 if it asks for
+// nothing this sender can do. The request comes off the network, every
+// value is checked before it sizes anything.
+int session_agree(const SESSION *request)
+{
+	int wire = request->wire_version < WIRE_VERSION ? request->wire_version : WIRE_VERSION;
+
+	if( wire < WIRE_VERSION_RAW ) {
+		wire = WIRE_VERSION_RAW;
+	}
+
+	if( !(request->codecs & SESSION_CODEC_VP8)
+	 || request->width < 16 || request->width > SESSION_MAX_WIDTH
+	 || request->height < 16 || request->height > SESSION_MAX_HEIGHT
+	 || (request->width | request->height) & 1
+	 || !request->frame_rate || request->frame_rate > SESSION_MAX_FPS
+	 || !request->kbps || request->kbps > SESSION_MAX_KBPS
+	 || !fec_valid(request->fec_numerator, request->fec_denominator, wire) ) {
+		vpxlog_dbg(ERRORS, "Can't serve %dx%d %dfps %dkbps %d/%dFEC codecs %x\n",
+			request->width, request->height, request->frame_rate, request->kbps,
+			request->fec_numerator, request->fec_denominator, request->codecs);
+		return -1;
+	}
+
+	display_width = request->width;
+	display_height = request->height;
+	capture_frame_rate = request->frame_rate;
+	video_bitrate = request->kbps;
+	fec_numerator = request->fec_numerator;
+	fec_denominator = request->fec_denominator;
+	wire_version = wire;
+
+	// no parity packets for a receiver that can't rebuild from them, and
+	// no sizing from reports it doesn't send
+	if( !(request->fec & SESSION_FEC_XOR)
+	 && fec_numerator < 2 * fec_denominator ) {
+		fec_numerator = fec_denominator;
+	}
+	if( !(request->fec & SESSION_FEC_ADAPTIVE)
+	 || !(request->fec & SESSION_FEC_XOR) ) {
+		adaptive_fec = 0;
+	}
+
+	// more layers than it knows to drop would only cost it frames
+	if( temporal_layers > (request->layers ? request->layers : 1) ) {
+		temporal_layers = request->layers ? request->layers : 1;
+	}
+
+	decoder_threads = request->threads ? request->threads : 1;
+
+	printf("Dimensions: %dx%-d %dfps %dkbps %d/%dFEC wire v%d\n",
+	       display_width,
+	       display_height,
+	       capture_frame_rate,
+	       video_bitrate,
+	       fec_numerator,
+	       fec_denominator,
+	       wire_version);
+	return 0;
+}
+
+// what the session uses now, for this generation of the request
+void session_confirmed(unsigned char generation)
+{
+	memset(&session, 0, sizeof(session));
+	session.type = SESSION_CONFIRM;
+	session.generation = generation;
+	session.wire_version = wire_version;
+	session.codecs = SESSION_CODEC_VP8;
+	session.fec = (fec_numerator >= 2 * fec_denominator ? SESSION_FEC_DUPLICATE : 0)
+	            | (fec_numerator > fec_denominator ? SESSION_FEC_XOR : 0)
+	            | (adaptive_fec ? SESSION_FEC_XOR | SESSION_FEC_DUPLICATE | SESSION_FEC_ADAPTIVE : 0);
+	session.fec_numerator = fec_numerator;
+	session.fec_denominator = fec_denominator;
+	session.layers = temporal_layers;
+	session.threads = cfg.g_threads;
+	session.width = display_width;
+	session.height = display_height;
+	session.frame_rate = capture_frame_rate;
+	session.packet_size = packetizer.size;
+	session.kbps = video_bitrate;
+}
+
+// a running session takes a new bitrate and FEC; the size, frame rate,
+// layers and packets stay what the encoder and the packet store were set up
+// for. A request out of bounds changes nothing. Whatever it ends up using is
+// confirmed under the new generation.
+void session_reconfigure(const SESSION *request)
+{
+	if( request->kbps > SESSION_MAX_KBPS
+	 || (request->fec_denominator
+	  && !fec_valid(request->fec_numerator, request->fec_denominator, wire_version)) ) {
+		vpxlog_dbg(ERRORS, "Can't change to %dkbps %d/%dFEC\n",
+			request->kbps, request->fec_numerator, request->fec_denominator);
+		session_confirmed(request->generation);
+		return;
+	}
+
+	if( request->kbps ) {
+		video_bitrate = request->kbps;
+		if( congestion_control ) {
+			cc_limits(video_bitrate / 10, video_bitrate);
+		} else {
+			target_bitrate = video_bitrate;
+		}
+	}
+
+	// the next group takes it, or choose_fec from the reports
+	if( request->fec_denominator ) {
+		fec_numerator = request->fec_numerator;
+		fec_denominator = request->fec_denominator;
+		packetizer.new_fec_numerator = fec_numerator;
+		packetizer.new_fec_denominator = fec_denominator;
+
+		if( packetizer.fec_count == packetizer.fec_denominator ) {
+			fec_next_group(&packetizer);
+		}
+	}
+
+	session_confirmed(request->generation);
+	printf("Reconfigured: %dkbps %d/%dFEC\n", video_bitrate, fec_numerator, fec_denominator);
+}
+
+// VP8 splits a frame's tokens into up to 8 partitions the decoder can work
+// on in parallel, as many as the receiver has threads for
+int token_partitions(unsigned int threads)
+{
+	return threads >= 8 ? VP8_EIGHT_TOKENPARTITION
+	     : threads >= 4 ? VP8_FOUR_TOKENPARTITION
+	     : threads >= 2 ? VP8_TWO_TOKENPARTITION
+	     : VP8_ONE_TOKENPARTITION;
+}
+
+// tells receivers that join the group late what the session agreed on, the
+// same way the first one was told
+void multicast_announce(struct vpxsocket *vpxSock, union vpx_sockaddr_x address)
+{
+	if( get_time() - last_announce < 1000 ) {
+		return;
+	}
+	last_announce = get_time();
+
+	session_send(vpxSock, address, &session);
+}
+
+uvc_context_t       *uvc_ctx;
+uvc_error_t          uvc_res;
+uvc_device_t        *uvc_dev;
+uvc_device_handle_t *uvc_devh;
+uvc_stream_ctrl_t    uvc_ctrl;
+int                  capture_width = 0;   // what the camera streams, 0 if not
+int                  capture_height = 0;
+
+pthread_cond_t  frame_cnd;
+pthread_mutex_t frame_mtx;
+int             session_live = 0;   // the packetizer is there, frames go out; atomic
+
+unsigned i_frame = 0;
+
+// Temporal layers: the base layer at half (two layers) or a quarter (three)
+// of the frame rate, the frames in between enhancement layer frames that are
+// predicted from the base layer only, so any of them can go missing. The
+// encoder's rate control gets a cumulative bitrate per layer.
+static const unsigned int layer_ids[3][4] = {
+	{ 0 },
+	{ 0, 1 },
+	{ 0, 2, 1, 2 },
+};
+static const unsigned int layer_percent[3][3] = {
+	{ 100 },
+	{ 60, 100 },
+	{ 40, 60, 100 },
+};
+
+unsigned int layer_frame = 0;       // position in the layer pattern
+unsigned char tl0_index = 0;        // base layer frames, counting
+
+void layer_bitrates(vpx_codec_enc_cfg_t *c)
+{
+	for( unsigned int i = 0; i < c->ts_number_layers; i++ ) {
+		c->ts_target_bitrate[i] = c->rc_target_bitrate * layer_percent[c->ts_number_layers - 1][i] / 100;
+	}
+}
+
+void layer_config(vpx_codec_enc_cfg_t *c)
+{
+	if( temporal_layers < 2 ) {
+		c->ts_number_layers = 1;
+		c->ts_periodicity = 0;
+		return;
+	}
+
+	c->ts_number_layers = temporal_layers;
+	c->ts_periodicity = temporal_layers == 2 ? 2 : 4;
+	for( unsigned int i = 0; i < c->ts_periodicity; i++ ) {
+		c->ts_layer_id[i] = layer_ids[temporal_layers - 1][i];
+	}
+	for( int i = 0; i < temporal_layers; i++ ) {
+		c->ts_rate_decimator[i] = 1 << (temporal_layers - 1 - i);
+	}
+	layer_bitrates(c);
+}
+
+// Sizes the full resolution stream is encoded at when the congestion
+// controller leaves too few bits per pixel, in eighths of the session's
+// width and height. The size steps down once the target falls below half the
+// session's bitrate for the pixels encoded, and back up once it reaches
+// three quarters of that for the larger size; the gap keeps it from flapping
+// between the two. A change waits for a key frame, the receiver's decoder
+// takes the new size from it.
+static const unsigned int scale_eighths[3] = { 8, 6, 4 };
+
+unsigned int scale_step = 0;        // size being encoded
+unsigned int scale_wanted = 0;      // size for the next key frame
+unsigned int scale_held = 0;        // a resize failed, stay at the full size
+vpx_image_t  scaled_img;            // the frame scaled down to it
+
+// picks the size for the bitrate the congestion controller allows and asks
+// for the key frame to change to it on, must hold frame_mtx
+void choose_scale(void)
+{
+	unsigned int e;
+
+	scale_wanted = scale_step;
+	if( !target_bitrate
+	 || scale_held ) {
+		return;
+	}
+
+	e = scale_eighths[scale_step];
+	if( scale_step < 2
+	 && target_bitrate * 128 < (unsigned int)video_bitrate * e * e ) {
+		scale_wanted = scale_step + 1;
+	} else if( scale_step > 0 ) {
+		e = scale_eighths[scale_step - 1];
+		if( target_bitrate * 256 >= (unsigned int)video_bitrate * e * e * 3 ) {
+			scale_wanted = scale_step - 1;
+		}
+	}
+
+	if( scale_wanted != scale_step
+	 && !request_recovery ) {
+		request_recovery = KEY;
+		stats_add(STAT_RECOVERY_KEY, 1);
+	}
+}
+
+// resizes the encoder in place, it never grows beyond the size it was set
+// up with so libvpx takes that without a new encoder. If that fails the
+// stream goes back to the full size and stays there. Must hold frame_mtx.
+int scale_encoder(unsigned int step)
+{
+	unsigned int width = (display_width * scale_eighths[step] / 8) & ~1;
+	unsigned int height = (display_height * scale_eighths[step] / 8) & ~1;
+
+	// vpx_img_free leaves the pointers, a second free would be a double one
+	vpx_img_free(&scaled_img);
+	memset(&scaled_img, 0, sizeof(scaled_img));
+
+	cfg.g_w = width;
+	cfg.g_h = height;
+	if( (step && !vpx_img_alloc(&scaled_img, VPX_IMG_FMT_I420, width, height, 1))
+	 || vpx_codec_enc_config_set(&encoder, &cfg) ) {
+		vpxlog_dbg(ERRORS, "Failed to encode at %dx%d: %s\n", width, height, vpx_codec_error(&encoder));
+		vpx_img_free(&scaled_img);
+		memset(&scaled_img, 0, sizeof(scaled_img));
+		cfg.g_w = display_width;
+		cfg.g_h = display_height;
+		vpx_codec_enc_config_set(&encoder, &cfg);
+		scale_step = scale_wanted = 0;
+		scale_held = 1;
+		stats_set(STAT_ENCODE_WIDTH, display_width);
+		return -1;
+	}
+
+	vpxlog_dbg(FRAME, "Encoding %dx%d\n", width, height);
+	scale_step = step;
+	stats_set(STAT_ENCODE_WIDTH, width);
+	return 0;
+}
+
+unsigned long long media_epoch_us = 0;
+unsigned int       media_last_ts = 0;
+
+// 90 kHz RTP timestamp of a frame captured at capture_us, must hold frame_mtx.
+// Counts from the first frame, starts at 1 (the receiver treats 0 as empty)
+// and never repeats or runs backwards, the receiver keys frames on it.
+unsigned int media_timestamp(unsigned long long capture_us)
+{
+	unsigned int ts;
+
+	if( !media_last_ts ) {
+		media_epoch_us = capture_us;
+	}
+
+	ts = 1 + (unsigned int)((capture_us - media_epoch_us) * RTP_CLOCK_RATE / 1000000);
+
+	if( (int)(ts - media_last_ts) <= 0 ) {
+		ts = media_last_ts + 1;
+	}
+
+	media_last_ts = ts;
+	return ts;
+}
+
+// hands one compressed frame to the packetizer, must hold frame_mtx
+int packetize_frame(unsigned char *buf, unsigned int size, int frame_type, unsigned int layer, unsigned int timestamp, unsigned long long capture_us)
+{
+	unsigned long long encoded_us = get_time_us();
+
+	// a recovery frame was requested move sendptr to current ptr, so that we
+	// don't spend datarate sending packets that won't be used.
+	if( request_recovery ) {
+		packetizer.send_ptr = packetizer.add_ptr;
+		request_recovery = 0;
+	}
+
+	if( frame_type != NORMAL ) {
+		recovery_seq = packetizer.seq;
+	}
+
+	if( frame_type == KEY ) {
+		rtx_key_seq = packetizer.seq;
+		fresh_key = 1;
+	}
+
+	// every packet names the base layer frame its frame builds on, so the
+	// receiver can tell whether a hole took one
+	if( layer == 0 ) {
+		tl0_index++;
+	}
+
+	choose_fec(&packetizer, frame_type, layer);
+
+	unsigned long long start = get_time_ns();
+
+	probes[packetizer.add_ptr].timestamp = timestamp;
+	probes[packetizer.add_ptr].probe.capture_us = capture_us;
+	probes[packetizer.add_ptr].probe.encoded_us = encoded_us;
+
+	packetize(&packetizer,
+		timestamp,
+		buf,
+		size,
+		frame_type,
+		layer,
+		temporal_layers > 1 ? tl0_index : 0);
+
+	stats_since(HIST_PACKETIZE, start);
+	stats_set(STAT_SEND_QUEUE, (packetizer.add_ptr - packetizer.send_ptr) & PSM);
+
+	vpxlog_dbg(FRAME,
+		"Frame %d %d %d %d\n",
+		packetizer.packet[packetizer.send_ptr].seq,
+		size,
+		packetizer.packet[packetizer.send_ptr].timestamp,
+		recovery_seq );
+
+	return 0;
+}
+
+// scales the frame down to the layer's size and encodes it into the layer's
+// packet store, on the layer's own thread
+void simulcast_encode(SIMULCAST *l, const vpx_image_t *img, unsigned int timestamp)
+{
+	unsigned long long start = get_time_ns();
+	int key = l->request_key;
+
+	libyuv::I420Scale(
+		img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+		img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+		img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+		img->d_w, img->d_h,
+		l->image.planes[VPX_PLANE_Y], l->image.stride[VPX_PLANE_Y],
+		l->image.planes[VPX_PLANE_U], l->image.stride[VPX_PLANE_U],
+		l->image.planes[VPX_PLANE_V], l->image.stride[VPX_PLANE_V],
+		l->width, l->height,
+		libyuv::kFilterBox);
+
+	stats_since(HIST_SCALE, start);
+
+	if( VPX_CODEC_OK != vpx_codec_encode(&l->encoder,
+		&l->image,
+		l->frame++,
+		1,
+		key ? VPX_EFLAG_FORCE_KF : 0,
+		VPX_DL_REALTIME )
+	) {
+		vpxlog_dbg(ERRORS, "Failed to encode %dx%d frame: %s\n",
+			l->width,
+			l->height,
+			vpx_codec_error(&l->encoder));
+		return;
+	}
+
+	vpx_codec_iter_t iter = NULL;
+	vpx_codec_cx_pkt_t const *pkt;
+	while( (pkt = vpx_codec_get_cx_data(&l->encoder, &iter)) ) {
+		if( pkt->kind != VPX_CODEC_CX_FRAME_PKT ) {
+			continue;
+		}
+
+		// nothing queued before a key frame is of use any more
+		if( key ) {
+			l->packetizer.send_ptr = l->packetizer.add_ptr;
+			l->packetizer.count = 0;
+			l->request_key = 0;
+		}
+
+		stats_add(STAT_SIMULCAST_FRAMES, 1);
+		packetize(&l->packetizer,
+			timestamp,
+			(unsigned char *)pkt->data.frame.buf,
+			pkt->data.frame.sz,
+			key ? KEY : NORMAL,
+			0,
+			0);
+	}
+}
+
+void *simulcast_worker(void *ptr)
+{
+	SIMULCAST *l = (SIMULCAST *)ptr;
+	unsigned int generation = 0;
+
+	for(;;) {
+		pthread_mutex_lock(&simulcast_mtx);
+		while( generation == simulcast_generation && !simulcast_quit ) {
+			pthread_cond_wait(&simulcast_cnd, &simulcast_mtx);
+		}
+		generation = simulcast_generation;
+		pthread_mutex_unlock(&simulcast_mtx);
+
+		if( simulcast_quit ) {
+			break;
+		}
+
+		// the capturing thread holds frame_mtx until all layers are done,
+		// so the receivers and the packet store are ours meanwhile
+		for( unsigned int i = 0; i < receiver_count; i++ ) {
+			if( receivers[i].joined && receivers[i].layer == l ) {
+				simulcast_encode(l, simulcast_img, simulcast_timestamp);
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&simulcast_mtx);
+		simulcast_done++;
+		pthread_cond_broadcast(&simulcast_cnd);
+		pthread_mutex_unlock(&simulcast_mtx);
+	}
+
+	return NULL;
+}
+
+// hands the frame to the layers, they scale and encode it in parallel with
+// the full resolution encode
+void simulcast_start(vpx_image_t *img, unsigned int timestamp)
+{
+	if( !simulcast_count ) {
+		return;
+	}
+
+	pthread_mutex_lock(&simulcast_mtx);
+	simulcast_img = img;
+	simulcast_timestamp = timestamp;
+	simulcast_done = 0;
+	simulcast_generation++;
+	pthread_cond_broadcast(&simulcast_cnd);
+	pthread_mutex_unlock(&simulcast_mtx);
+}
+
+// waits for the layers to be done with the frame, it goes away after this
+void simulcast_wait(void)
+{
+	if( !simulcast_count ) {
+		return;
+	}
+
+	pthread_mutex_lock(&simulcast_mtx);
+	while( simulcast_done < simulcast_count ) {
+		pthread_cond_wait(&simulcast_cnd, &simulcast_mtx);
+	}
+	pthread_mutex_unlock(&simulcast_mtx);
+}
+
+// sets up a layer per WxH[@kbps] in the comma separated spec, smaller than
+// the full resolution; without a bitrate a layer gets the receiver's by
+// its share of the pixels
+int simulcast_open(const char *spec, unsigned int packet_size)
+{
+	char list[256];
+	char *s;
+
+	FAIL_ON_NONZERO( pthread_mutex_init(&simulcast_mtx, NULL)
+	 || pthread_cond_init(&simulcast_cnd, NULL) )
+
+	strncpy(list, spec, sizeof(list) - 1);
+	list[sizeof(list) - 1] = 0;
+
+	for( s = strtok(list, ","); s && simulcast_count < MAX_SIMULCAST; s = strtok(NULL, ",") ) {
+		SIMULCAST *l = &simulcast[simulcast_count];
+		unsigned int bitrate = 0;
+
+		memset(l, 0, sizeof(*l));
+		if( sscanf(s, "%ux%u@%u", &l->width, &l->height, &bitrate) < 2
+		 || l->width < 16 || l->width >= (unsigned int)display_width
+		 || l->height < 16 || l->height >= (unsigned int)display_height ) {
+			fprintf(stderr, "Ignoring simulcast layer %s\n", s);
+			continue;
+		}
+
+		if( !bitrate ) {
+			bitrate = (unsigned int)((unsigned long long)video_bitrate
+				* l->width * l->height / (display_width * display_height));
+		}
+
+		// every layer frame is a base layer frame, it has a receiver of
+		// its own to recover
+		l->cfg = cfg;
+		l->cfg.g_w = l->width;
+		l->cfg.g_h = l->height;
+		l->cfg.rc_target_bitrate = bitrate > 30 ? bitrate : 30;
+		l->cfg.ts_number_layers = 1;
+		l->cfg.ts_periodicity = 0;
+
+		FAIL_ON_ZERO( vpx_img_alloc(&l->image,
+			VPX_IMG_FMT_I420, l->width, l->height, 1) )
+
+		if( vpx_codec_enc_init(&l->encoder, &vpx_codec_vp8_cx_algo, &l->cfg, 0) ) {
+			vpxlog_dbg(ERRORS, "Failed to set up the %dx%d encoder: %s\n",
+				l->width,
+				l->height,
+				vpx_codec_error(&l->encoder));
+			vpx_img_free(&l->image);
+			return -1;
+		}
+
+		FAIL_ON_NONZERO( create_packetizer(&l->packetizer, XOR, fec_numerator, fec_denominator, packet_size) )
+		l->request_key = 1;
+
+		FAIL_ON_NONZERO( pthread_create(&l->thread, NULL, simulcast_worker, l) )
+		simulcast_count++;
+
+		printf("Simulcast %dx%d %dkbps\n", l->width, l->height, l->cfg.rc_target_bitrate);
+	}
+
+	return 0;
+}
+
+void simulcast_close(void)
+{
+	if( !simulcast_count ) {
+		return;
+	}
+
+	pthread_mutex_lock(&simulcast_mtx);
+	simulcast_quit = 1;
+	pthread_cond_broadcast(&simulcast_cnd);
+	pthread_mutex_unlock(&simulcast_mtx);
+
+	for( unsigned int i = 0; i < simulcast_count; i++ ) {
+		pthread_join(simulcast[i].thread, NULL);
+		vpx_codec_destroy(&simulcast[i].encoder);
+		vpx_img_free(&simulcast[i].image);
+		free(simulcast[i].packetizer.store);
+	}
+}
+
+// sends what the layer queued to the receivers that take it, must hold frame_mtx
+void simulcast_send(SIMULCAST *l, struct vpxsocket *vpxSock)
+{
+	PACKETIZER *p = &l->packetizer;
+	tc32 bytes_sent;
+
+	while( p->send_ptr != p->add_ptr ) {
+		PACKET *pkt = &p->packet[p->send_ptr];
+		tc32 head;
+
+		pkt->ssrc = 411;
+		head = packet_write_header(pkt, NULL, wire_version);
+
+		for( unsigned int i = 0; i < receiver_count; i++ ) {
+			if( receivers[i].joined && receivers[i].layer == l ) {
+				vpx_net_sendto(vpxSock,
+					(tc8 *)pkt->data - head,
+					head + pkt->size,
+					&bytes_sent,
+					receivers[i].data );
+				stats_add(STAT_PACKETS_SENT, 1);
+				stats_add(STAT_BYTES_SENT, head + pkt->size);
+			}
+		}
+
+		p->send_ptr = (p->send_ptr + 1) & PSM;
+		if( p->count ) {
+			p->count--;
+		}
+	}
+}
+
+// the further receivers to invite, ip:port with the port the receiver
+// takes video on, comma separated
+int receivers_open(const char *spec)
+{
+	char list[1024];
+	char *s;
+
+	strncpy(list, spec, sizeof(list) - 1);
+	list[sizeof(list) - 1] = 0;
+
+	for( s = strtok(list, ","); s && receiver_count < MAX_RECEIVERS; s = strtok(NULL, ",") ) {
+		RECEIVER *r = &receivers[receiver_count];
+		char *colon = strchr(s, ':');
+		unsigned short port = send_port;
+
+		if( colon ) {
+			*colon = 0;
+			port = atoi(colon + 1);
+		}
+
+		memset(r, 0, sizeof(*r));
+		FAIL_ON_NONZERO( vpx_net_get_addr_info(s, port, vpx_IPv4, vpx_UDP, &r->data) )
+		r->invite_at = get_time();
+		r->retry_ms = SESSION_RETRY_MIN_MS;
+		receiver_count++;
+	}
+
+	return 0;
+}
+
+// offers the receivers that haven't joined yet a session, the same way the
+// first one was, backing off per receiver
+void receivers_invite(struct vpxsocket *vpxSock)
+{
+	SESSION offer;
+
+	session_offer(&offer);
+	offer.packet_size = packetizer.size;
+
+	for( unsigned int i = 0; i < receiver_count; i++ ) {
+		RECEIVER *r = &receivers[i];
+
+		if( !r->joined
+		 && (int)(get_time() - r->invite_at) >= 0 ) {
+			session_send(vpxSock, r->data, &offer);
+			r->invite_at = session_retry(get_time(), &r->retry_ms);
+		}
+	}
+}
+
+// the receiver whose requests come from this address, NULL for the first
+RECEIVER *receiver_of(union vpx_sockaddr_x *from)
+{
+	for( unsigned int i = 0; i < receiver_count; i++ ) {
+		if( receivers[i].joined
+		 && receivers[i].feedback.sa_in.sin_addr.s_addr == from->sa_in.sin_addr.s_addr
+		 && receivers[i].feedback.sa_in.sin_port == from->sa_in.sin_port ) {
+			return &receivers[i];
+		}
+	}
+
+	return NULL;
+}
+
+// a further receiver's request: the stream is the full resolution one
+// when it asked for at least that much, else the largest layer no wider
+// than asked for, or the smallest. The wire format and the packet size are
+// the session's, a receiver that can't take them isn't served.
+void receiver_join(struct vpxsocket *vpxSock, union vpx_sockaddr_x *from, const SESSION *request)
+{
+	RECEIVER *r = NULL;
+
+	for( unsigned int i = 0; i < receiver_count; i++ ) {
+		if( receivers[i].data.sa_in.sin_addr.s_addr == from->sa_in.sin_addr.s_addr
+		 && receivers[i].data.sa_in.sin_port == htons(request->data_port) ) {
+			r = &receivers[i];
+		}
+	}
+
+	if( !r ) {
+		vpxlog_dbg(LOG_PACKET, "Request from a receiver not asked for\n");
+		return;
+	}
+
+	// it repeats its request until it sees the confirmation
+	if( !r->joined ) {
+		SIMULCAST *best = NULL, *smallest = NULL;
+
+		if( request->width < display_width ) {
+			for( unsigned int i = 0; i < simulcast_count; i++ ) {
+				SIMULCAST *l = &simulcast[i];
+
+				if( !smallest || l->width < smallest->width ) {
+					smallest = l;
+				}
+				if( l->width <= request->width
+				 && (!best || l->width > best->width) ) {
+					best = l;
+				}
+			}
+		}
+		r->layer = best ? best : smallest;
+
+		if( !(request->codecs & SESSION_CODEC_VP8)
+		 || request->wire_version < wire_version
+		 || request->packet_size < (r->layer ? r->layer->packetizer.size : packetizer.size) ) {
+			vpxlog_dbg(ERRORS, "Receiver on port %d takes wire v%d, %d byte packets, can't serve it\n",
+				request->data_port, request->wire_version, request->packet_size);
+			return;
+		}
+
+		// a newcomer needs a key frame to start from
+		if( r->layer ) {
+			r->layer->request_key = 1;
+		} else if( !request_recovery ) {
+			request_recovery = KEY;
+		}
+
+		r->feedback = *from;
+		r->joined = 1;
+		stats_add(STAT_RECEIVERS, 1);
+
+		printf("Receiver on port %d asked for %dx%d, gets %dx%d\n",
+			request->data_port,
+			request->width,
+			request->height,
+			r->layer ? r->layer->width : display_width,
+			r->layer ? r->layer->height : display_height);
+	}
+
+	// its stream's size and bitrate, the session's everything else; it
+	// can't change them, but is told what it gets for each generation
+	SESSION confirm = session;
+
+	confirm.generation = request->generation;
+	if( r->layer ) {
+		confirm.width = r->layer->width;
+		confirm.height = r->layer->height;
+		confirm.packet_size = r->layer->packetizer.size;
+		confirm.kbps = r->layer->cfg.rc_target_bitrate;
+		confirm.layers = 1;
+	}
+	session_send(vpxSock, r->data, &confirm);
+}
+
+// a further receiver's requests: resends straight from the packet store of
+// its stream, give ups get a key frame. The reference tracking, the
+// congestion controller and the FEC sizing follow the first receiver only,
+// so its reports, arrivals and acks are dropped.
+void receiver_feedback(RECEIVER *r, struct vpxsocket *vpxSock, const unsigned char *buf, int bytes)
+{
+	RECEIVER_REPORT report;
+	unsigned int timestamp;
+	ARRIVAL arrivals[ARRIVAL_MAX];
+	PACKET *pkt;
+	tc32 bytes_sent;
+
+	if( !report_read(buf, bytes, &report)
+	 || !ack_read(buf, bytes, &timestamp)
+	 || arrivals_read(buf, bytes, arrivals) >= 0
+	 || bytes < 3 ) {
+		return;
+	}
+
+	unsigned char command = buf[0];
+	unsigned short seq = buf[1] | buf[2] << 8;
+
+	stats_add(command == 'g' ? STAT_GIVE_UPS_RECEIVED : STAT_NACKS_RECEIVED, 1);
+
+	if( command == 'g' ) {
+		if( r->layer ) {
+			r->layer->request_key = 1;
+		} else if( !request_recovery ) {
+			request_recovery = KEY;
+			stats_add(STAT_RECOVERY_KEY, 1);
+		}
+		return;
+	}
+
+	if( r->layer ) {
+		pkt = &r->layer->packetizer.packet[seq & PSM];
+		if( pkt->seq != seq ) {
+			stats_add(STAT_RESENDS_STALE, 1);
+			return;
+		}
+	} else if( !(pkt = rtx_packet(seq)) ) {
+		stats_add(STAT_RESENDS_STALE, 1);
+		return;
+	}
+
+	tc32 head = packet_write_header(pkt, NULL, wire_version);
+	vpx_net_sendto(vpxSock, (tc8 *)pkt->data - head, head + pkt->size, &bytes_sent, r->data);
+	stats_add(STAT_PACKETS_RESENT, 1);
+}
+
+// Encoder effort follows the time encoding takes against the frame interval,
+// so a loaded machine gives up quality a step at a time instead of dropping
+// frames. Every 15 frames, an average over 70% of the interval drops the
+// noise reduction first, then raises the speed by 2 up to 16, then doubles
+// the static threshold up to 8 times; under 35% gives them back one step at
+// a time the other way round. A negative -c leaves the speed to libvpx and
+// the effort as set.
+#define TUNE_FRAMES       15
+#define TUNE_MAX_SPEED    16
+#define TUNE_MAX_SHIFT    3
+
+int cpu_used = 6;                   // the least speed
+int noise_sensitivity = 1;          // the most noise reduction
+int static_threshold = 1200;        // the least static threshold
+int tune_speed = 0;
+int tune_noise = 0;
+int tune_shift = 0;
+unsigned long long tune_ns = 0;
+unsigned int tune_frames = 0;
+
+void tune_apply(void)
+{
+	vpx_codec_control(&encoder, VP8E_SET_CPUUSED, tune_speed);
+	vpx_codec_control(&encoder, VP8E_SET_NOISE_SENSITIVITY, tune_noise);
+	vpx_codec_control(&encoder, VP8E_SET_STATIC_THRESHOLD, static_threshold << tune_shift);
+
+	stats_set(STAT_CPU_USED, tune_speed);
+	stats_set(STAT_NOISE_SENSITIVITY, tune_noise);
+	stats_set(STAT_STATIC_THRESHOLD, static_threshold << tune_shift);
+}
+
+void tune_init(void)
+{
+	tune_speed = cpu_used;
+	tune_noise = noise_sensitivity;
+	tune_shift = 0;
+	tune_apply();
+}
+
+// takes one frame's encode time, must hold frame_mtx
+void tune_encoder(unsigned long long encode_ns)
+{
+	unsigned long long interval_ns = 1000000000ULL / capture_frame_rate;
+	unsigned int load;
+
+	tune_ns += encode_ns;
+	if( ++tune_frames < TUNE_FRAMES ) {
+		return;
+	}
+
+	load = (unsigned int)(tune_ns * 100 / (interval_ns * tune_frames));
+	tune_ns = 0;
+	tune_frames = 0;
+	stats_set(STAT_ENCODE_LOAD, load);
+
+	if( cpu_used < 0 ) {
+		return;
+	}
+
+	if( load > 70 ) {
+		if( tune_noise ) {
+			tune_noise = 0;
+		} else if( tune_speed < TUNE_MAX_SPEED ) {
+			tune_speed = tune_speed + 2 < TUNE_MAX_SPEED ? tune_speed + 2 : TUNE_MAX_SPEED;
+		} else if( tune_shift < TUNE_MAX_SHIFT ) {
+			tune_shift++;
+		} else {
+			return;
+		}
+	} else if( load < 35 ) {
+		if( tune_shift ) {
+			tune_shift--;
+		} else if( tune_speed > cpu_used ) {
+			tune_speed--;
+		} else if( tune_noise < noise_sensitivity ) {
+			tune_noise = noise_sensitivity;
+		} else {
+			return;
+		}
+	} else {
+		return;
+	}
+
+	vpxlog_dbg(FRAME, "Encoding takes %d%% of the frame interval: speed %d, noise reduction %d, static threshold %d\n",
+		load, tune_speed, tune_noise, static_threshold << tune_shift);
+	tune_apply();
+}
+
+// encodes one raw frame and packetizes the result, must hold frame_mtx
+int compress_and_packetize(vpx_image_t *img, unsigned int timestamp, unsigned long long capture_us)
+{
+	unsigned int layer = 0;
+	unsigned long long start = get_time_ns();
+
+	// the simulcast layers scale and encode the same frame meanwhile
+	simulcast_start(img, timestamp);
 
-	p->packet[p->send_ptr].ssrc = 411;
-	vpxlog_dbg(LOG_PACKET,
-		"Sent Packet %d, %d, %d : new=%d \n",
-		p->packet[p->send_ptr].seq,
-		p->packet[p->send_ptr].timestamp,
-		p->packet[p->send_ptr].frame_type,
-		p->packet[p->send_ptr].new_frame );
-
-	rc = vpx_net_sendto(vpxSock,
-		(tc8 *)&p->packet[p->send_ptr],
-		PACKET_HEADER_SIZE + p->packet[p->send_ptr].size,
-		&bytes_sent,
-		address );
+	// a new encode size asks for the key frame it is taken on
+	choose_scale();
 
-	p->send_ptr++;
-	p->send_ptr &= PSM;
-	p->count--;
+	// key and recovery frames are base layer frames, the pattern starts over
+	if( temporal_layers > 1 ) {
+		if( request_recovery ) {
+			layer_frame = 0;
+		}
+		layer = cfg.ts_layer_id[layer_frame++ % cfg.ts_periodicity];
+		vpx_codec_control(&encoder, VP8E_SET_TEMPORAL_LAYER_ID, layer);
+	}
 
-	return 0;
-}
+	unsigned int const flags = request_recovery ? recovery_flags[request_recovery] : reference_flags(layer);
 
+	// the encode size changes on key frames only
+	if( request_recovery == KEY
+	 && scale_wanted != scale_step ) {
+		scale_encoder(scale_wanted);
+	}
 
+	if( scale_step ) {
+		unsigned long long scale_start = get_time_ns();
+
+		libyuv::I420Scale(
+			img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+			img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+			img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+			img->d_w, img->d_h,
+			scaled_img.planes[VPX_PLANE_Y], scaled_img.stride[VPX_PLANE_Y],
+			scaled_img.planes[VPX_PLANE_U], scaled_img.stride[VPX_PLANE_U],
+			scaled_img.planes[VPX_PLANE_V], scaled_img.stride[VPX_PLANE_V],
+			scaled_img.d_w, scaled_img.d_h,
+			libyuv::kFilterBox);
+		stats_since(HIST_SCALE, scale_start);
+		img = &scaled_img;
+	}
 
+	// retarget the rate control to what the congestion controller allows,
+	// small changes aren't worth disturbing it for
+	if( target_bitrate
+	 && (target_bitrate * 20 < cfg.rc_target_bitrate * 19
+	  || target_bitrate * 20 > cfg.rc_target_bitrate * 21) ) {
+		vpxlog_dbg(FRAME, "Bitrate %d -> %d kbps\n", cfg.rc_target_bitrate, target_bitrate);
+		cfg.rc_target_bitrate = target_bitrate;
+		layer_bitrates(&cfg);
+		if( vpx_codec_enc_config_set(&encoder, &cfg) ) {
+			vpxlog_dbg(ERRORS, "Failed to set bitrate: %s\n", vpx_codec_error(&encoder));
+		}
+	}
 
-unsigned int const recovery_flags[] = {
-	0,                                              //   NORMAL,
-	VPX_EFLAG_FORCE_KF,                             //   KEY,
-	VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF |
-	VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_REF_ARF,   //   GOLD = 2,
-	VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF |
-	VP8_EFLAG_NO_REF_LAST | VP8_EFLAG_NO_REF_GF     //   ALTREF = 3
-};
+	if( VPX_CODEC_OK != vpx_codec_encode(&encoder,
+		img,
+		i_frame,
+		1,
+		flags,
+		VPX_DL_REALTIME )
+	) {
+		vpxlog_dbg(ERRORS, "Failed to encode frame %d: %s\n",
+			(int)i_frame,
+			vpx_codec_error(&encoder));
+	}
 
-uvc_context_t       *uvc_ctx;
-uvc_error_t          uvc_res;
-uvc_device_t        *uvc_dev;
-uvc_device_handle_t *uvc_devh;
-uvc_stream_ctrl_t    uvc_ctrl;
+	stats_since(HIST_ENCODE, start);
+	tune_encoder(get_time_ns() - start);
+
+	vpx_codec_iter_t iter = NULL;
+	vpx_codec_cx_pkt_t const *pkt;
+	while( (pkt = vpx_codec_get_cx_data(&encoder, &iter)) ) {
+		if( pkt->kind == VPX_CODEC_CX_FRAME_PKT ) {
+			stats_add(STAT_FRAMES_ENCODED, 1);
+			vpxlog_dbg(FRAME, "Encoded frame %d: %d bytes\n",
+				(int)i_frame,
+				(int)pkt->data.frame.sz );
+
+			unsigned short first_seq = packetizer.seq;
+
+			packetize_frame(
+				(unsigned char *)pkt->data.frame.buf,
+				pkt->data.frame.sz,
+				request_recovery,
+				layer,
+				timestamp,
+				capture_us );
+
+			update_references(flags, timestamp, first_seq, packetizer.seq - 1);
+		}
+	}
 
-pthread_cond_t  frame_cnd;
-pthread_mutex_t frame_mtx;
+	i_frame++;
+	simulcast_wait();
+	return 0;
+}
 
-unsigned i_frame = 0;
+unsigned int packets_queued(PACKETIZER *p)
+{
+	return (p->add_ptr - p->send_ptr) & PSM;
+}
 
 void frame_callback(uvc_frame_t *frame, void *ptr) {
+	// as close to the capture as we get, uvc's own capture_time is wall clock
+	unsigned long long capture_us = get_time_us();
+	unsigned long long start = get_time_ns();
 	uvc_frame_t *rgb;
 	uvc_error_t ret;
 
+	// the camera streams from startup so it has settled by the time a
+	// receiver is there, the frames before that are dropped undecoded
+	if( !__atomic_load_n(&session_live, __ATOMIC_ACQUIRE) ) {
+		return;
+	}
+
+	stats_add(STAT_FRAMES_CAPTURED, 1);
+
 	rgb = uvc_allocate_frame(frame->width * frame->height * 3);
 	if (!rgb) {
 		printf("unable to allocate rgb frame!");
@@ -320,20 +2038,19 @@ void frame_callback(uvc_frame_t *frame, void *ptr) {
 		uvc_perror(ret, "uvc_mjpeg2rgb");
 		return;
 	}
+	stats_since(HIST_CONVERT, start);
 
 	pthread_mutex_lock(&frame_mtx);
 
 	// do we have room in our packet store for a frame
-	if( packetizer.add_ptr - packetizer.send_ptr < 20 ) {
-		fprintf(stderr, "frame[%3d]> %d %d %d: %06x",
+	if( packets_queued(&packetizer) < 20 ) {
+		vpxlog_dbg(FRAME, "frame[%3d]> %d %d %d: %06x\n",
 			(int)i_frame % 1000,
 			(int)rgb->width,
 			(int)rgb->height,
 			(int)rgb->step,
 			*((unsigned int*)rgb->data));
 
-		int const flags = recovery_flags[request_recovery];
-
 	/* XXX: I don't care that the frame data is RGB, but the encoder
 	 *      is configured for a planar format. I just want to see
 	 *      something to fall out of the encoder at all.
@@ -361,63 +2078,14 @@ void frame_callback(uvc_frame_t *frame, void *ptr) {
 		vpx_img.stride[2] = rgb->width;
 		vpx_img.stride[3] = rgb->width;
 
-		if( VPX_CODEC_OK != vpx_codec_encode(&encoder,
-			&vpx_img,
-			i_frame,
-			1,
-			flags,
-			VPX_DL_REALTIME )
-		) {
-			fputc('!', stderr);
-		}
-		fprintf(stderr, " %s ", vpx_codec_error(&encoder));
-
-		vpx_codec_iter_t iter;
-		vpx_codec_cx_pkt_t const *pkt;
-		while( (pkt = vpx_codec_get_cx_data(&encoder, &iter)) ) {
-			fputc('.', stderr);
-			if( pkt->kind == VPX_CODEC_CX_FRAME_PKT ) {
-				int const frame_type = request_recovery;
-
-				// a recovery frame was requested move sendptr to current ptr, so that we
-				// don't spend datarate sending packets that won't be used.
-				if( request_recovery ) {
-					packetizer.send_ptr = packetizer.add_ptr;
-					request_recovery = 0;
-				}
-
-				if( frame_type == GOLD
-				 || frame_type == KEY) {
-					gold_recovery_seq = packetizer.seq;
-				}
-
-				if( frame_type == ALTREF
-				 || frame_type == KEY ) {
-					altref_recovery_seq = packetizer.seq;
-				}
-
-				packetize(&packetizer,
-					i_frame,
-					(unsigned char *)pkt->data.frame.buf,
-					pkt->data.frame.sz,
-					frame_type);
-
-				vpxlog_dbg(FRAME,
-					"Frame %d %d %d %10.4g\n",
-					packetizer.packet[packetizer.send_ptr].seq,
-					pkt->data.frame.sz,
-					packetizer.packet[packetizer.send_ptr].timestamp,
-					gold_recovery_seq );
-			}
-		}
-		fprintf(stderr, " %s ", vpx_codec_error(&encoder));
-		fputc('\n', stderr);
-
-		i_frame++;
-
-		uvc_free_frame(rgb);
+		stats_since(HIST_CAPTURE, start);
+		compress_and_packetize(&vpx_img, media_timestamp(capture_us), capture_us);
+	} else {
+		stats_add(STAT_FRAMES_SKIPPED, 1);
 	}
 
+	uvc_free_frame(rgb);
+
 	pthread_cond_broadcast(&frame_cnd);
 	pthread_mutex_unlock(&frame_mtx);
 
@@ -448,11 +2116,59 @@ int start_capture(void)
 		NULL, /* TODO: make this a per camera UVC/VPX context */
 		0) );
 
+	capture_width = display_width;
+	capture_height = display_height;
+	return 0;
+}
+
+// the session agreed on another size than the camera was started with:
+// negotiate a new stream with the device kept open, which is much quicker
+// than opening it again. A size the camera can't do leaves the stream as it
+// is and the session at the camera's size
+int resize_capture(void)
+{
+	uvc_stream_ctrl_t ctrl;
+
+	if( !capture_width
+	 || (display_width == capture_width && display_height == capture_height) ) {
+		return 0;
+	}
+
+	if( uvc_get_stream_ctrl_format_size(
+		uvc_devh, &ctrl,
+		UVC_FRAME_FORMAT_MJPEG,
+		display_width, display_height,
+		0 ) < 0 ) {
+		fprintf(stderr, "Camera can't do %dx%d, sending %dx%d\n",
+			display_width, display_height, capture_width, capture_height);
+		display_width = capture_width;
+		display_height = capture_height;
+		return 0;
+	}
+
+	uvc_stop_streaming(uvc_devh);
+	uvc_ctrl = ctrl;
+	uvc_print_stream_ctrl(&uvc_ctrl, stderr);
+
+	capture_width = 0;
+	FAIL_ON_NEGATIVE( uvc_start_streaming(
+		uvc_devh,
+		&uvc_ctrl,
+		frame_callback,
+		NULL,
+		0) );
+
+	capture_width = display_width;
+	capture_height = display_height;
 	return 0;
 }
 
 int stop_capture(void)
 {
+	if( !capture_width ) {
+		return 0;
+	}
+
 	uvc_stop_streaming(uvc_devh);
 	uvc_close(uvc_devh);
 	uvc_unref_device(uvc_dev);
@@ -462,6 +2178,178 @@ int stop_capture(void)
 }
 
 
+typedef enum {
+	SOURCE_CAMERA,
+	SOURCE_IVF,
+	SOURCE_Y4M,
+	SOURCE_I420
+} SOURCE_TYPE;
+
+SOURCE_TYPE   source_type = SOURCE_CAMERA;
+const char   *source_name = NULL;
+FILE         *source_file = NULL;
+int           source_pace = 1;
+int           source_done = 0;
+unsigned int  source_rate = 30;
+unsigned int  source_scale = 1;
+vpx_image_t   source_img;
+pthread_t     source_thread;
+
+// picks the file type from the extension and reads its header, for ivf and
+// y4m the file's own size overrides the one the receiver asked for
+int open_file_source(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	unsigned int fourcc;
+	unsigned int width = display_width;
+	unsigned int height = display_height;
+
+	if( !(source_file = fopen(name, "rb")) ) {
+		vpxlog_dbg(ERRORS, "Failed to open %s for reading\n", name);
+		return -1;
+	}
+
+	if( ext && strcasecmp(ext, ".ivf") == 0 ) {
+		source_type = SOURCE_IVF;
+		FAIL_ON_NONZERO( ivf_read_header(source_file,
+			&fourcc, &width, &height, &source_rate, &source_scale) )
+
+		if( fourcc != ivf_fourcc ) {
+			vpxlog_dbg(ERRORS, "%s is not VP8\n", name);
+			return -1;
+		}
+	} else if( ext && strcasecmp(ext, ".y4m") == 0 ) {
+		source_type = SOURCE_Y4M;
+		FAIL_ON_NONZERO( y4m_read_file_header(source_file,
+			&width, &height, &source_rate, &source_scale) )
+	} else {
+		source_type = SOURCE_I420;
+		source_rate = capture_frame_rate;
+		source_scale = 1;
+	}
+
+	if( (int)width != display_width || (int)height != display_height ) {
+		fprintf(stderr, "%s is %dx%d, receiver asked for %dx%d\n",
+			name, width, height, display_width, display_height);
+		display_width = width;
+		display_height = height;
+	}
+
+	if( source_type != SOURCE_IVF ) {
+		FAIL_ON_ZERO( vpx_img_alloc(&source_img,
+			VPX_IMG_FMT_I420, display_width, display_height, 1) )
+	}
+
+	return 0;
+}
+
+void *file_source(void *ptr)
+{
+	static unsigned char frame[LARGESTFRAMESIZE];
+	unsigned int frame_count = 0;
+	unsigned int start_time = get_time();
+
+	for(;;) {
+		unsigned int frame_size = 0;
+		vpx_codec_pts_t pts = frame_count;
+		int frame_type = NORMAL;
+		unsigned int timestamp;
+		int rc;
+
+		switch( source_type ) {
+		case SOURCE_IVF:
+			rc = ivf_read_frame(source_file,
+				frame, sizeof(frame), &frame_size, &pts);
+			// bit 0 of the VP8 frame tag is clear on key frames
+			if( !rc && frame_size && !(frame[0] & 1) ) {
+				frame_type = KEY;
+			}
+			break;
+		case SOURCE_Y4M:
+			rc = y4m_read_frame(source_file, &source_img);
+			break;
+		default:
+			rc = i420_read_frame(source_file, &source_img);
+			break;
+		}
+
+		if( rc ) {
+			break;
+		}
+
+		stats_add(STAT_FRAMES_CAPTURED, 1);
+
+		// the file's frame rate, or as fast as the packetizer drains
+		if( source_pace ) {
+			unsigned int due = start_time
+				+ (unsigned int)(pts * 1000 * source_scale / source_rate);
+			int wait = (int)(due - get_time());
+
+			if( wait > 0 ) {
+				Sleep(wait);
+			}
+		}
+
+		// a file frame is "captured" when it is due
+		unsigned long long capture_us = get_time_us();
+
+		pthread_mutex_lock(&frame_mtx);
+
+		while( packets_queued(&packetizer) >= PS / 4 ) {
+			pthread_mutex_unlock(&frame_mtx);
+			Sleep(1);
+			pthread_mutex_lock(&frame_mtx);
+		}
+
+		// the file's time base is its media clock
+		timestamp = media_timestamp(
+			(unsigned long long)pts * 1000000 * source_scale / source_rate);
+
+		if( source_type != SOURCE_IVF ) {
+			compress_and_packetize(&source_img, timestamp, capture_us);
+		} else if( request_recovery && frame_type != KEY ) {
+			// pre-encoded data can't make a recovery frame, the best we
+			// can do is skip ahead to the next key frame in the file
+			vpxlog_dbg(SKIP, "Skipping frame %d until key frame\n", frame_count);
+		} else {
+			packetize_frame(frame, frame_size, frame_type, 0, timestamp, capture_us);
+			i_frame++;
+		}
+
+		frame_count++;
+
+		pthread_cond_broadcast(&frame_cnd);
+		pthread_mutex_unlock(&frame_mtx);
+	}
+
+	fprintf(stderr, "%s: sent %d frames in %d ms\n",
+		source_name, frame_count, get_time() - start_time);
+
+	pthread_mutex_lock(&frame_mtx);
+	source_done = 1;
+	pthread_cond_broadcast(&frame_cnd);
+	pthread_mutex_unlock(&frame_mtx);
+
+	return NULL;
+}
+
+int start_file_source(void)
+{
+	FAIL_ON_NONZERO( pthread_create(&source_thread, NULL, file_source, NULL) )
+	return 0;
+}
+
+void stop_file_source(void)
+{
+	pthread_join(source_thread, NULL);
+	fclose(source_file);
+
+	if( source_type != SOURCE_IVF ) {
+		vpx_img_free(&source_img);
+	}
+}
+
+
 int main(int argc, char *argv[])
 {
 	char ip[512];
@@ -469,12 +2357,10 @@ int main(int argc, char *argv[])
 	strncpy(ip, "127.0.0.1", 512);
 	printf("GrabCompressAndSend: (-? for help) \n");
 
-	vpx_codec_enc_cfg_t cfg;
 	vpx_codec_enc_config_default(&vpx_codec_vp8_cx_algo, &cfg, 0);
 
 	cfg.g_w = display_width;
 	cfg.g_h = display_height;
-#if 0
 	cfg.rc_target_bitrate = video_bitrate;
 	cfg.rc_end_usage = VPX_CBR;
 	cfg.g_pass = VPX_RC_ONE_PASS;
@@ -489,10 +2375,7 @@ int main(int argc, char *argv[])
 	cfg.kf_mode = VPX_KF_DISABLED;
 	cfg.kf_max_dist = 999999;
 	cfg.g_threads = 1;
-#endif
 
-	int cpu_used = -6;
-	int static_threshold = 1200;
 
 	if( pthread_mutex_init(&frame_mtx, NULL) 
 	 || pthread_cond_init(&frame_cnd, NULL) ) {
@@ -515,6 +2398,10 @@ int main(int argc, char *argv[])
 			case 'T':
 				static_threshold = atoi(argv[argc-- + 1]);
 				break;
+			case 'f':
+			case 'F':
+				noise_sensitivity = atoi(argv[argc-- + 1]);
+				break;
 			case 'b':
 			case 'B':
 				cfg.rc_min_quantizer = atoi(argv[argc-- + 1]);
@@ -535,18 +2422,107 @@ int main(int argc, char *argv[])
 			case 'R':
 				recv_port = atoi(argv[argc-- + 1]);
 				break;
+			case 'v':
+			case 'V':
+				source_name = argv[argc-- + 1];
+				break;
+			case 'p':
+			case 'P':
+				source_pace = atoi(argv[argc-- + 1]);
+				break;
+			case 'e':
+			case 'E':
+				impairment_spec = argv[argc-- + 1];
+				break;
+			case 'u':
+			case 'U':
+				stats_path = argv[argc-- + 1];
+				break;
+			case 'g':
+			case 'G':
+				latency_probe = atoi(argv[argc-- + 1]);
+				break;
+			case 'x':
+			case 'X':
+				path_mtu = atoi(argv[argc-- + 1]);
+				break;
+			case 'k':
+			case 'K':
+				udp_gso = atoi(argv[argc-- + 1]);
+				break;
+			case 'j':
+			case 'J':
+				uring_depth = atoi(argv[argc-- + 1]);
+				break;
+			case 'l':
+			case 'L':
+				resend_budget = atoi(argv[argc-- + 1]);
+				break;
+			case 'a':
+			case 'A':
+				adaptive_fec = atoi(argv[argc-- + 1]);
+				break;
+			case 'w':
+			case 'W':
+				congestion_control = atoi(argv[argc-- + 1]);
+				break;
+			case 'y':
+			case 'Y':
+				temporal_layers = atoi(argv[argc-- + 1]);
+				break;
+			case 'z':
+			case 'Z':
+				simulcast_spec = argv[argc-- + 1];
+				break;
+			case 'o':
+			case 'O':
+				receivers_spec = argv[argc-- + 1];
+				break;
+			case 'n':
+			case 'N':
+				multicast_ttl = atoi(argv[argc-- + 1]);
+				break;
 			default:
 				puts("========================: \n"
 				     "Captures, compresses and sends video to ReceiveDecompressand play sample\n\n"
 				     "-m [1] buffer level at which to drop frames 0 shuts it off \n"
-				     "-c [12] amount of cpu to leave free of 16 \n"
-				     "-t [1200] sad score below which is just a copy \n"
+				     "-c [6] least encoder speed, raised up to 16 while encoding\n"
+				     "      takes too long for the frame rate, negative leaves the\n"
+				     "      speed to libvpx and the settings as given\n"
+				     "-t [1200] sad score below which is just a copy, doubled up\n"
+				     "      to 8 times once the speed is at 16\n"
+				     "-f [1] noise reduction 0-6, the first thing given up when\n"
+				     "      encoding takes too long\n"
 				     "-b [20] minimum quantizer ( best frame quality )\n"
 				     "-q [52] maximum frame quantizer ( worst frame quality ) \n"
 				     "-d [60] number of frames to drop at the start\n"
 				     "-i [127.0.0.1]    Port to send data to. \n"
 				     "-s [1408] port to send requests to\n"
 				     "-r [1407] port to receive requests on. \n"
+				     "-v [camera] stream an .ivf, .y4m or raw I420 file instead\n"
+				     "-p [1] pace the file at its frame rate, 0 sends as fast as possible\n"
+				     "-e [] emulate network impairment on received requests,\n"
+				     "      same syntax as ReceiveDecompressAndPlay -e\n"
+				     "-u [] serve counters and latency histograms on this\n"
+				     "      unix domain socket\n"
+				     "-g [0] embed a latency probe in the first packet of every frame\n"
+				     "-x [0] path MTU to size packets for, 0 looks it up\n"
+				     "-k [0] send runs of equal sized packets in one UDP GSO\n"
+				     "      call (Linux 4.18+), falls back by itself\n"
+				     "-j [0] queue packets on an io_uring this deep and submit\n"
+				     "      each frame's in one system call (Linux 6.0+)\n"
+				     "-l [25] percent of the target bitrate resends may use\n"
+				     "-a [1] size the FEC per frame from the receiver's loss\n"
+				     "      reports, 0 keeps its -n/-d throughout\n"
+				     "-w [1] back the bitrate off as queues build up on the path,\n"
+				     "      0 sends at the receiver's bitrate throughout\n"
+				     "-y [1] temporal layers, 2 or 3 make every other frame\n"
+				     "      droppable\n"
+				     "-z [] simulcast, smaller sizes to encode the same capture at as\n"
+				     "      WxH[@kbps],... e.g. 640x360,320x180@150\n"
+				     "-o [] further receivers to serve, ip:port,... each gets the\n"
+				     "      size closest to what it asks for\n"
+				     "-n [1] hops packets to a multicast group (-i) may travel\n"
 				     "\n");
 				exit(0);
 				break;
@@ -554,12 +2530,20 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if( temporal_layers > 3 ) {
+		temporal_layers = 3;
+	}
+
 	struct vpxsocket      vpx_socket, vpx_socket2;
 	union  vpx_sockaddr_x address,    address2;
 
 	TCRV rc;
 	int bytes_read;
-	int bytes_sent;
+	unsigned int packet_size;
+
+	if( stats_path ) {
+		FAIL_ON_NONZERO(stats_serve(stats_path))
+	}
 
 	vpx_net_init();
 
@@ -567,207 +2551,375 @@ int main(int argc, char *argv[])
 	FAIL_ON_NONZERO(vpx_net_open(&vpx_socket, vpx_IPv4, vpx_UDP))
 	FAIL_ON_NONZERO(vpx_net_get_addr_info(ip, send_port, vpx_IPv4, vpx_UDP, &address))
 
+	// a group address: one send reaches every receiver that joined it
+	multicast = IN_MULTICAST(ntohl(address.sa_in.sin_addr.s_addr));
+	if( multicast ) {
+		tcu8 ttl = multicast_ttl;
+
+		FAIL_ON_NONZERO(vpx_net_multicast_ttl(&vpx_socket, 1, &ttl))
+	}
+
 	// feedback socket
 	FAIL_ON_NONZERO(vpx_net_open(&vpx_socket2, vpx_IPv4, vpx_UDP))
 	vpx_net_set_read_timeout(&vpx_socket2, 0);
 	rc = vpx_net_bind(&vpx_socket2, 0, recv_port);
 	vpx_net_set_send_timeout(&vpx_socket, vpx_NET_NO_TIMEOUT);
 
-	// make sure 2 way discussion taking place before getting started
+	if( impairment_spec ) {
+		struct vpx_net_impairment impairment;
+
+		FAIL_ON_NONZERO(vpx_net_parse_impairment(impairment_spec, &impairment))
+		FAIL_ON_NONZERO(vpx_net_set_impairment(&vpx_socket2, &impairment))
+	}
+
+	// as big as the path takes, the receiver may take less
+	if( !path_mtu
+	 && vpx_net_path_mtu(vpx_IPv4, &address, &path_mtu) != TC_OK ) {
+		path_mtu = 0;
+	}
+
+	// camera and encoder come up while the offers go out rather than after
+	// the receiver has answered: the camera takes its time to open and
+	// settle its exposure, the encoder to allocate. Both start at the size
+	// offered, which is what a receiver takes unless it asks for another
+	cfg.g_w = display_width;
+	cfg.g_h = display_height;
+	cfg.rc_target_bitrate = video_bitrate;
+	layer_config(&cfg);
+
+	vpx_codec_enc_init(&encoder, &vpx_codec_vp8_cx_algo, &cfg, 0);
+	fprintf(stderr, "init codec: %s\n", vpx_codec_error(&encoder));
+
+	if( !source_name ) {
+		FAIL_ON_NONZERO( start_capture() )
+	}
+
+	// offer until a receiver requests a session this sender can serve,
+	// again after 10 ms and twice as long each time up to a second, so a
+	// receiver that is already waiting is answered within a round trip
+	SESSION offer, request;
+	unsigned int retry_ms = SESSION_RETRY_MIN_MS;
+	unsigned int offer_at = get_time();
+
+	session_offer(&offer);
+	vpx_net_set_read_timeout(&vpx_socket2, SESSION_RETRY_MIN_MS);
+
 	for(;;) {
-		char init_packet[PACKET_SIZE] = "initiate call";
-		rc = vpx_net_sendto(&vpx_socket, (tc8 *)&init_packet, PACKET_SIZE, &bytes_sent, address);
-		Sleep(200);
+		if( (int)(get_time() - offer_at) >= 0 ) {
+			session_send(&vpx_socket, address, &offer);
+			offer_at = session_retry(get_time(), &retry_ms);
+		}
 
 		rc = vpx_net_recvfrom(&vpx_socket2, one_packet, sizeof(one_packet), &bytes_read, &address2);
 
-		if (rc != TC_OK && rc != TC_WOULDBLOCK)
+		if( rc != TC_OK
+		 && rc != TC_WOULDBLOCK
+		 && rc != TC_TIMEDOUT ) {
 			vpxlog_dbg(LOG_PACKET, "error\n");
+		}
 
-		if (bytes_read == -1)
-			bytes_read = 0;
-
-		if (bytes_read) {
-			if (strncmp(one_packet, "configuration ", 14) == 0) {
-				sscanf(one_packet + 14,
-				       "%d %d %d %d %d %d",
-				       &display_width,
-				       &display_height,
-				       &capture_frame_rate,
-				       &video_bitrate,
-				       &fec_numerator,
-				       &fec_denominator);
-
-				printf("Dimensions: %dx%-d %dfps %dkbps %d/%dFEC\n",
-				       display_width,
-				       display_height,
-				       capture_frame_rate,
-				       video_bitrate,
-				       fec_numerator,
-				       fec_denominator);
-				break;
-			}
+		if( rc == TC_OK
+		 && bytes_read > 0
+		 && !session_read((unsigned char *)one_packet, bytes_read, &request)
+		 && request.type == SESSION_REQUEST
+		 && !session_agree(&request) ) {
+			break;
 		}
 	}
+	session_peer = address2;
+
+	// no bigger than the receiver takes
+	packet_size = offer.packet_size;
+	if( request.packet_size < MIN_PACKET_SIZE ) {
+		request.packet_size = MIN_PACKET_SIZE;
+	}
+	if( packet_size > request.packet_size ) {
+		packet_size = request.packet_size & ~7;
+	}
+
+	printf("Path MTU %d, %d byte packets\n", path_mtu, packet_size);
+
+	// don't fragment from here on, a narrower path then shows up in send_wire
+	int pmtu_discover = 1;
+	vpx_net_pmtu_discover(&vpx_socket, 1, &pmtu_discover);
+
+	// a frame's packets and the resends before them reach the kernel in one
+	// vpx_net_flush instead of a system call each
+	if( uring_depth
+	 && vpx_net_uring(&vpx_socket, 1, &uring_depth) != TC_OK ) {
+		vpxlog_dbg(ERRORS, "io_uring not available, sending packet by packet\n");
+	}
+
+	if( source_name
+	 && open_file_source(source_name) ) {
+		return -1;
+	}
 
-	char init_packet[PACKET_SIZE] = "confirmed";
-	rc = vpx_net_sendto(&vpx_socket, (tc8 *)&init_packet, PACKET_SIZE, &bytes_sent, address);
-	fputs(init_packet, stderr);
-	Sleep(200);
-	rc = vpx_net_sendto(&vpx_socket, (tc8 *)&init_packet, PACKET_SIZE, &bytes_sent, address);
-	fputs(init_packet, stderr);
-	Sleep(200);
-	rc = vpx_net_sendto(&vpx_socket, (tc8 *)&init_packet, PACKET_SIZE, &bytes_sent, address);
-	fputs(init_packet, stderr);
-	fputc('\n', stderr);
+	FAIL_ON_NONZERO( resize_capture() )
 
 	cfg.g_w = display_width;
 	cfg.g_h = display_height;
+	cfg.rc_target_bitrate = video_bitrate;
+	target_bitrate = video_bitrate;
+	layer_config(&cfg);
+
+	// up to the bitrate the receiver asked for, down to a tenth of it
+	cc_init(video_bitrate, video_bitrate / 10, video_bitrate);
+	stats_set(STAT_TARGET_BITRATE, target_bitrate);
+	stats_set(STAT_ENCODE_WIDTH, display_width);
+
+	// what the receiver agreed to mostly fits the encoder as it is, only a
+	// size beyond the one it was set up for needs a new one
+	if( vpx_codec_enc_config_set(&encoder, &cfg) ) {
+		vpx_codec_destroy(&encoder);
+		vpx_codec_enc_init(&encoder, &vpx_codec_vp8_cx_algo, &cfg, 0);
+		fprintf(stderr, "init codec: %s\n", vpx_codec_error(&encoder));
+	}
 
-	vpx_codec_enc_init(&encoder, &vpx_codec_vp8_cx_algo, &cfg, 0);
-	fprintf(stderr, "init codec: %s\n", vpx_codec_error(&encoder));
+	// as many token partitions as the receiver decodes with threads
+	vpx_codec_control(&encoder, VP8E_SET_TOKEN_PARTITIONS, token_partitions(decoder_threads));
+
+	// speed, noise reduction and static threshold start at the most
+	// quality asked for, the encode time tunes them from there
+	tune_init();
+
+	FAIL_ON_NONZERO(create_packetizer(&packetizer, XOR, fec_numerator, fec_denominator, packet_size))
+
+	// the receiver asks again until it has the confirmation, the feedback
+	// loop answers that
+	session_confirmed(request.generation);
+	session_send(&vpx_socket, address, &session);
+
+	if( simulcast_spec ) {
+		if( source_type == SOURCE_IVF ) {
+			fprintf(stderr, "No simulcast from a pre-encoded file\n");
+		} else {
+			FAIL_ON_NONZERO( simulcast_open(simulcast_spec, packet_size) )
+		}
+	}
 
-#if 0
-	vpx_codec_control_(&encoder, VP8E_SET_CPUUSED, cpu_used);
-	vpx_codec_control_(&encoder, VP8E_SET_STATIC_THRESHOLD, static_threshold);
-	vpx_codec_control_(&encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
-#endif
+	if( receivers_spec ) {
+		FAIL_ON_NONZERO( receivers_open(receivers_spec) )
+	}
 
-	create_packetizer(&packetizer, XOR, fec_numerator, fec_denominator);
+	// the next camera frame is the first key frame, request_recovery
+	// starts out asking for one
+	__atomic_store_n(&session_live, 1, __ATOMIC_RELEASE);
 
-	start_capture();
+	if( source_name ) {
+		FAIL_ON_NONZERO( start_file_source() )
+	}
 	vpx_net_set_read_timeout(&vpx_socket2, 1);
 
 	for (int i = 0;; ) {
 		if( pthread_mutex_lock(&frame_mtx) ) {
 			continue;
 		}
-		if( pthread_cond_wait(&frame_cnd, &frame_mtx) ) {
+
+		// the file ran out and everything has gone out on the wire
+		if( source_done
+		 && !packets_queued(&packetizer) ) {
+			pthread_mutex_unlock(&frame_mtx);
+			break;
+		}
+
+		if( !source_done
+		 && pthread_cond_wait(&frame_cnd, &frame_mtx) ) {
 			pthread_mutex_unlock(&frame_mtx);
 			continue;
 		}
 
-		// if there is nothing to send
-		rc = vpx_net_recvfrom(&vpx_socket2,
-			one_packet,
-			sizeof(one_packet),
-			&bytes_read,
-			&address2 );
+		// everything the receiver sent since the last frame: resend and
+		// recovery requests, and its reports
+		for( ;; ) {
+			rc = vpx_net_recvfrom(&vpx_socket2,
+				one_packet,
+				sizeof(one_packet),
+				&bytes_read,
+				&address2 );
+
+			if( rc != TC_OK
+			 && rc != TC_WOULDBLOCK
+			 && rc != TC_TIMEDOUT ) {
+				vpxlog_dbg(LOG_PACKET, "error\n");
+			}
 
-		if( rc != TC_OK
-		 && rc != TC_WOULDBLOCK
-		 && rc != TC_TIMEDOUT ) {
-			vpxlog_dbg(LOG_PACKET, "error\n");
-		}
+			if( rc != TC_OK
+			 || bytes_read <= 0 ) {
+				break;
+			}
 
-		if( bytes_read == -1 ) {
-			bytes_read = 0;
-		}
+			// the receiver that set the session up changing it, or asking
+			// again for a lost confirmation; further receivers joining
+			SESSION request;
+			if( !session_read((unsigned char *)one_packet, bytes_read, &request) ) {
+				if( request.type != SESSION_REQUEST ) {
+					continue;
+				}
+
+				if( address2.sa_in.sin_addr.s_addr == session_peer.sa_in.sin_addr.s_addr
+				 && address2.sa_in.sin_port == session_peer.sa_in.sin_port ) {
+					if( request.generation != session.generation ) {
+						session_reconfigure(&request);
+					}
+					session_send(&vpx_socket, address, &session);
+				} else if( multicast ) {
+					session_send(&vpx_socket, address, &session);
+				} else {
+					receiver_join(&vpx_socket, &address2, &request);
+				}
+				continue;
+			}
+
+			RECEIVER *receiver = receiver_of(&address2);
+			if( receiver ) {
+				receiver_feedback(receiver, &vpx_socket, (unsigned char *)one_packet, bytes_read);
+				continue;
+			}
+
+			// in a group every receiver counts, the first one heard from
+			// drives the congestion controller
+			int member = multicast ? member_of(&address2) : 0;
+
+			RECEIVER_REPORT report;
+			if( !report_read((unsigned char *)one_packet, bytes_read, &report) ) {
+				fec_report(&report);
+				cc_loss(report.lost, report.received + report.lost);
+				continue;
+			}
 
-		if( bytes_read ) {
+			unsigned int acked_timestamp;
+			if( !ack_read((unsigned char *)one_packet, bytes_read, &acked_timestamp) ) {
+				reference_acked(acked_timestamp, member);
+				continue;
+			}
+
+			ARRIVAL arrivals[ARRIVAL_MAX];
+			int arrival_count = arrivals_read((unsigned char *)one_packet, bytes_read, arrivals);
+			if( arrival_count >= 0 ) {
+				for( int a = 0; member == 0 && a < arrival_count; a++ ) {
+					cc_arrival(arrivals[a].seq, arrivals[a].arrival_us);
+				}
+				continue;
+			}
+
+			// command byte, then the sequence number little endian
 			unsigned char command = one_packet[0];
-			unsigned short seq = *((unsigned short *)(1 + one_packet));
-			int bytes_sent;
+			unsigned short seq = (unsigned char)one_packet[1]
+			                   | (unsigned char)one_packet[2] << 8;
+
+			// a receiver that holds no references at all, only a key frame
+			// helps it
+			if( command == KEY_REQUEST_COMMAND ) {
+				if( !request_recovery ) {
+					request_recovery = KEY;
+					stats_add(STAT_RECOVERY_KEY, 1);
+					vpxlog_dbg(SKIP, "Requested key frame %c:%d\n", command, seq);
+				}
+				continue;
+			}
+
+			// a packet the cache no longer holds is long gone, treat it as
+			// an inter frame's
+			static PACKET unknown;
+			PACKET *tp = rtx_packet(seq);
+			if( !tp ) {
+				tp = &unknown;
+			}
 
-			PACKET *tp = &packetizer.packet[seq & PSM];
-			vpxlog_dbg(SKIP, "Command :%c Seq:%d FT:%c RecoverySeq:%d AltSeq:%d \n",
+			stats_add(command == 'g' ? STAT_GIVE_UPS_RECEIVED : STAT_NACKS_RECEIVED, 1);
+			vpxlog_dbg(SKIP, "Command :%c Seq:%d FT:%c RecoverySeq:%d Gold:%d%s AltRef:%d%s \n",
 				   command,
 				   seq,
 				   (tp->frame_type == NORMAL ? 'N' : 'G'),
-				   gold_recovery_seq,
-				   altref_recovery_seq );
+				   recovery_seq,
+				   references[GOLD].first_seq,
+				   references[GOLD].acked ? "+" : "",
+				   references[ALTREF].first_seq,
+				   references[ALTREF].acked ? "+" : "" );
 
 			// requested to resend a packet ( ignore if we are about to send a recovery frame)
 			if( command == 'r'
 			 && request_recovery == 0 ) {
-				rc = vpx_net_sendto(&vpx_socket,
-					(tc8 *)&packetizer.packet[seq & PSM],
-					PACKET_HEADER_SIZE + packetizer.packet[seq & PSM].size,
-					&bytes_sent,
-					address );
-
-				vpxlog_dbg(SKIP,
-					"Sent recovery packet %c:%d, %d,%d\n",
-					command,
-					tp->frame_type,
-					seq,
-					tp->timestamp );
-			}
-
-			int recovery_seq = gold_recovery_seq;
-			int recovery_type = GOLD;
-			int other_recovery_seq = altref_recovery_seq;
-			int other_recovery_type = ALTREF;
-
-			if( (unsigned short)(recovery_seq - altref_recovery_seq > 32768) ) {
-				recovery_seq = altref_recovery_seq;
-				recovery_type = ALTREF;
-				other_recovery_seq = gold_recovery_seq;
-				other_recovery_type = GOLD;
+				rtx_request(seq);
 			}
 
-			// if requested to recover but seq is before recovery RESEND
-			if( (unsigned short)(seq - recovery_seq) > 32768
+			// a packet from before the newest recovery frame: the receiver
+			// skips ahead to that frame anyway, just resend
+			if( (short)(seq - recovery_seq) < 0
 			 || command != 'g' ) {
-				rc = vpx_net_sendto(
-					&vpx_socket,
-					(tc8 *)&packetizer.packet[seq & PSM],
-					PACKET_HEADER_SIZE + packetizer.packet[seq & PSM].size,
-					&bytes_sent,
-					address );
-				vpxlog_dbg(SKIP,
-					"Sent recovery packet %c:%d, %d,%d\n",
-					command,
-					tp->frame_type,
-					seq,
-					tp->timestamp );
+				rtx_request(seq);
 			} else
-			// requested  recovery frame and its a normal frame
-			// packet that's lost and seq is after our recovery
-			// frame so make a long term ref frame
-			if( tp->frame_type == NORMAL
-			 && (unsigned short)(seq - recovery_seq) > 0
-			 && (unsigned short)(seq - recovery_seq) < 32768 ) {
-				request_recovery = recovery_type;
-				vpxlog_dbg(SKIP,
-					"Requested recovery frame %c:%c,%d,%d\n",
-					command,
-					(recovery_type == GOLD ? 'G' : 'A'),
-					packetizer.packet[gold_recovery_seq & PSM].frame_type,
-					seq,
-					packetizer.packet[gold_recovery_seq & PSM].timestamp );
-			} else
-			// so the other one is too old request a recovery frame from our older reference buffer.
-			if( (unsigned short)(seq - other_recovery_seq) > 0 
-			 && (unsigned short)(seq - other_recovery_seq) < 32768 ) {
-				request_recovery = other_recovery_type;
-
-				vpxlog_dbg(SKIP,
-					"Requested recovery frame %c:%c,%d,%d\n",
-					command,
-					(other_recovery_type == GOLD ? 'G' : 'A'),
-					packetizer.packet[gold_recovery_seq & PSM].frame_type,
-					seq,
-					packetizer.packet[gold_recovery_seq & PSM].timestamp );
-
-			}
-			else {
-				// nothing else we can do ask for a key
-				request_recovery = KEY;
-				vpxlog_dbg(SKIP, "Requested key frame %c:%d,%d\n", command, tp->frame_type, seq, tp->timestamp);
+			// given up on: recover from the newest reference the receiver
+			// holds, a key frame only when it holds none
+			if( !request_recovery ) {
+				request_recovery = recovery_reference(seq);
+
+				if( request_recovery == KEY ) {
+					stats_add(STAT_RECOVERY_KEY, 1);
+					vpxlog_dbg(SKIP, "Requested key frame %c:%d,%d\n", command, seq, tp->timestamp);
+				} else {
+					stats_add(request_recovery == GOLD ? STAT_RECOVERY_GOLD : STAT_RECOVERY_ALTREF, 1);
+					vpxlog_dbg(SKIP,
+						"Requested recovery frame %c:%c,%d from %d\n",
+						command,
+						(request_recovery == GOLD ? 'G' : 'A'),
+						seq,
+						references[request_recovery].timestamp );
+				}
 			}
 		}
 
-		fputs("send packet\n", stderr);
-		send_packet(&packetizer, &vpx_socket, address);
+		if( congestion_control ) {
+			cc_update(get_time_us());
+			target_bitrate = cc_target_kbps();
+			stats_set(STAT_TARGET_BITRATE, target_bitrate);
+			stats_set(STAT_ACKED_BITRATE, cc_acked_kbps());
+		}
+
+		// resends go first, unless the new frame is a key frame: it makes
+		// them moot and nothing should hold it up
+		if( !fresh_key ) {
+			rtx_drain(&vpx_socket, address);
+		}
+
+		// send everything the last frame produced
+		while( !send_packet(&packetizer, &vpx_socket, address) ) {
+		}
+
+		if( fresh_key ) {
+			rtx_drain(&vpx_socket, address);
+			fresh_key = 0;
+		}
+
+		for( unsigned int l = 0; l < simulcast_count; l++ ) {
+			simulcast_send(&simulcast[l], &vpx_socket);
+		}
+		receivers_invite(&vpx_socket);
+		if( multicast ) {
+			multicast_announce(&vpx_socket, address);
+		}
+
+		if( vpx_net_flush(&vpx_socket) == TC_MSG_TOO_LARGE ) {
+			path_mtu_dropped(address);
+		}
 		vpx_net_set_read_timeout(&vpx_socket2, 1);
 		
 		pthread_mutex_unlock(&frame_mtx);
 	}
 
+	if( source_name ) {
+		stop_file_source();
+	} else {
+		stop_capture();
+	}
+	simulcast_close();
+
 	vpx_net_close(&vpx_socket2);
 	vpx_net_close(&vpx_socket);
 	vpx_net_destroy();
+	free(packetizer.store);
+	stats_stop();
 
 	vpx_codec_destroy(&encoder);
 	return 0;
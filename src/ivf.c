@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "ivf.h"
 
@@ -18,43 +19,80 @@ static void mem_put_le32(char *mem, unsigned int val) {
     mem[3] = val>>24;
 }
  
-void ivf_write_file_header(
+static unsigned int mem_get_le16(const unsigned char *mem) {
+    return mem[0] | mem[1]<<8;
+}
+
+static unsigned int mem_get_le32(const unsigned char *mem) {
+    return mem[0] | mem[1]<<8 | mem[2]<<16 | (unsigned int)mem[3]<<24;
+}
+
+void ivf_write_header(
 	FILE *outfile,
-	const vpx_codec_enc_cfg_t *cfg,
+	unsigned int fourcc,
+	unsigned int width,
+	unsigned int height,
+	unsigned int rate,
+	unsigned int scale,
 	int frame_cnt )
 {
 	char header[32];
 
-	if( cfg->g_pass != VPX_RC_ONE_PASS
-	 && cfg->g_pass != VPX_RC_LAST_PASS ) {
-		return;
-	}
-
 	header[0] = 'D';
 	header[1] = 'K';
 	header[2] = 'I';
 	header[3] = 'F';
 	mem_put_le16(header+4,  0);                   /* version */
 	mem_put_le16(header+6,  32);                  /* headersize */
-	mem_put_le32(header+8,  ivf_fourcc);          /* fourcc */
-	mem_put_le16(header+12, cfg->g_w);            /* width */
-	mem_put_le16(header+14, cfg->g_h);            /* height */
-	mem_put_le32(header+16, cfg->g_timebase.den); /* rate */
-	mem_put_le32(header+20, cfg->g_timebase.num); /* scale */
+	mem_put_le32(header+8,  fourcc);              /* fourcc */
+	mem_put_le16(header+12, width);               /* width */
+	mem_put_le16(header+14, height);              /* height */
+	mem_put_le32(header+16, rate);                /* rate */
+	mem_put_le32(header+20, scale);               /* scale */
 	mem_put_le32(header+24, frame_cnt);           /* length */
 	mem_put_le32(header+28, 0);                   /* unused */
 
 	fwrite(header, 1, 32, outfile);
 }
+
+void ivf_write_frame_size(
+	FILE *outfile,
+	unsigned int frame_size,
+	vpx_codec_pts_t pts )
+{
+	char header[12];
+
+	mem_put_le32(header, frame_size);
+	mem_put_le32(header+4, pts&0xFFFFFFFF);
+	mem_put_le32(header+8, pts >> 32);
+
+	fwrite(header, 1, 12, outfile);
+}
+
+void ivf_write_file_header(
+	FILE *outfile,
+	const vpx_codec_enc_cfg_t *cfg,
+	int frame_cnt )
+{
+	if( cfg->g_pass != VPX_RC_ONE_PASS
+	 && cfg->g_pass != VPX_RC_LAST_PASS ) {
+		return;
+	}
+
+	ivf_write_header(outfile,
+		ivf_fourcc,
+		cfg->g_w,
+		cfg->g_h,
+		cfg->g_timebase.den,
+		cfg->g_timebase.num,
+		frame_cnt );
+}
  
  
 void ivf_write_frame_header(
 	FILE *outfile,
 	const vpx_codec_cx_pkt_t *pkt )
 {
-	char             header[12];
-	vpx_codec_pts_t  pts;
-
 	if( pkt->kind != VPX_CODEC_CX_FRAME_PKT ) {
 		return;
 	}
@@ -62,11 +100,66 @@ void ivf_write_frame_header(
 	fprintf(stderr, "frame size: %u\n",
 	(unsigned int)pkt->data.frame.sz);
 
-	pts = pkt->data.frame.pts;
-	mem_put_le32(header, pkt->data.frame.sz);
-	mem_put_le32(header+4, pts&0xFFFFFFFF);
-	mem_put_le32(header+8, pts >> 32);
+	ivf_write_frame_size(outfile,
+		pkt->data.frame.sz,
+		pkt->data.frame.pts );
+}
 
-	fwrite(header, 1, 12, outfile);
+
+int ivf_read_header(
+	FILE *infile,
+	unsigned int *fourcc,
+	unsigned int *width,
+	unsigned int *height,
+	unsigned int *rate,
+	unsigned int *scale )
+{
+	unsigned char header[IVF_FILE_HDR_SZ];
+
+	if( fread(header, 1, IVF_FILE_HDR_SZ, infile) != IVF_FILE_HDR_SZ
+	 || memcmp(header, "DKIF", 4) ) {
+		return -1;
+	}
+
+	*fourcc = mem_get_le32(header+8);
+	*width  = mem_get_le16(header+12);
+	*height = mem_get_le16(header+14);
+	*rate   = mem_get_le32(header+16);
+	*scale  = mem_get_le32(header+20);
+
+	/* skip anything a newer header version might have added */
+	if( mem_get_le16(header+6) > IVF_FILE_HDR_SZ ) {
+		fseek(infile, mem_get_le16(header+6), SEEK_SET);
+	}
+
+	/* the frame rate paces the file, a zero in it would divide by zero */
+	return (*width && *height && *rate && *scale) ? 0 : -1;
 }
 
+int ivf_read_frame(
+	FILE *infile,
+	unsigned char *buf,
+	unsigned int buf_size,
+	unsigned int *frame_size,
+	vpx_codec_pts_t *pts )
+{
+	unsigned char header[IVF_FRAME_HDR_SZ];
+
+	if( fread(header, 1, IVF_FRAME_HDR_SZ, infile) != IVF_FRAME_HDR_SZ ) {
+		return -1;
+	}
+
+	*frame_size = mem_get_le32(header);
+	*pts = ((vpx_codec_pts_t)mem_get_le32(header+8) << 32) | mem_get_le32(header+4);
+
+	if( *frame_size > buf_size ) {
+		fprintf(stderr, "ivf frame of %u bytes is too large\n", *frame_size);
+		return -1;
+	}
+
+	if( fread(buf, 1, *frame_size, infile) != *frame_size ) {
+		return -1;
+	}
+
+	return 0;
+}
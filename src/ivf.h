@@ -6,6 +6,24 @@
 
 #include <vpx/vpx_encoder.h>
 
+#ifndef ivf_fourcc
+#define ivf_fourcc 0x30385056 /* VP80 */
+#endif
+
+void ivf_write_header(
+	FILE *outfile,
+	unsigned int fourcc,
+	unsigned int width,
+	unsigned int height,
+	unsigned int rate,
+	unsigned int scale,
+	int frame_cnt );
+
+void ivf_write_frame_size(
+	FILE *outfile,
+	unsigned int frame_size,
+	vpx_codec_pts_t pts );
+
 void ivf_write_file_header(
 	FILE *outfile,
 	const vpx_codec_enc_cfg_t *cfg,
@@ -15,4 +33,19 @@ void ivf_write_frame_header(
 	FILE *outfile,
 	const vpx_codec_cx_pkt_t *pkt );
 
+int ivf_read_header(
+	FILE *infile,
+	unsigned int *fourcc,
+	unsigned int *width,
+	unsigned int *height,
+	unsigned int *rate,
+	unsigned int *scale );
+
+int ivf_read_frame(
+	FILE *infile,
+	unsigned char *buf,
+	unsigned int buf_size,
+	unsigned int *frame_size,
+	vpx_codec_pts_t *pts );
+
 #endif/*IVF_H*/
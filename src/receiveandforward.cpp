@@ -0,0 +1,921 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+/*
+ * A relay between GrabCompressAndSend and any number of
+ * ReceiveDecompressAndPlay: it takes the stream like a receiver does and
+ * forwards every packet to its receivers like a sender would, without
+ * ever decoding it. Each receiver ("leg") gets its own resends, paced, from
+ * the relay's packet cache, and its own temporal layers; what only the
+ * sender can do, resends the relay didn't get and recovery frames, goes
+ * upstream once however many legs ask for it.
+ *
+ */
+
+#include "tctypes.h"
+#include "vpx_network.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+extern "C"
+{
+#include "rtp.h"
+#include "stats.h"
+}
+
+#define PS 2048
+#define PSM  (PS - 1)
+
+#define MAX_LEGS 512
+#define LEG_QUEUE 64                // resends waiting for a leg's budget
+#define UPSTREAM_RETRY_MS 100       // between asking upstream for the same packet
+#define UPSTREAM_WAIT_MS 500        // a leg's resend waits this long for upstream
+#define GIVE_UP_HOLDOFF_MS 300      // between recovery requests sent upstream
+#define LAYER_BACKOFF_PERMILLE 100  // leg loss above which its top layer goes
+#define LAYER_RESTORE_REPORTS 4     // clean reports before it comes back
+#define UPSTREAM_BURST 256          // packets forwarded before looking at the legs
+
+int display_width = 800;
+int display_height = 600;
+int capture_frame_rate = 30;
+int video_bitrate = 300;
+int fec_numerator = 6;
+int fec_denominator = 5;
+unsigned short send_port = 1408;
+unsigned short recv_port = 1407;
+unsigned short leg_port = 1410;
+const char *legs_spec = NULL;
+const char *stats_path = NULL;
+const char *impairment_spec = NULL;
+int resend_budget = 25;
+int path_mtu = 0;
+int udp_gro = 0;
+int uring_depth = 0;
+int signalquit = 1;
+
+// what comes from upstream, as the sender confirmed it
+SESSION session;
+int wire_version = WIRE_VERSION_RAW;
+unsigned int packet_size = PACKET_SIZE;
+
+tc8 one_packet[8192];
+
+// The packet cache: the newest PS packets by sequence number, laid out like
+// the receiver's DEPACKETIZER, with the latency probe each came with and
+// when the relay last asked upstream for the ones it is missing.
+typedef struct {
+	unsigned int	size;
+	PACKET		p[PS];
+	LATENCY_PROBE	probe[PS];
+	unsigned char	has_probe[PS];
+	unsigned short	asked_seq[PS];
+	unsigned int	asked_ms[PS];
+	unsigned char	*store;
+} CACHE;
+
+CACHE cache;
+
+typedef struct {
+	union vpx_sockaddr_x	data;
+	union vpx_sockaddr_x	feedback;
+	int			joined;
+	int			version;
+	unsigned int		max_layer;
+	unsigned int		clean_reports;
+	unsigned int		thinned;
+	unsigned short		queue[LEG_QUEUE];
+	unsigned int		head;
+	unsigned int		count;
+	long long		tokens;
+	unsigned long long	refill_us;
+	unsigned int		invite_at;
+	unsigned int		retry_ms;
+} LEG;
+
+LEG legs[MAX_LEGS];
+unsigned int leg_count = 0;
+unsigned int legs_joined = 0;
+
+// where upstream requests go
+union vpx_sockaddr_x upstream;
+
+// first packet of the newest key or recovery frame from upstream, give ups
+// from before it are already answered
+unsigned short recovery_seq = 0;
+unsigned int last_give_up = 0;
+
+// frame acknowledgements go upstream once every leg sent one, the sender
+// may recover from that frame for all of them then
+#define ACKS 64
+
+typedef struct {
+	unsigned int	timestamp;
+	unsigned int	count;
+} ACK_COUNT;
+
+ACK_COUNT acks[ACKS];
+unsigned int ack_next = 0;
+
+// incoming rate, the legs' resend budgets are a share of it
+unsigned long long rate_us = 0;
+unsigned int rate_bytes = 0;
+unsigned int incoming_bytes_per_s = 0;
+
+// what the relay itself tells upstream, as a receiver would
+RECEIVER_REPORT report;
+unsigned int report_time = 0;
+ARRIVAL arrivals[ARRIVAL_MAX];
+unsigned int arrival_count = 0;
+unsigned int arrival_time = 0;
+unsigned short expected_seq = 0;
+int have_seq = 0;
+
+void session_send(struct vpxsocket *vpx_sock, union vpx_sockaddr_x address, const SESSION *s)
+{
+	unsigned char buffer[SESSION_SIZE];
+	tc32 bytes_sent;
+
+	vpx_net_sendto(vpx_sock, (tc8 *)buffer, session_write(s, buffer), &bytes_sent, address);
+}
+
+void on_signal(int sig)
+{
+	signalquit = 0;
+}
+
+int create_cache(CACHE *c, unsigned int size)
+{
+	c->store = packets_alloc(c->p, PS, size);
+	if (!c->store)
+		return -1;
+
+	c->size = size;
+	return 0;
+}
+
+// the packet if the cache still holds it
+PACKET *cached(unsigned short seq)
+{
+	PACKET *pkt = &cache.p[seq & PSM];
+
+	if (pkt->seq != seq || !pkt->size)
+		return NULL;
+
+	return pkt;
+}
+
+// serializes the header the leg's wire version wants in front of the payload
+// and sends both; with -j the send only queues, vpx_net_flush submits
+void leg_send(LEG *leg, struct vpxsocket *vpx_sock, unsigned short seq)
+{
+	PACKET *pkt = &cache.p[seq & PSM];
+	tc32 head = packet_write_header(pkt, cache.has_probe[seq & PSM] ? &cache.probe[seq & PSM] : NULL, leg->version);
+	tc32 bytes_sent;
+
+	vpx_net_sendto(vpx_sock, (tc8 *)pkt->data - head, head + pkt->size, &bytes_sent, leg->data);
+	stats_add(STAT_PACKETS_SENT, 1);
+	stats_add(STAT_BYTES_SENT, head + pkt->size);
+}
+
+// the relay asked upstream for this packet lately, what comes is the answer
+int upstream_pending(unsigned short seq)
+{
+	return cache.asked_seq[seq & PSM] == seq
+	    && get_time() - cache.asked_ms[seq & PSM] < UPSTREAM_WAIT_MS;
+}
+
+// sends the cached packet to every leg that takes its layer; only the first
+// copy of a packet counts as thinned, the legs count losses by seq
+void relay_to_legs(struct vpxsocket *down, unsigned short seq, int first)
+{
+	PACKET *pkt = &cache.p[seq & PSM];
+	unsigned int i;
+
+	for (i = 0; i < leg_count; i++) {
+		LEG *leg = &legs[i];
+
+		if (!leg->joined)
+			continue;
+
+		if (pkt->layer > leg->max_layer) {
+			if (first) {
+				leg->thinned++;
+				stats_add(STAT_PACKETS_THINNED, 1);
+			}
+			continue;
+		}
+
+		leg_send(leg, down, seq);
+	}
+}
+
+// sends a three byte request upstream, command then seq little endian
+void upstream_request(struct vpxsocket *vpx_sock, unsigned char command, unsigned short seq)
+{
+	tc8 buffer[3];
+	tc32 bytes_sent;
+
+	buffer[0] = command;
+	buffer[1] = seq & 0x00ff;
+	buffer[2] = (seq & 0xff00) >> 8;
+	vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, upstream);
+	stats_add(command == 'r' ? STAT_NACKS_SENT : STAT_GIVE_UPS_SENT, 1);
+}
+
+// one datagram from upstream: into the cache and out to every leg that
+// takes its layer
+void relay_packet(struct vpxsocket *down, const unsigned char *wire, unsigned int len)
+{
+	static unsigned char rx_data[MAX_PACKET_SIZE];
+	static PACKET rx = { 0 };
+	LATENCY_PROBE probe;
+	int has_probe = 0;
+
+	rx.data = rx_data;
+
+	if (packet_read(wire, len, wire_version, &rx, &probe, &has_probe) || rx.size > cache.size) {
+		vpxlog_dbg(DISCARD, "Malformed packet of %d bytes\n", len);
+		return;
+	}
+
+	stats_add(STAT_PACKETS_RECEIVED, 1);
+	stats_add(STAT_BYTES_RECEIVED, len);
+	rate_bytes += len;
+
+	// duplicate FEC sends a packet several times under one sequence number:
+	// the cache keeps the first copy, the legs get every one. A resend the
+	// relay asked upstream for goes only to the legs that queued it, from
+	// the cache in leg_drain.
+	if (cached(rx.seq)) {
+		if (!upstream_pending(rx.seq))
+			relay_to_legs(down, rx.seq, 0);
+		return;
+	}
+
+	report.received++;
+	if (have_seq && (short)(rx.seq - expected_seq) > 0) {
+		unsigned int run = (unsigned short)(rx.seq - expected_seq);
+
+		report.lost += run;
+		report.bursts[report_burst(run)]++;
+	} else if (have_seq && (short)(rx.seq - expected_seq) < 0 && report.lost
+	        && cache.asked_seq[rx.seq & PSM] != rx.seq) {
+		// reordered, not the resend the relay asked for: that one stays lost
+		report.lost--;
+	}
+	if (!have_seq || (short)(rx.seq - expected_seq) >= 0)
+		expected_seq = rx.seq + 1;
+	have_seq = 1;
+
+	if (arrival_count < ARRIVAL_MAX) {
+		arrivals[arrival_count].seq = rx.seq;
+		arrivals[arrival_count].arrival_us = (unsigned int)get_time_us();
+		arrival_count++;
+	}
+
+	if (rx.type == DATAPACKET && rx.new_frame && rx.frame_type != NORMAL
+	 && (short)(rx.seq - recovery_seq) > 0)
+		recovery_seq = rx.seq;
+
+	packet_copy(&cache.p[rx.seq & PSM], &rx, rx.size);
+	cache.has_probe[rx.seq & PSM] = has_probe;
+	if (has_probe)
+		cache.probe[rx.seq & PSM] = probe;
+
+	if (!upstream_pending(rx.seq))
+		relay_to_legs(down, rx.seq, 1);
+}
+
+// the arrival times collected since the last time, for the sender's
+// congestion control
+void arrivals_send(struct vpxsocket *up)
+{
+	unsigned char buffer[ARRIVAL_SIZE(ARRIVAL_MAX)];
+	tc32 bytes_sent;
+
+	arrival_time = get_time();
+	if (wire_version >= WIRE_VERSION_ARRIVALS && arrival_count)
+		vpx_net_sendto(up, (tc8 *)buffer, arrivals_write(arrivals, arrival_count, buffer), &bytes_sent, upstream);
+	arrival_count = 0;
+}
+
+// the leg whose requests come from this address
+LEG *leg_of(union vpx_sockaddr_x *from)
+{
+	unsigned int i;
+
+	for (i = 0; i < leg_count; i++) {
+		if (legs[i].joined
+		 && legs[i].feedback.sa_in.sin_addr.s_addr == from->sa_in.sin_addr.s_addr
+		 && legs[i].feedback.sa_in.sin_port == from->sa_in.sin_port)
+			return &legs[i];
+	}
+
+	return NULL;
+}
+
+// a leg's request, in answer to the offer: it gets the packets in the
+// newest wire format both speak, but no bigger than it takes. What the
+// session is comes from upstream, the leg can't change it but is told so
+// for each generation it asks with.
+void leg_join(struct vpxsocket *down, struct vpxsocket *up, union vpx_sockaddr_x *from, const SESSION *request)
+{
+	SESSION confirm = session;
+	LEG *leg = NULL;
+	unsigned int i;
+
+	for (i = 0; i < leg_count; i++) {
+		if (legs[i].data.sa_in.sin_addr.s_addr == from->sa_in.sin_addr.s_addr
+		 && legs[i].data.sa_in.sin_port == htons(request->data_port))
+			leg = &legs[i];
+	}
+
+	if (!leg) {
+		vpxlog_dbg(LOG_PACKET, "Request from a receiver not asked for\n");
+		return;
+	}
+
+	if (!(request->codecs & SESSION_CODEC_VP8) || request->packet_size < cache.size) {
+		vpxlog_dbg(ERRORS, "Receiver on port %d takes %d byte packets, can't serve it\n", request->data_port, request->packet_size);
+		return;
+	}
+
+	// it repeats its request until it sees the confirmation
+	if (!leg->joined) {
+		leg->version = request->wire_version < wire_version ? request->wire_version : wire_version;
+		if (leg->version < WIRE_VERSION_RAW)
+			leg->version = WIRE_VERSION_RAW;
+
+		leg->feedback = *from;
+		leg->max_layer = 3;
+		leg->refill_us = get_time_us();
+		leg->tokens = 2 * cache.size;
+		leg->joined = 1;
+		legs_joined++;
+		stats_set(STAT_RECEIVERS, legs_joined);
+
+		// it needs a key frame to start from, the references the sender
+		// recovers others from it doesn't have
+		upstream_request(up, KEY_REQUEST_COMMAND, expected_seq - 1);
+		last_give_up = get_time();
+
+		printf("Receiver on port %d joined, wire v%d\n", request->data_port, leg->version);
+	}
+
+	confirm.generation = request->generation;
+	confirm.wire_version = leg->version;
+	session_send(down, leg->data, &confirm);
+}
+
+// a resend the leg asked for, queued behind the leg's budget. One the cache
+// doesn't have goes upstream too, unless it went there just now, and waits
+// in the queue until it comes
+void leg_resend(LEG *leg, struct vpxsocket *up, unsigned short seq)
+{
+	unsigned int i;
+
+	if (!cached(seq)) {
+		unsigned int now = get_time();
+
+		if (cache.asked_seq[seq & PSM] == seq && now - cache.asked_ms[seq & PSM] < UPSTREAM_RETRY_MS) {
+			stats_add(STAT_NACKS_SUPPRESSED, 1);
+		} else {
+			cache.asked_seq[seq & PSM] = seq;
+			cache.asked_ms[seq & PSM] = now;
+			upstream_request(up, 'r', seq);
+		}
+	}
+
+	for (i = 0; i < leg->count; i++) {
+		if (leg->queue[(leg->head + i) % LEG_QUEUE] == seq)
+			return;
+	}
+
+	if (leg->count == LEG_QUEUE) {
+		stats_add(STAT_RESENDS_LIMITED, 1);
+		return;
+	}
+
+	leg->queue[(leg->head + leg->count++) % LEG_QUEUE] = seq;
+}
+
+// a leg gave up on a packet: one recovery frame serves every leg, so only
+// the first give up after the newest recovery frame goes upstream
+void leg_give_up(struct vpxsocket *up, unsigned short seq)
+{
+	if ((short)(seq - recovery_seq) < 0
+	 || get_time() - last_give_up < GIVE_UP_HOLDOFF_MS) {
+		stats_add(STAT_NACKS_SUPPRESSED, 1);
+		return;
+	}
+
+	last_give_up = get_time();
+	upstream_request(up, 'g', seq);
+}
+
+// the leg decoded this frame, upstream hears of it once all of them did
+void leg_ack(struct vpxsocket *up, unsigned int timestamp)
+{
+	unsigned char buffer[ACK_SIZE];
+	tc32 bytes_sent;
+	ACK_COUNT *a = NULL;
+	unsigned int i;
+
+	stats_add(STAT_FRAME_ACKS_RECEIVED, 1);
+
+	for (i = 0; i < ACKS; i++) {
+		if (acks[i].count && acks[i].timestamp == timestamp)
+			a = &acks[i];
+	}
+
+	if (!a) {
+		a = &acks[ack_next];
+		ack_next = (ack_next + 1) % ACKS;
+		a->timestamp = timestamp;
+		a->count = 0;
+	}
+
+	if (++a->count == legs_joined && wire_version >= WIRE_VERSION_ACKS) {
+		vpx_net_sendto(up, (tc8 *)buffer, ack_write(timestamp, buffer), &bytes_sent, upstream);
+		stats_add(STAT_FRAME_ACKS_SENT, 1);
+	}
+}
+
+// the leg's loss decides which temporal layers it gets: its top layer goes
+// while it loses more than it should, and comes back after a few clean
+// reports. What the relay held back shows up as lost, it doesn't count.
+void leg_report(LEG *leg, const RECEIVER_REPORT *r)
+{
+	unsigned int lost = r->lost > r->rebuilt + leg->thinned ? r->lost - r->rebuilt - leg->thinned : 0;
+	unsigned int total = r->received + lost;
+	unsigned int loss = total ? lost * 1000 / total : 0;
+
+	leg->thinned = 0;
+
+	if (loss > LAYER_BACKOFF_PERMILLE) {
+		leg->clean_reports = 0;
+		if (leg->max_layer > 0) {
+			leg->max_layer = leg->max_layer > 2 ? 1 : leg->max_layer - 1;
+			vpxlog_dbg(SKIP, "Leg loses %d permille, layers up to %d\n", loss, leg->max_layer);
+		}
+	} else if (loss < LAYER_BACKOFF_PERMILLE / 5 && leg->max_layer < 3
+	        && ++leg->clean_reports >= LAYER_RESTORE_REPORTS) {
+		leg->clean_reports = 0;
+		leg->max_layer++;
+	}
+}
+
+void leg_feedback(LEG *leg, struct vpxsocket *up, const unsigned char *buf, int bytes)
+{
+	RECEIVER_REPORT r;
+	unsigned int timestamp;
+
+	if (!report_read(buf, bytes, &r)) {
+		leg_report(leg, &r);
+		return;
+	}
+
+	if (!ack_read(buf, bytes, &timestamp)) {
+		leg_ack(up, timestamp);
+		return;
+	}
+
+	// the congestion controller runs on the relay's own arrivals, the
+	// legs' go nowhere
+	if (bytes < 3 || buf[0] == ARRIVAL_COMMAND)
+		return;
+
+	unsigned short seq = buf[1] | buf[2] << 8;
+
+	if (buf[0] == 'g') {
+		stats_add(STAT_GIVE_UPS_RECEIVED, 1);
+		leg_give_up(up, seq);
+	} else if (buf[0] == 'r') {
+		stats_add(STAT_NACKS_RECEIVED, 1);
+		leg_resend(leg, up, seq);
+	}
+}
+
+// sends the leg's queued resends as far as its budget, resend_budget
+// percent of the incoming rate, allows
+void leg_drain(LEG *leg, struct vpxsocket *down)
+{
+	unsigned long long now = get_time_us();
+	long long burst = (long long)incoming_bytes_per_s * resend_budget / 100 / 5;
+	unsigned int n;
+
+	leg->tokens += (long long)(now - leg->refill_us) * incoming_bytes_per_s * resend_budget / 100000000;
+	leg->refill_us = now;
+
+	// 200 ms worth, but always room for a couple of packets
+	if (burst < 2 * (long long)cache.size)
+		burst = 2 * cache.size;
+	if (leg->tokens > burst)
+		leg->tokens = burst;
+
+	// each entry once: sent, dropped, or back in the queue while upstream
+	// hasn't answered for it yet
+	for (n = leg->count; n; n--) {
+		unsigned short seq = leg->queue[leg->head];
+		PACKET *pkt = cached(seq);
+
+		if (pkt && leg->tokens < (long long)pkt->size)
+			break;
+
+		leg->head = (leg->head + 1) % LEG_QUEUE;
+		leg->count--;
+
+		if (pkt) {
+			leg->tokens -= pkt->size;
+			leg_send(leg, down, seq);
+			stats_add(STAT_PACKETS_RESENT, 1);
+		} else if (upstream_pending(seq)) {
+			leg->queue[(leg->head + leg->count++) % LEG_QUEUE] = seq;
+		} else {
+			stats_add(STAT_RESENDS_STALE, 1);
+		}
+	}
+}
+
+// the legs to invite, ip:port with the port each takes video on
+int legs_open(const char *spec)
+{
+	char list[8192];
+	char *s;
+
+	strncpy(list, spec, sizeof(list) - 1);
+	list[sizeof(list) - 1] = 0;
+
+	for (s = strtok(list, ","); s && leg_count < MAX_LEGS; s = strtok(NULL, ",")) {
+		LEG *leg = &legs[leg_count];
+		char *colon = strchr(s, ':');
+		unsigned short port = recv_port;
+
+		if (colon) {
+			*colon = 0;
+			port = atoi(colon + 1);
+		}
+
+		memset(leg, 0, sizeof(*leg));
+		if (vpx_net_get_addr_info(s, port, vpx_IPv4, vpx_UDP, &leg->data) != TC_OK) {
+			vpxlog_dbg(ERRORS, "Bad receiver address %s\n", s);
+			return -1;
+		}
+		leg->invite_at = get_time();
+		leg->retry_ms = SESSION_RETRY_MIN_MS;
+		leg_count++;
+	}
+
+	return 0;
+}
+
+// offers the legs that haven't joined yet the session, the way a sender
+// does, backing off per leg
+void legs_invite(struct vpxsocket *down)
+{
+	SESSION offer = session;
+	unsigned int i;
+
+	offer.type = SESSION_OFFER;
+	offer.generation = 0;
+
+	for (i = 0; i < leg_count; i++) {
+		LEG *leg = &legs[i];
+
+		if (!leg->joined && (int)(get_time() - leg->invite_at) >= 0) {
+			session_send(down, leg->data, &offer);
+			leg->invite_at = session_retry(get_time(), &leg->retry_ms);
+		}
+	}
+}
+
+// takes the stream from upstream the way a receiver does: answers the
+// sender's offer with a request, backing off, until it confirms
+int upstream_handshake(struct vpxsocket *up_data, struct vpxsocket *up)
+{
+	union vpx_sockaddr_x from;
+	SESSION request, s;
+	tc32 bytes_read;
+	TCRV rc;
+	int responded = 0;
+	unsigned int request_at = 0;
+	unsigned int retry_ms = SESSION_RETRY_MIN_MS;
+
+	memset(&request, 0, sizeof(request));
+	request.type = SESSION_REQUEST;
+	request.wire_version = WIRE_VERSION;
+	request.codecs = SESSION_CODEC_VP8;
+	request.fec = SESSION_FEC_XOR | SESSION_FEC_DUPLICATE | SESSION_FEC_ADAPTIVE;
+	request.fec_numerator = fec_numerator;
+	request.fec_denominator = fec_denominator;
+	request.layers = 3;
+	request.threads = 1;
+	request.width = display_width;
+	request.height = display_height;
+	request.frame_rate = capture_frame_rate;
+	request.data_port = recv_port;
+	request.kbps = video_bitrate;
+
+	vpx_net_set_read_timeout(up_data, SESSION_RETRY_MIN_MS);
+
+	while (signalquit) {
+		bytes_read = 0;
+		rc = vpx_net_recvfrom(up_data, one_packet, sizeof(one_packet), &bytes_read, &from);
+
+		if (rc == TC_OK && bytes_read > 0 && !session_read((unsigned char *)one_packet, bytes_read, &s)) {
+			if (!responded) {
+				char add[64];
+
+				sprintf(add, "%d.%d.%d.%d",
+					((unsigned char *)&from.sa_in.sin_addr)[0],
+					((unsigned char *)&from.sa_in.sin_addr)[1],
+					((unsigned char *)&from.sa_in.sin_addr)[2],
+					((unsigned char *)&from.sa_in.sin_addr)[3]);
+				vpx_net_get_addr_info(add, send_port, vpx_IPv4, vpx_UDP, &upstream);
+				responded = 1;
+				request_at = get_time();
+
+				if (!path_mtu && vpx_net_path_mtu(vpx_IPv4, &upstream, &path_mtu) != TC_OK)
+					path_mtu = 0;
+				request.packet_size = path_mtu ? packet_size_for_mtu(path_mtu, 0) : PACKET_SIZE;
+			}
+
+			if (s.type == SESSION_CONFIRM) {
+				if (s.wire_version < WIRE_VERSION_RAW || s.wire_version > WIRE_VERSION
+				 || s.packet_size < MIN_PACKET_SIZE || s.packet_size > MAX_PACKET_SIZE)
+					return -1;
+
+				session = s;
+				wire_version = s.wire_version;
+				packet_size = s.packet_size;
+				printf("Upstream wire v%d, %d byte packets\n", wire_version, packet_size);
+				return 0;
+			}
+		}
+
+		if (responded && (int)(get_time() - request_at) >= 0) {
+			session_send(up, upstream, &request);
+			request_at = session_retry(get_time(), &retry_ms);
+		}
+	}
+
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct vpxsocket up_data, up, down;
+	union vpx_sockaddr_x from;
+	tc32 bytes_read;
+	TCRV rc;
+	unsigned int i;
+
+	printf("ReceiveAndForward: (-? for help) \n");
+
+	while (--argc > 0) {
+		if (argv[argc][0] == '-') {
+			switch (argv[argc][1]) {
+			case 'w':
+			case 'W':
+				display_width = atoi(argv[argc-- + 1]);
+				break;
+			case 'h':
+			case 'H':
+				display_height = atoi(argv[argc-- + 1]);
+				break;
+			case 'f':
+			case 'F':
+				capture_frame_rate = atoi(argv[argc-- + 1]);
+				break;
+			case 'b':
+			case 'B':
+				video_bitrate = atoi(argv[argc-- + 1]);
+				break;
+			case 'n':
+			case 'N':
+				fec_numerator = atoi(argv[argc-- + 1]);
+				break;
+			case 'd':
+			case 'D':
+				fec_denominator = atoi(argv[argc-- + 1]);
+				break;
+			case 's':
+			case 'S':
+				send_port = atoi(argv[argc-- + 1]);
+				break;
+			case 'r':
+			case 'R':
+				recv_port = atoi(argv[argc-- + 1]);
+				break;
+			case 'p':
+			case 'P':
+				leg_port = atoi(argv[argc-- + 1]);
+				break;
+			case 'o':
+			case 'O':
+				legs_spec = argv[argc-- + 1];
+				break;
+			case 'l':
+			case 'L':
+				resend_budget = atoi(argv[argc-- + 1]);
+				break;
+			case 'e':
+			case 'E':
+				impairment_spec = argv[argc-- + 1];
+				break;
+			case 'u':
+			case 'U':
+				stats_path = argv[argc-- + 1];
+				break;
+			case 'x':
+			case 'X':
+				path_mtu = atoi(argv[argc-- + 1]);
+				break;
+			case 'k':
+			case 'K':
+				udp_gro = atoi(argv[argc-- + 1]);
+				break;
+			case 'j':
+			case 'J':
+				uring_depth = atoi(argv[argc-- + 1]);
+				break;
+			default:
+				printf(
+					"ReceiveAndForward: \n"
+					"========================: \n"
+					"Takes the stream from GrabCompressAndSend and forwards it to any number\n"
+					"of ReceiveDecompressAndPlay without decoding it.\n\n"
+					"-w [800]  request capture width \n"
+					"-h [600]  request capture height \n"
+					"-f [30]   request capture frame rate\n"
+					"-b [300]  request video bitrate\n"
+					"-n [6]    fec_numerator ( redundancy numerator)\n"
+					"-d [5]    fec_denominator ( redundancy denominator) \n"
+					"-s [1408] port to send requests upstream to\n"
+					"-r [1407] port to take the stream on\n"
+					"-p [1410] port the receivers send their requests to,\n"
+					"          their -s\n"
+					"-o []     receivers to forward to, ip:port,... with the\n"
+					"          port each takes video on, their -r\n"
+					"-l [25]   percent of the incoming rate each receiver's\n"
+					"          resends may use\n"
+					"-e []     emulate network impairment on the stream coming in,\n"
+					"          same syntax as ReceiveDecompressAndPlay -e\n"
+					"-u []     serve counters and latency histograms on this\n"
+					"          unix domain socket\n"
+					"-x [0]    path MTU to accept packets for, 0 looks it up\n"
+					"-k [0]    have the kernel coalesce incoming packet runs (UDP GRO)\n"
+					"-j [0]    queue the packets to the receivers on an io_uring\n"
+					"          this deep, one submit per burst (Linux 6.0+)\n"
+					"\n");
+				exit(0);
+				break;
+			}
+		}
+	}
+
+	signal(SIGINT, on_signal);
+
+	if (stats_path && stats_serve(stats_path)) {
+		vpxlog_dbg(ERRORS, "Failed to serve stats on %s\n", stats_path);
+		return -1;
+	}
+
+	vpx_net_init();
+
+	// the stream comes in here, requests go upstream from an unbound socket
+	if (TC_OK != vpx_net_open(&up_data, vpx_IPv4, vpx_UDP)
+	 || TC_OK != vpx_net_open(&up, vpx_IPv4, vpx_UDP)
+	 || TC_OK != vpx_net_open(&down, vpx_IPv4, vpx_UDP))
+		return -1;
+
+	vpx_net_set_read_timeout(&up_data, 20);
+	if (TC_OK != vpx_net_bind(&up_data, 0, recv_port)) {
+		vpxlog_dbg(ERRORS, "Failed to take the stream on port %d\n", recv_port);
+		return -1;
+	}
+
+	if (udp_gro && TC_OK != vpx_net_udp_gro(&up_data, 1, &udp_gro))
+		vpxlog_dbg(ERRORS, "UDP GRO not available, receiving packet by packet\n");
+
+	if (impairment_spec) {
+		struct vpx_net_impairment impairment;
+
+		if (TC_OK != vpx_net_parse_impairment(impairment_spec, &impairment)
+		 || TC_OK != vpx_net_set_impairment(&up_data, &impairment)) {
+			vpxlog_dbg(ERRORS, "Bad impairment: %s\n", impairment_spec);
+			return -1;
+		}
+	}
+
+	// the legs: packets to them and their requests back on one socket,
+	// hundreds of sends a burst go to the kernel in one go with -j
+	if (TC_OK != vpx_net_bind(&down, 0, leg_port)) {
+		vpxlog_dbg(ERRORS, "Failed to take requests on port %d\n", leg_port);
+		return -1;
+	}
+	vpx_net_set_read_timeout(&down, 0);
+
+	if (uring_depth && TC_OK != vpx_net_uring(&down, 1, &uring_depth))
+		vpxlog_dbg(ERRORS, "io_uring not available, sending packet by packet\n");
+
+	if (legs_spec && legs_open(legs_spec))
+		return -1;
+
+	if (upstream_handshake(&up_data, &up) || create_cache(&cache, packet_size))
+		return -1;
+
+	vpx_net_set_read_timeout(&up_data, 1);
+	rate_us = report_time = arrival_time = 0;
+
+	while (signalquit) {
+		unsigned long long now_us;
+
+		// forward what came in, the sends to every leg go out together
+		for (i = 0; i < UPSTREAM_BURST; i++) {
+			bytes_read = 0;
+			rc = vpx_net_recvfrom(&up_data, one_packet, sizeof(one_packet), &bytes_read, &from);
+
+			if (rc != TC_OK || bytes_read <= 0)
+				break;
+
+			// the sender tells a group what the session is now and then
+			SESSION s;
+			if (!session_read((unsigned char *)one_packet, bytes_read, &s))
+				continue;
+
+			relay_packet(&down, (unsigned char *)one_packet, bytes_read);
+
+			// a burst fills the records long before it ends
+			if (arrival_count == ARRIVAL_MAX)
+				arrivals_send(&up);
+		}
+
+		// the legs' requests, answered from the cache or passed upstream
+		for (;;) {
+			bytes_read = 0;
+			rc = vpx_net_recvfrom(&down, one_packet, sizeof(one_packet), &bytes_read, &from);
+
+			if (rc != TC_OK || bytes_read <= 0)
+				break;
+
+			SESSION request;
+			if (!session_read((unsigned char *)one_packet, bytes_read, &request)) {
+				if (request.type == SESSION_REQUEST)
+					leg_join(&down, &up, &from, &request);
+				continue;
+			}
+
+			LEG *leg = leg_of(&from);
+			if (leg)
+				leg_feedback(leg, &up, (unsigned char *)one_packet, bytes_read);
+		}
+
+		for (i = 0; i < leg_count; i++) {
+			if (legs[i].joined && legs[i].count)
+				leg_drain(&legs[i], &down);
+		}
+
+		vpx_net_flush(&down);
+		legs_invite(&down);
+
+		// incoming rate over the last second
+		now_us = get_time_us();
+		if (now_us - rate_us >= 1000000) {
+			incoming_bytes_per_s = rate_us ? (unsigned int)(rate_bytes * 1000000ULL / (now_us - rate_us)) : 0;
+			rate_us = now_us;
+			rate_bytes = 0;
+		}
+
+		// what the relay got, for the sender's FEC and congestion control
+		if (get_time() - report_time >= REPORT_INTERVAL_MS) {
+			unsigned char buffer[REPORT_SIZE];
+			tc32 bytes_sent;
+
+			report_time = get_time();
+			if (wire_version >= WIRE_VERSION_REPORTS)
+				vpx_net_sendto(&up, (tc8 *)buffer, report_write(&report, buffer), &bytes_sent, upstream);
+			memset(&report, 0, sizeof(report));
+		}
+
+		if (get_time() - arrival_time >= ARRIVAL_INTERVAL_MS)
+			arrivals_send(&up);
+	}
+
+	vpx_net_close(&down);
+	vpx_net_close(&up);
+	vpx_net_close(&up_data);
+	vpx_net_destroy();
+	free(cache.store);
+	stats_stop();
+
+	return 0;
+}
@@ -25,6 +25,9 @@
 extern "C"
 {
 #include "rtp.h"
+#include "ivf.h"
+#include "y4m.h"
+#include "stats.h"
 #define VPX_CODEC_DISABLE_COMPAT 1
 #include "vpx/vpx_decoder.h"
 #include "vpx/vp8dx.h"
@@ -47,9 +50,9 @@ typedef struct {
 #define HRE(y) if (FAILED(hr = y)) { vpxlog_dbg(ERRORS, # y ## ":%x\n", hr); };
 
 unsigned short first_seq_ever = 0;
-unsigned int lag_In_milli_seconds = 0;
+int lag_In_milli_seconds = 0;
 unsigned int first_time_stamp_ever = 0;
-unsigned int time_of_first_display = 0;
+unsigned long long time_of_first_display = 0;
 int given_up = 0;
 int givenup_skip = 0;
 int display_width = 800;
@@ -62,14 +65,141 @@ int skip_timeout = 800;
 int retry_interval = 50;
 unsigned short retry_count = 12;
 int drop_simulation = 0;
+const char *impairment_spec = NULL;
+const char *stats_path = NULL;
+int postproc_level = 3;
+int postproc_adapt = 1;
+const char *output_name = "sdl";
+unsigned int quit_after_frames = 0;
 unsigned short send_port = 1408;
 unsigned short recv_port = 1407;
+int path_mtu = 0;
+int udp_gro = 0;
+int uring_depth = 0;
+const char *multicast_group = NULL;
 unsigned int quit = 0;
 int signalquit = 1;
 
 unsigned char compressed_video_buffer[400000];
 unsigned char output_video_buffer[1280 * 1024 * 3];
-tc8 one_packet[8000];
+tc8 one_packet[WIRE_HEADER_MAX + MAX_PACKET_SIZE];
+
+// the session as the sender confirmed it, and a change to it waiting for
+// its confirmation, sent again when request_at comes
+SESSION session;
+unsigned char generation = 0;
+int decoder_threads = 1;
+int changing = 0;
+unsigned int request_at = 0;
+unsigned int request_retry_ms = SESSION_RETRY_MIN_MS;
+
+typedef struct {
+	int	flags;
+	int	deblocking_level;
+	int	noise_level;
+} POSTPROC_LEVEL;
+
+// post processing settings from cheapest (off) to most expensive
+POSTPROC_LEVEL const postproc_levels[] = {
+	{ 0, 0, 0 },
+	{ VP8_DEBLOCK, 3, 0 },
+	{ VP8_DEMACROBLOCK | VP8_DEBLOCK, 5, 0 },
+	{ VP8_DEMACROBLOCK | VP8_DEBLOCK | VP8_ADDNOISE, 5, 1 },
+};
+#define POSTPROC_LEVELS ((int)(sizeof(postproc_levels) / sizeof(postproc_levels[0])))
+
+typedef struct {
+	int		level;
+	int		max_level;
+	int		adapt;
+	unsigned int	frames;         // frames decoded at the current level
+	unsigned int	decode_avg;     // moving averages in us
+	unsigned int	display_avg;
+	unsigned int	downgrades;
+	unsigned int	upgrades;
+} POSTPROC;
+POSTPROC pp;
+
+int set_postproc(vpx_codec_ctx_t *decoder, POSTPROC *p, int level)
+{
+	vp8_postproc_cfg_t ppcfg;
+
+	if (level < 0)
+		level = 0;
+
+	if (level > p->max_level)
+		level = p->max_level;
+
+	ppcfg.post_proc_flag = postproc_levels[level].flags;
+	ppcfg.deblocking_level = postproc_levels[level].deblocking_level;
+	ppcfg.noise_level = postproc_levels[level].noise_level;
+
+	// without VPX_CODEC_USE_POSTPROC the decoder has nothing to configure
+	if (p->max_level && vpx_codec_control(decoder, VP8_SET_POSTPROC, &ppcfg)) {
+		vpxlog_dbg(ERRORS, "Failed to set post processing: %s\n", vpx_codec_error(decoder));
+		return -1;
+	}
+
+	p->level = level;
+	p->frames = 0;
+	return 0;
+}
+
+int create_postproc(vpx_codec_ctx_t *decoder, POSTPROC *p, int max_level, int adapt)
+{
+	if (max_level >= POSTPROC_LEVELS)
+		max_level = POSTPROC_LEVELS - 1;
+
+	if (max_level < 0)
+		max_level = 0;
+
+	p->max_level = max_level;
+	p->adapt = adapt;
+	p->decode_avg = 0;
+	p->display_avg = 0;
+	p->downgrades = 0;
+	p->upgrades = 0;
+
+	return set_postproc(decoder, p, max_level);
+}
+
+// Steps post processing down when decode plus display time gets close to
+// the frame interval, and back up once there is plenty of headroom again.
+// Times are in microseconds, a decode takes a few milliseconds.
+void adapt_postproc(vpx_codec_ctx_t *decoder, POSTPROC *p, unsigned int decode_us, unsigned int display_us)
+{
+	unsigned int budget = 1000000 / (capture_frame_rate > 0 ? capture_frame_rate : 30);
+	unsigned int cost;
+
+	// 1/8 weight for the newest sample
+	p->decode_avg += (int)(decode_us - p->decode_avg) / 8;
+	p->display_avg += (int)(display_us - p->display_avg) / 8;
+	p->frames++;
+	cost = p->decode_avg + p->display_avg;
+
+	if (p->frames % (5 * capture_frame_rate + 1) == 0)
+		vpxlog_dbg(STATS, "Postproc level %d/%d decode %d.%02d ms display %d.%02d ms budget %d ms down %d up %d\n",
+			   p->level, p->max_level,
+			   p->decode_avg / 1000, (p->decode_avg % 1000) / 10,
+			   p->display_avg / 1000, (p->display_avg % 1000) / 10,
+			   budget / 1000, p->downgrades, p->upgrades);
+
+	if (!p->adapt)
+		return;
+
+	// give the averages a few frames to settle after a change
+	if (cost > budget * 85 / 100 && p->level > 0 && p->frames >= 8) {
+		set_postproc(decoder, p, p->level - 1);
+		p->downgrades++;
+		vpxlog_dbg(STATS, "Postproc down to level %d, cost %d us budget %d us\n", p->level, cost, budget);
+	}
+	// only go back up after several seconds of headroom
+	else if (cost < budget / 2 && p->level < p->max_level && p->frames >= 4 * (unsigned int)capture_frame_rate) {
+		set_postproc(decoder, p, p->level + 1);
+		p->upgrades++;
+		vpxlog_dbg(STATS, "Postproc up to level %d, cost %d us budget %d us\n", p->level, cost, budget);
+	}
+}
 
 #define Sleep usleep
 extern "C" int _kbhit(void);
@@ -78,7 +208,12 @@ extern "C" int _kbhit(void);
 #include <SDL/SDL_audio.h>
 #include <SDL/SDL_timer.h>
 
+#include <libyuv/convert.h>
+#include <libyuv/scale.h>
+
 #include <strings.h>
+#include <signal.h>
+#include <unistd.h>
 #include <iostream>
 #include <stdio.h>
 using namespace std;
@@ -99,6 +234,11 @@ char driver[128];
 const char *videodevice = NULL;
 SDL_Surface *pscreen;
 SDL_Overlay *overlay;
+SDL_Overlay *overlays[2];
+int back_overlay = 0;
+int stream_width = 0;       // size of the frames decoded last
+int stream_height = 0;
+unsigned int frames_shown = 0;
 SDL_Rect drect;
 SDL_Event sdlevent;
 SDL_Thread *mythread;
@@ -124,7 +264,10 @@ int setup_surface(void)
 		videodevice = "/dev/video0";
 
 	pscreen = SDL_SetVideoMode(display_width, display_height, 0, SDL_VIDEO_Flags);
-	overlay = SDL_CreateYUVOverlay(display_width, display_height, SDL_YV12_OVERLAY, pscreen);
+	overlays[0] = SDL_CreateYUVOverlay(display_width, display_height, SDL_YV12_OVERLAY, pscreen);
+	overlays[1] = SDL_CreateYUVOverlay(display_width, display_height, SDL_YV12_OVERLAY, pscreen);
+	overlay = overlays[0];
+	back_overlay = 1;
 
 	p = (unsigned char *)overlay->pixels[0];
 	drect.x = 0;
@@ -148,33 +291,55 @@ int setup_surface(void)
 };
 int show_frame(vpx_image_t *img)
 {
-	char caption[512];
-
-	sprintf(caption, "Receive Decompress and Play");
-	SDL_LockMutex(affmutex);
-	SDL_WM_SetCaption(caption, NULL);
-	SDL_LockYUVOverlay(overlay);
-	int i;
-
-	unsigned char *in = img->planes[VPX_PLANE_Y];
-	unsigned char *p = (unsigned char *)overlay->pixels[0];
-
-	for (i = 0; i < display_height; i++, in += img->stride[VPX_PLANE_Y], p += display_width)
-		memcpy(p, in, display_width);
-
-	in = img->planes[VPX_PLANE_U];
-
-	for (i = 0; i < display_height / 2; i++, in += img->stride[VPX_PLANE_U], p += display_width / 2)
-		memcpy(p, in, display_width / 2);
-
-	in = img->planes[VPX_PLANE_V];
+	unsigned long long start = get_time_ns();
+	SDL_Overlay *back = overlays[back_overlay];
+
+	// the sender encodes smaller under congestion, changing on a key frame,
+	// and the decoder follows. The overlays stay the size the window was
+	// set up for, a frame of any other size is scaled to fill them.
+	if ((int)img->d_w != stream_width || (int)img->d_h != stream_height) {
+		printf("Stream %dx%d\n", img->d_w, img->d_h);
+		stream_width = img->d_w;
+		stream_height = img->d_h;
+	}
 
-	for (i = 0; i < display_height / 2; i++, in += img->stride[VPX_PLANE_U], p += display_width / 2)
-		memcpy(p, in, display_width / 2);
+	// fill the overlay that isn't on screen without holding affmutex,
+	// libyuv collapses the copy into one block when the strides match.
+	// YV12 overlays store the V plane before the U plane.
+	SDL_LockYUVOverlay(back);
+	if (stream_width == back->w && stream_height == back->h) {
+		libyuv::I420Copy(
+			img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+			img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+			img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+			back->pixels[0], back->pitches[0],
+			back->pixels[2], back->pitches[2],
+			back->pixels[1], back->pitches[1],
+			back->w, back->h);
+	} else {
+		libyuv::I420Scale(
+			img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+			img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+			img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+			img->d_w, img->d_h,
+			back->pixels[0], back->pitches[0],
+			back->pixels[2], back->pitches[2],
+			back->pixels[1], back->pitches[1],
+			back->w, back->h,
+			libyuv::kFilterBilinear);
+	}
+	SDL_UnlockYUVOverlay(back);
 
-	SDL_UnlockYUVOverlay(overlay);
+	// flip: the event thread only ever sees a completely filled overlay
+	SDL_LockMutex(affmutex);
+	overlay = back;
 	SDL_DisplayYUVOverlay(overlay, &drect);
 	SDL_UnlockMutex(affmutex);
+
+	back_overlay ^= 1;
+	frames_shown++;
+	stats_add(STAT_FRAMES_SHOWN, 1);
+	stats_since(HIST_SHOW_FRAME, start);
 	return 0;
 }
 
@@ -182,9 +347,28 @@ void destroy_surface(void)
 {
 	SDL_WaitThread(mythread, &status);
 	SDL_DestroyMutex(affmutex);
+	SDL_FreeYUVOverlay(overlays[0]);
+	SDL_FreeYUVOverlay(overlays[1]);
 	SDL_Quit();
 }
 
+// asks for another bitrate or FEC group without restarting, the parity
+// packets per group stay; the main loop sends the request
+void change_session(int bitrate, int denominator)
+{
+	if (bitrate < 30 || denominator < 1 || denominator > 15)
+		return;
+
+	fec_numerator += denominator - fec_denominator;
+	fec_denominator = denominator;
+	video_bitrate = bitrate;
+	generation++;
+	request_retry_ms = SESSION_RETRY_MIN_MS;
+	request_at = get_time();
+	changing = 1;
+	printf("Asking for %dkbps %d/%dFEC\n", video_bitrate, fec_numerator, fec_denominator);
+}
+
 static int event_thread(void *data)
 {
 	struct pt_data *gdata = (struct pt_data *)data;
@@ -192,10 +376,24 @@ static int event_thread(void *data)
 	SDL_Event *sdlevent = gdata->ptsdlevent;
 	SDL_Rect *drect = gdata->drect;
 	SDL_mutex *affmutex = gdata->affmutex;
+	unsigned int caption_time = get_time();
+	unsigned int caption_frames = frames_shown;
 
 	while (signalquit) {
 		SDL_LockMutex(affmutex);
 
+		// refresh the caption about once a second instead of every frame
+		if (get_time() - caption_time >= 1000) {
+			char caption[512];
+			unsigned int now = get_time();
+
+			sprintf(caption, "Receive Decompress and Play - %d fps, post processing %d",
+				(frames_shown - caption_frames) * 1000 / (now - caption_time), pp.level);
+			SDL_WM_SetCaption(caption, NULL);
+			caption_time = now;
+			caption_frames = frames_shown;
+		}
+
 		while (SDL_PollEvent(sdlevent)) { //scan the event queue
 			switch (sdlevent->type) {
 			case SDL_VIDEORESIZE:
@@ -208,14 +406,19 @@ static int event_thread(void *data)
 				break;
 			case SDL_KEYDOWN:
 
+				// a/z bitrate up/down, s/x smaller/larger FEC groups
 				switch (sdlevent->key.keysym.sym) {
 				case SDLK_a:
+					change_session(video_bitrate * 5 / 4, fec_denominator);
 					break;
 				case SDLK_s:
+					change_session(video_bitrate, fec_denominator - 1);
 					break;
 				case SDLK_z:
+					change_session(video_bitrate * 4 / 5, fec_denominator);
 					break;
 				case SDLK_x:
+					change_session(video_bitrate, fec_denominator + 1);
 					break;
 				default:
 					break;
@@ -236,6 +439,150 @@ static int event_thread(void *data)
 	return 0;
 }
 
+enum {
+	OUTPUT_SDL = 0,
+	OUTPUT_NULL,
+	OUTPUT_IVF,
+	OUTPUT_Y4M,
+	OUTPUT_I420
+};
+
+int output_mode = OUTPUT_SDL;
+FILE *outfile = NULL;
+unsigned int frames_written = 0;
+unsigned long long bytes_written = 0;
+
+// "sdl" shows a window, "null" decodes and drops, anything else is a file
+// whose extension picks the format: .ivf (compressed), .y4m or raw I420.
+int open_output(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	if (strcmp(name, "sdl") == 0) {
+		output_mode = OUTPUT_SDL;
+		return 0;
+	}
+
+	if (strcmp(name, "null") == 0) {
+		output_mode = OUTPUT_NULL;
+		return 0;
+	}
+
+	if (ext && strcasecmp(ext, ".ivf") == 0)
+		output_mode = OUTPUT_IVF;
+	else if (ext && strcasecmp(ext, ".y4m") == 0)
+		output_mode = OUTPUT_Y4M;
+	else
+		output_mode = OUTPUT_I420;
+
+	if (!(outfile = fopen(name, "wb"))) {
+		vpxlog_dbg(ERRORS, "Failed to open %s for writing\n", name);
+		return -1;
+	}
+
+	// frame count is filled in when the file is closed
+	if (output_mode == OUTPUT_IVF)
+		ivf_write_header(outfile, ivf_fourcc, display_width, display_height, capture_frame_rate, 1, 0);
+
+	return 0;
+}
+
+// a Y4M or raw file holds one size, the first frame's. The sender encodes
+// smaller under congestion and back, frames of another size are scaled to it.
+vpx_image_t output_img;
+unsigned int output_width = 0;
+unsigned int output_height = 0;
+
+vpx_image_t *output_frame(vpx_image_t *img)
+{
+	if (!output_width) {
+		output_width = img->d_w;
+		output_height = img->d_h;
+	}
+
+	if (img->d_w == output_width && img->d_h == output_height)
+		return img;
+
+	if (!output_img.img_data
+	 && !vpx_img_alloc(&output_img, VPX_IMG_FMT_I420, output_width, output_height, 1))
+		return NULL;
+
+	libyuv::I420Scale(
+		img->planes[VPX_PLANE_Y], img->stride[VPX_PLANE_Y],
+		img->planes[VPX_PLANE_U], img->stride[VPX_PLANE_U],
+		img->planes[VPX_PLANE_V], img->stride[VPX_PLANE_V],
+		img->d_w, img->d_h,
+		output_img.planes[VPX_PLANE_Y], output_img.stride[VPX_PLANE_Y],
+		output_img.planes[VPX_PLANE_U], output_img.stride[VPX_PLANE_U],
+		output_img.planes[VPX_PLANE_V], output_img.stride[VPX_PLANE_V],
+		output_width, output_height,
+		libyuv::kFilterBilinear);
+	return &output_img;
+}
+
+int write_output(unsigned char *data, unsigned int size, vpx_image_t *img)
+{
+	// only frames shown or written count towards -q and the fps summary,
+	// the decoder doesn't hand back an image for every frame it takes
+	if (!img && output_mode != OUTPUT_IVF)
+		return 0;
+
+	if (img && (output_mode == OUTPUT_Y4M || output_mode == OUTPUT_I420)
+	 && !(img = output_frame(img)))
+		return -1;
+
+	switch (output_mode) {
+	case OUTPUT_SDL:
+		show_frame(img);
+		break;
+	case OUTPUT_IVF:
+		ivf_write_frame_size(outfile, size, frames_written);
+		fwrite(data, 1, size, outfile);
+		break;
+	case OUTPUT_Y4M:
+		// the header needs the size of what the decoder actually produced
+		if (!frames_written)
+			y4m_write_file_header(outfile, img->d_w, img->d_h, capture_frame_rate, 1);
+
+		y4m_write_frame(outfile, img);
+		break;
+	case OUTPUT_I420:
+		i420_write_frame(outfile, img);
+		break;
+	default:
+		break;
+	}
+
+	frames_written++;
+	bytes_written += size;
+	return 0;
+}
+
+void close_output(void)
+{
+	if (!outfile)
+		return;
+
+	if (output_mode == OUTPUT_IVF && !fseek(outfile, 0, SEEK_SET))
+		ivf_write_header(outfile, ivf_fourcc, display_width, display_height, capture_frame_rate, 1, frames_written);
+
+	fclose(outfile);
+	outfile = NULL;
+	vpx_img_free(&output_img);
+}
+
+// a key press on the console ends the session, stdin redirected from a file
+// or /dev/null (as in CI) always looks readable so it is ignored.
+int key_pressed(void)
+{
+	return isatty(0) && _kbhit();
+}
+
+void on_signal(int sig)
+{
+	signalquit = 0;
+}
+
 typedef struct {
 	unsigned int	size;
 	unsigned int	count;
@@ -246,16 +593,45 @@ typedef struct {
 	SKIPS		s[SS];
 	unsigned int	skip_ptr;
 	PACKET		p[PS];
+	unsigned char	*store;
 	unsigned int	last_frame_timestamp;
 	unsigned short	last_seq;
 } DEPACKETIZER;
 DEPACKETIZER y;
 
-int create_depacketizer(DEPACKETIZER *x)
+// latency probes by media timestamp, see rtp.h
+typedef struct {
+	unsigned int		timestamp;
+	LATENCY_PROBE		probe;
+	unsigned long long	received_us;
+} FRAME_PROBE;
+
+#define PROBES 64
+FRAME_PROBE probes[PROBES];
+
+// agreed on in the handshake, see rtp.h
+int wire_version = WIRE_VERSION_RAW;
+
+// what arrived since the last receiver report
+RECEIVER_REPORT report;
+unsigned int report_time = 0;
+
+// arrival times not yet fed back to the sender's congestion control
+ARRIVAL arrivals[ARRIVAL_MAX];
+unsigned int arrival_count = 0;
+unsigned int arrival_time = 0;
+
+int create_depacketizer(DEPACKETIZER *x, unsigned int packet_size)
 {
 	unsigned int sn;
 
-	x->size = PACKET_SIZE;
+	// payload slots for the negotiated packet size
+	x->store = packets_alloc(x->p, PS, packet_size);
+
+	if (!x->store)
+		return -1;
+
+	x->size = packet_size;
 	x->max = PS;
 	x->skip_ptr = 0;
 	x->count = 0;
@@ -366,12 +742,20 @@ void check_recovery(DEPACKETIZER *p, PACKET *x)
 
 int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size)
 {
-	PACKET *x = (PACKET *)data;
+	static unsigned char rx_data[MAX_PACKET_SIZE];
+	static PACKET rx = { 0 };
+	PACKET *x = &rx;
 	unsigned int skip_fill = 0;
+	LATENCY_PROBE probe;
+	int has_probe = 0;
+
+	// decode the wire header, the packet store only holds plain packets
+	rx.data = rx_data;
 
-	// random drops
-	if ((rand() & 1023) < drop_simulation)
+	if (packet_read((unsigned char *)data, size, wire_version, x, &probe, &has_probe) || x->size > p->size) {
+		vpxlog_dbg(DISCARD, "Malformed packet of %d bytes\n", size);
 		return 0;
+	}
 
 	// wrong ssrc exit
 	if (p->ssrc != x->ssrc)
@@ -381,6 +765,28 @@ int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size)
 	if (p->p[x->seq & PSM].seq == x->seq && p->p[x->seq & PSM].size)
 		return 0;
 
+	report.received++;
+
+	if (arrival_count < ARRIVAL_MAX) {
+		arrivals[arrival_count].seq = x->seq;
+		arrivals[arrival_count].arrival_us = (unsigned int)get_time_us();
+		arrival_count++;
+	}
+
+	// a hole filled before we asked for a resend was reordering, not loss
+	if ((short)(x->seq - p->last_seq) < 0 && report.lost) {
+		int i;
+
+		for (i = 0; i < SS; i++) {
+			if (p->s[i].seq == x->seq && !p->s[i].received) {
+				if (!p->s[i].retry)
+					report.lost--;
+
+				break;
+			}
+		}
+	}
+
 	// on the first received packet record first time ever numbers
 	if (!first_time_stamp_ever) {
 		first_time_stamp_ever = x->timestamp;
@@ -431,12 +837,17 @@ int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size)
 		skip_fill = 1;
 
 	// copy to the packet store
-	x->size = size - PACKET_HEADER_SIZE;
+	if (x->size < p->size)
+		memset(x->data + x->size, 0, p->size - x->size);
 
-	if (x->size < PACKET_SIZE)
-		memset(x->data + x->size, 0, PACKET_SIZE - x->size);
+	packet_copy(&p->p[x->seq & PSM], x, p->size);
 
-	p->p[x->seq & PSM] = *x;
+	if (has_probe) {
+		FRAME_PROBE *fp = &probes[x->timestamp % PROBES];
+		fp->timestamp = x->timestamp;
+		fp->probe = probe;
+		fp->received_us = get_time_us();
+	}
 
 	vpxlog_dbg(LOG_PACKET, "Received Packet %d, %d : new: %d, frame type: %d given_up: %d oldest: %d \n", x->seq, p->p[x->seq & PSM].timestamp, x->new_frame, x->frame_type, given_up, p->oldest_seq);
 
@@ -452,6 +863,10 @@ int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size)
 			vpxlog_dbg(SKIP, "Skipped Packet  %d\n", sn);
 			add_skip(p, sn);
 		}
+
+		sn = x->seq - p->last_seq - 1;
+		report.lost += sn;
+		report.bursts[report_burst(sn)]++;
 	}
 
 	if (!skip_fill)
@@ -460,8 +875,42 @@ int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size)
 	return 0;
 }
 
+// breaks a probed frame's latency down by stage, from capture to shown
+void report_probe(unsigned int timestamp, unsigned long long complete_us, unsigned long long decoded_us, unsigned long long shown_us)
+{
+	FRAME_PROBE *fp = &probes[timestamp % PROBES];
+	LATENCY_PROBE *pr = &fp->probe;
+
+	if (fp->timestamp != timestamp || !pr->capture_us)
+		return;
+
+	// the sender's times only mean something on a clock we share, i.e. the same host
+	if (pr->capture_us > pr->encoded_us || pr->encoded_us > pr->sent_us || pr->sent_us > fp->received_us) {
+		vpxlog_dbg(STATS, "Latency probe %u: sender clock not comparable\n", timestamp);
+		pr->capture_us = 0;
+		return;
+	}
+
+	stats_record(HIST_PROBE_ENCODE, (pr->encoded_us - pr->capture_us) * 1000);
+	stats_record(HIST_PROBE_QUEUE, (pr->sent_us - pr->encoded_us) * 1000);
+	stats_record(HIST_PROBE_NETWORK, (fp->received_us - pr->sent_us) * 1000);
+	stats_record(HIST_PROBE_REASSEMBLY, (complete_us - fp->received_us) * 1000);
+	stats_record(HIST_PROBE_DECODE, (decoded_us - complete_us) * 1000);
+	stats_record(HIST_PROBE_DISPLAY, (shown_us - decoded_us) * 1000);
+	stats_record(HIST_GLASS_TO_GLASS, (shown_us - pr->capture_us) * 1000);
+
+	vpxlog_dbg(FRAME, "Frame %u latency %llu us: encode %llu queue %llu network %llu reassembly %llu decode %llu display %llu\n",
+		   timestamp, shown_us - pr->capture_us,
+		   pr->encoded_us - pr->capture_us, pr->sent_us - pr->encoded_us,
+		   fp->received_us - pr->sent_us, complete_us - fp->received_us,
+		   decoded_us - complete_us, shown_us - decoded_us);
+
+	pr->capture_us = 0;
+}
+
 int rebuild_packet(DEPACKETIZER *p, unsigned short seq)
 {
+	unsigned long long start = get_time_ns();
 	unsigned short seqp, seqj;
 	long long *in[MAX_NUMERATOR];
 	long long *out = (long long *)p->p[seq & PSM].data;
@@ -523,7 +972,7 @@ int rebuild_packet(DEPACKETIZER *p, unsigned short seq)
 		return -1;
 
 	// go through a full packet's worth of data.
-	for (j = 0; j < PACKET_SIZE / sizeof(long long); j++) {
+	for (j = 0; j < p->size / sizeof(long long); j++) {
 		// start with the most recent packet
 		*out = *(in[0]);
 
@@ -540,11 +989,13 @@ int rebuild_packet(DEPACKETIZER *p, unsigned short seq)
 	// real data filled to the brim with data.
 	p->p[seq & PSM].seq = seq;
 	p->p[seq & PSM].type = DATAPACKET;
-	p->p[seq & PSM].size = PACKET_SIZE;
+	p->p[seq & PSM].size = p->size;
 	p->p[seq & PSM].timestamp = pp->timestamp;
 	p->p[seq & PSM].new_frame = 0;
 	p->p[seq & PSM].end_frame = 0;
 	p->p[seq & PSM].frame_type = pp->frame_type;
+	p->p[seq & PSM].layer = pp->layer;
+	p->p[seq & PSM].tl0_index = pp->tl0_index;
 
 	// logging what packets we used to rebuild
 	if (LOG_MASK & REBUILD) {
@@ -573,12 +1024,18 @@ int rebuild_packet(DEPACKETIZER *p, unsigned short seq)
 		} else {
 			// this must be the frame start
 			p->p[seq & PSM].frame_type = np->frame_type;
+			p->p[seq & PSM].layer = np->layer;
+			p->p[seq & PSM].tl0_index = np->tl0_index;
 			p->p[seq & PSM].timestamp = np->timestamp;
 			p->p[seq & PSM].new_frame = 1;
 		}
 	}
 
 	check_recovery(p, &p->p[seq & PSM]);
+
+	report.rebuilt++;
+	stats_add(STAT_PACKETS_REBUILT, 1);
+	stats_since(HIST_REBUILD, start);
 	return 0;
 }
 
@@ -641,6 +1098,7 @@ int frame_ready(DEPACKETIZER *p)
 }
 int get_frame(DEPACKETIZER *p, unsigned char *data, int size, unsigned int *outsize, unsigned int *timestamp)
 {
+	unsigned long long start = get_time_ns();
 	*outsize = 0;
 
 	// check if we have a whole frame.
@@ -678,13 +1136,190 @@ int get_frame(DEPACKETIZER *p, unsigned char *data, int size, unsigned int *outs
 		p->last_frame_timestamp = *timestamp;
 		p->oldest_seq = seq + 1;
 
-
+		stats_since(HIST_GET_FRAME, start);
 		return 1;
 	}
 
 	return 0;
 }
 
+// tells the sender what arrived since the last report, it sizes its FEC by it
+void send_report(struct vpxsocket *vpx_sock, union vpx_sockaddr_x *address)
+{
+	unsigned char buffer[REPORT_SIZE];
+	int bytes_sent;
+
+	report_time = get_time();
+
+	if (wire_version < WIRE_VERSION_REPORTS)
+		return;
+
+	vpxlog_dbg(STATS, "Report: %d received, %d lost, %d rebuilt, bursts %d %d %d %d\n",
+		   report.received, report.lost, report.rebuilt,
+		   report.bursts[0], report.bursts[1], report.bursts[2], report.bursts[3]);
+
+	vpx_net_sendto(vpx_sock, (tc8 *)buffer, report_write(&report, buffer), &bytes_sent, *address);
+	memset(&report, 0, sizeof(report));
+}
+
+// tells the sender when packets arrived, it backs its bitrate off as the delay grows
+void send_arrivals(struct vpxsocket *vpx_sock, union vpx_sockaddr_x *address)
+{
+	unsigned char buffer[ARRIVAL_SIZE(ARRIVAL_MAX)];
+	int bytes_sent;
+
+	arrival_time = get_time();
+
+	if (wire_version < WIRE_VERSION_ARRIVALS || !arrival_count)
+		return;
+
+	vpx_net_sendto(vpx_sock, (tc8 *)buffer, arrivals_write(arrivals, arrival_count, buffer), &bytes_sent, *address);
+	arrival_count = 0;
+}
+
+// tells the sender a frame decoded intact, it recovers from the buffers that
+// frame updated instead of sending a key frame
+void send_ack(struct vpxsocket *vpx_sock, union vpx_sockaddr_x *address, unsigned int timestamp)
+{
+	unsigned char buffer[ACK_SIZE];
+	int bytes_sent;
+
+	if (wire_version < WIRE_VERSION_ACKS)
+		return;
+
+	vpx_net_sendto(vpx_sock, (tc8 *)buffer, ack_write(timestamp, buffer), &bytes_sent, *address);
+	stats_add(STAT_FRAME_ACKS_SENT, 1);
+}
+
+// what this receiver asks the sender for, within what it offered; with a
+// new generation, a change to the running session
+void send_request(struct vpxsocket *vpx_sock, union vpx_sockaddr_x *address)
+{
+	unsigned char buffer[SESSION_SIZE];
+	SESSION request;
+	int bytes_sent;
+
+	memset(&request, 0, sizeof(request));
+	request.type = SESSION_REQUEST;
+	request.generation = generation;
+	request.wire_version = WIRE_VERSION;
+	request.codecs = SESSION_CODEC_VP8;
+	request.fec = SESSION_FEC_XOR | SESSION_FEC_DUPLICATE | SESSION_FEC_ADAPTIVE;
+	request.fec_numerator = fec_numerator;
+	request.fec_denominator = fec_denominator;
+	request.layers = 3;
+	request.threads = decoder_threads;
+	request.width = display_width;
+	request.height = display_height;
+	request.frame_rate = capture_frame_rate;
+	request.packet_size = path_mtu ? packet_size_for_mtu(path_mtu, 0) : PACKET_SIZE;
+	request.data_port = recv_port;
+	request.kbps = video_bitrate;
+
+	vpx_net_sendto(vpx_sock, (tc8 *)buffer, session_write(&request, buffer), &bytes_sent, *address);
+}
+
+// nothing decodes before a key frame: after joining a group mid stream ask
+// for one, by giving up on the newest packet, until it comes
+unsigned int key_request_time = 0;
+int seen_key = 0;
+
+void request_key(struct vpxsocket *vpx_sock, union vpx_sockaddr_x *address, unsigned short seq)
+{
+	tc8 buffer[3];
+	int bytes_sent;
+
+	if (get_time() - key_request_time < 500)
+		return;
+
+	key_request_time = get_time();
+	buffer[0] = 'g';
+	buffer[1] = seq & 0x00ff;
+	buffer[2] = (seq & 0xff00) >> 8;
+	vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
+	stats_add(STAT_GIVE_UPS_SENT, 1);
+	vpxlog_dbg(DISCARD, "Waiting for a key frame, asked at %d\n", seq);
+}
+
+// A lost packet is only worth asking for if it may have been part of a base
+// layer frame: enhancement layer frames update no references and can go.
+// The packets we have on either side of the hole tell, by their layer and
+// the index of the base layer frame they build on. Senders without temporal
+// layers send everything as base layer frame 0, so their holes never qualify.
+int enhancement_hole(DEPACKETIZER *p, unsigned short seq)
+{
+	PACKET *before = NULL, *after = NULL;
+	unsigned short s;
+	unsigned int bases;
+
+	for (s = seq - 1; s != (unsigned short)(seq - SS); s--) {
+		if (p->p[s & PSM].seq == s) {
+			before = &p->p[s & PSM];
+			break;
+		}
+	}
+
+	for (s = seq + 1; s != (unsigned short)(p->last_seq + 1); s++) {
+		if (p->p[s & PSM].seq == s) {
+			after = &p->p[s & PSM];
+			break;
+		}
+	}
+
+	if (!before || !after)
+		return 0;
+
+	// the frames on either side reach into the hole
+	if ((!before->end_frame && !before->layer) || (!after->new_frame && !after->layer))
+		return 0;
+
+	// and whole frames in between, the base layer ones counted
+	bases = (unsigned char)(after->tl0_index - before->tl0_index);
+	if (after->new_frame && !after->layer)
+		bases = (unsigned char)(bases - 1);
+
+	return bases == 0;
+}
+
+// drops the frames an enhancement layer hole is in once they are the oldest,
+// up to the next frame that starts
+int drop_enhancement(DEPACKETIZER *p, unsigned short seq)
+{
+	unsigned short s, first = seq, next;
+	PACKET *head = &p->p[p->oldest_seq & PSM];
+
+	while (p->p[(first - 1) & PSM].seq != (unsigned short)(first - 1) && first != p->oldest_seq)
+		first--;
+
+	// frames before the hole's still to come out
+	if (first != p->oldest_seq
+	 && (head->seq != p->oldest_seq || head->timestamp != p->p[(first - 1) & PSM].timestamp || p->p[(first - 1) & PSM].end_frame))
+		return -1;
+
+	for (next = seq + 1; next != (unsigned short)(p->last_seq + 1); next++) {
+		PACKET *tp = &p->p[next & PSM];
+
+		if (tp->seq == next && tp->size && tp->new_frame && tp->type == DATAPACKET)
+			break;
+	}
+
+	if (next == (unsigned short)(p->last_seq + 1))
+		return -1;
+
+	vpxlog_dbg(SKIP, "Dropping enhancement layer frames %d to %d\n", p->oldest_seq, next - 1);
+
+	for (s = p->oldest_seq; s != next; s++) {
+		p->p[s & PSM].size = 0;
+		remove_skip(p, s);
+	}
+
+	p->oldest_seq = next;
+	p->last_frame_timestamp = p->p[next & PSM].timestamp - 1;
+	stats_add(STAT_LAYER_DROPS, 1);
+
+	return 0;
+}
+
 int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock, union vpx_sockaddr_x *address)
 {
 	unsigned int request_count = 0;
@@ -711,6 +1346,7 @@ int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock, union vpx_sockad
 			buffer[1] = seq & 0x00ff;
 			buffer[2] = (seq & 0xff00) >> 8;
 			vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
+			stats_add(STAT_GIVE_UPS_SENT, 1);
 			vpxlog_dbg(DISCARD, "Give up forever on sequence %d now %d :age :%d retry:%d \n", seq, now, p->s[givenup_skip].age, p->s[givenup_skip].retry);
 			p->s[givenup_skip].retry++;
 		}
@@ -723,6 +1359,8 @@ int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock, union vpx_sockad
 			request_count++;
 	}
 
+	stats_set(STAT_SKIP_STORE, request_count);
+
 	// go through the skip store
 	for (i = 0; i < SS; i++) {
 		// if this skip is still in play
@@ -751,10 +1389,17 @@ int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock, union vpx_sockad
 				p->s[i].received = 1;
 				p->s[i].age = 0;
 			}
+			// no use asking for an enhancement layer frame, the frames after
+			// it don't need it; once the FEC had its chance it goes
+			else if (enhancement_hole(p, seq)) {
+				if (p->s[i].age > retry_interval)
+					drop_enhancement(p, seq);
+			}
 			// time to give up we wasted enough time
 			else if (time_to_retry && (p->s[i].age > skip_timeout || request_count > retry_count)) {
 				given_up = 1;
 				givenup_skip = i;
+				stats_add(STAT_GIVEN_UP, 1);
 				vpxlog_dbg(LOG_PACKET, "Giving up: %d age:%d request_count:%d\n", seq, p->s[i].age, request_count);
 				break;
 			}
@@ -766,6 +1411,7 @@ int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock, union vpx_sockad
 				buffer[1] = seq & 0x00ff;
 				buffer[2] = (seq & 0xff00) >> 8;
 				vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
+				stats_add(STAT_NACKS_SENT, 1);
 				vpxlog_dbg(DISCARD, "Lost %d, skip: %d, Requesting Resend\n", seq, i);
 				p->s[i].retry++;
 			}
@@ -834,6 +1480,50 @@ int main(int argc, char *argv[])
 			case 'R':
 				recv_port = atoi(argv[argc-- + 1]);
 				break;
+			case 'p':
+			case 'P':
+				postproc_level = atoi(argv[argc-- + 1]);
+				break;
+			case 'a':
+			case 'A':
+				postproc_adapt = atoi(argv[argc-- + 1]);
+				break;
+			case 'o':
+			case 'O':
+				output_name = argv[argc-- + 1];
+				break;
+			case 'q':
+			case 'Q':
+				quit_after_frames = atoi(argv[argc-- + 1]);
+				break;
+			case 'e':
+			case 'E':
+				impairment_spec = argv[argc-- + 1];
+				break;
+			case 'u':
+			case 'U':
+				stats_path = argv[argc-- + 1];
+				break;
+			case 'x':
+			case 'X':
+				path_mtu = atoi(argv[argc-- + 1]);
+				break;
+			case 'k':
+			case 'K':
+				udp_gro = atoi(argv[argc-- + 1]);
+				break;
+			case 'j':
+			case 'J':
+				uring_depth = atoi(argv[argc-- + 1]);
+				break;
+			case 'm':
+			case 'M':
+				multicast_group = argv[argc-- + 1];
+				break;
+			case 'g':
+			case 'G':
+				decoder_threads = atoi(argv[argc-- + 1]);
+				break;
 			default:
 				printf(
 					"ReceiveDecompressAndPlay: \n"
@@ -851,8 +1541,28 @@ int main(int argc, char *argv[])
 					"-i [50]   time in milliseconds between attempts at a packet resend\n"
 					"-c [12]   number of lost packets before requesting recovery \n"
 					"-l [0]    packets to lose out of every 1000 \n"
+					"-e []     emulate network impairment on received packets, e.g.\n"
+					"          seed=1,loss=1,p_gb=0.5,p_bg=25,bad_loss=50,dup=0.1,\n"
+					"          reorder=1,reorder_delay=20,delay=40,jitter=10,rate=2000,queue=100\n"
+					"          (percentages, ms, kbps, packets; overrides -l)\n"
+					"-u []     serve counters and latency histograms on this\n"
+					"          unix domain socket\n"
 					"-s [1408] port to send requests to\n"
 					"-r [1407] port to receive requests on. \n"
+					"-x [0]    path MTU to accept packets for, 0 looks it up\n"
+					"-k [0]    have the kernel coalesce packet runs (UDP GRO,\n"
+					"          Linux 5.0+), they are split again on read\n"
+					"-j [0]    receive through an io_uring with this many buffers\n"
+					"          (Linux 6.0+), replaces -k\n"
+					"-m []     join this multicast group and take the video\n"
+					"          from it on the -r port\n"
+					"-g [1]    decoder threads, the sender splits frames into as\n"
+					"          many token partitions (up to 8)\n"
+					"-p [3]    post processing level 0 (off) - 3 (deblock + noise)\n"
+					"-a [1]    lower post processing when decoding falls behind\n"
+					"-o [sdl]  output: sdl, null (decode and drop), or a .ivf,\n"
+					"          .y4m or raw I420 file; anything but sdl is headless\n"
+					"-q [0]    quit after this many frames, 0 runs until a key press\n"
 					"\n");
 				exit(0);
 				break;
@@ -875,22 +1585,36 @@ int main(int argc, char *argv[])
 
 	vpx_codec_ctx_t decoder;
 	uint8_t *buf = NULL;
-	vp8_postproc_cfg_t ppcfg;
 	vpx_codec_dec_cfg_t cfg = { 0 };
-	int dec_flags =
-		VPX_CODEC_USE_ERROR_CONCEALMENT | VPX_CODEC_USE_POSTPROC;
+
+	// the sender splits frames into as many token partitions
+	cfg.threads = decoder_threads;
+	int dec_flags = VPX_CODEC_USE_ERROR_CONCEALMENT;
+
+	if (open_output(output_name))
+		return -1;
+
+	// headless runs are for measuring the pipeline, not for looking at it
+	if (output_mode != OUTPUT_SDL)
+		postproc_level = 0;
+
+	signal(SIGINT, on_signal);
+
+	if (stats_path && stats_serve(stats_path)) {
+		vpxlog_dbg(ERRORS, "Failed to serve stats on %s\n", stats_path);
+		return -1;
+	}
+
+	// post processing off means we don't even ask the decoder for it
+	if (postproc_level > 0)
+		dec_flags |= VPX_CODEC_USE_POSTPROC;
 
 	vpx_codec_dec_init(&decoder, &vpx_codec_vp8_dx_algo, &cfg, dec_flags);
 
 	buf = (uint8_t *)malloc(display_width * display_height * 3 / 2);
 
 	/* Config post processing settings for decoder */
-	ppcfg.post_proc_flag = VP8_DEMACROBLOCK | VP8_DEBLOCK | VP8_ADDNOISE;
-	ppcfg.deblocking_level = 5;
-	ppcfg.noise_level = 1;
-	vpx_codec_control(&decoder, VP8_SET_POSTPROC, &ppcfg);
-
-	create_depacketizer(&y);
+	create_postproc(&decoder, &pp, postproc_level, postproc_adapt);
 
 	vpx_net_init();
 
@@ -898,25 +1622,65 @@ int main(int argc, char *argv[])
 		return -1;
 
 	vpx_net_set_read_timeout(&vpx_sock, 20);
-	vpx_net_bind(&vpx_sock, 0, recv_port);
+
+	// several receivers, on this host too, can take the same group and port
+	if (multicast_group) {
+		if (TC_OK != vpx_net_join_multicast_addr(&vpx_sock, (tc8 *)multicast_group, recv_port)) {
+			vpxlog_dbg(ERRORS, "Failed to join %s\n", multicast_group);
+			return -1;
+		}
+	} else {
+		vpx_net_bind(&vpx_sock, 0, recv_port);
+	}
+
+	// one recvmsg per burst instead of per packet, vpx_net_recvfrom still
+	// hands them out one datagram at a time
+	if (udp_gro && TC_OK != vpx_net_udp_gro(&vpx_sock, 1, &udp_gro))
+		vpxlog_dbg(ERRORS, "UDP GRO not available, receiving packet by packet\n");
+
+	// the kernel keeps filling buffers between reads, vpx_net_recvfrom only
+	// enters it once they are all read
+	if (uring_depth && TC_OK != vpx_net_uring(&vpx_sock, 1, &uring_depth))
+		vpxlog_dbg(ERRORS, "io_uring not available, receiving packet by packet\n");
+
+	struct vpx_net_impairment impairment = { 0 };
+
+	if (impairment_spec) {
+		if (TC_OK != vpx_net_parse_impairment(impairment_spec, &impairment)) {
+			vpxlog_dbg(ERRORS, "Bad impairment: %s\n", impairment_spec);
+			return -1;
+		}
+	} else if (drop_simulation) {
+		impairment.loss_good = drop_simulation * 1000;
+		impairment.queue_packets = 1000;
+	}
+
+	// same seed, same losses: runs with -e are reproducible
+	srand(impairment.seed);
+
+	if ((impairment_spec || drop_simulation) && TC_OK != vpx_net_set_impairment(&vpx_sock, &impairment))
+		return -1;
 
 	if (TC_OK != vpx_net_open(&vpx_sock2, vpx_IPv4, vpx_UDP))
 		return -1;
 
-	int bytes_sent;
+	int packet_size = PACKET_SIZE;
+
+	// answer the sender's offer with a request, again after 10 ms and
+	// twice as long each time until it confirms; a confirmation alone
+	// (joining a group late) sets the session up as well
+	vpx_net_set_read_timeout(&vpx_sock, SESSION_RETRY_MIN_MS);
+	request_at = 0;
+
+	while (!key_pressed() && signalquit) {
+		SESSION s;
 
-	while (!_kbhit()) {
-		char initPacket[PACKET_SIZE];
-		sprintf(initPacket, "configuration  %d %d %d %d %d %d ", display_width, display_height, capture_frame_rate, video_bitrate, fec_numerator, fec_denominator);
 		rc = vpx_net_recvfrom(&vpx_sock, one_packet, sizeof(one_packet), &bytes_read, &address);
 
 		if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
 			vpxlog_dbg(DISCARD, "error\n");
 
-		if (bytes_read == -1)
-			bytes_read = 0;
-
-		if (bytes_read) {
+		if (rc == TC_OK && bytes_read > 0 && !session_read((unsigned char *)one_packet, bytes_read, &s)) {
 			if (!responded) {
 				char add[400];
 				sprintf(add, "%d.%d.%d.%d",
@@ -928,24 +1692,54 @@ int main(int argc, char *argv[])
 				vpxlog_dbg(LOG_PACKET, "Address of Sender : %s \n", add);
 				vpx_net_get_addr_info(add, send_port, vpx_IPv4, vpx_UDP, &address2);
 				responded = 1;
+				request_at = get_time();
+
+				// the largest packets we take, the sender may pick smaller ones
+				if (!path_mtu && vpx_net_path_mtu(vpx_IPv4, &address2, &path_mtu) != TC_OK)
+					path_mtu = 0;
 			}
 
-			if (strncmp(one_packet, "initiate call", PACKET_SIZE) == 0)
-				rc = vpx_net_sendto(&vpx_sock2, (tc8 *)&initPacket, PACKET_SIZE, &bytes_sent, address2);
+			if (s.type == SESSION_OFFER && !(s.codecs & SESSION_CODEC_VP8)) {
+				vpxlog_dbg(ERRORS, "The sender offers no codec we decode\n");
+				return -1;
+			}
 
-			if (strncmp(one_packet, "confirmed", PACKET_SIZE) == 0) {
-				rc = vpx_net_sendto(&vpx_sock2, (tc8 *)&initPacket, PACKET_SIZE, &bytes_sent, address2);
+			if (s.type == SESSION_CONFIRM) {
+				session = s;
+				generation = s.generation;
+				wire_version = s.wire_version;
+				packet_size = s.packet_size;
+				vpxlog_dbg(FRAME, "Wire format version %d, %d byte packets\n", wire_version, packet_size);
 				break;
 			}
 		}
 
-		Sleep(200);
+		if (responded && (int)(get_time() - request_at) >= 0) {
+			send_request(&vpx_sock2, &address2);
+			request_at = session_retry(get_time(), &request_retry_ms);
+		}
 	}
 
-	setup_surface();
+	if (wire_version < WIRE_VERSION_RAW || wire_version > WIRE_VERSION) {
+		vpxlog_dbg(ERRORS, "Can't read wire format version %d\n", wire_version);
+		return -1;
+	}
+
+	vpx_net_set_read_timeout(&vpx_sock, 20);
+
+	if (packet_size < MIN_PACKET_SIZE || packet_size > MAX_PACKET_SIZE || create_depacketizer(&y, packet_size)) {
+		vpxlog_dbg(ERRORS, "Can't hold %d byte packets\n", packet_size);
+		return -1;
+	}
+
+	if (output_mode == OUTPUT_SDL)
+		setup_surface();
+
+	unsigned int session_start = get_time();
 
 	/* Message loop for display window's thread */
-	while (!_kbhit() && signalquit) {
+	while (!key_pressed() && signalquit) {
+		unsigned long long receive_start = get_time_ns();
 		rc = vpx_net_recvfrom(&vpx_sock, one_packet, sizeof(one_packet), &bytes_read, &address);
 
 		if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
@@ -958,26 +1752,83 @@ int main(int argc, char *argv[])
 		if (bytes_read) {
 			unsigned int timestamp;
 			unsigned int size;
+			unsigned long long read_start = get_time_ns();
+			SESSION s;
+
+			// the sender confirming a change, or telling a group what the
+			// session is
+			if (!session_read((unsigned char *)one_packet, bytes_read, &s)) {
+				if (s.type == SESSION_CONFIRM && changing && s.generation == generation) {
+					session = s;
+					changing = 0;
+					printf("Sender confirms %dkbps %d/%dFEC\n", session.kbps, session.fec_numerator, session.fec_denominator);
+				}
+				continue;
+			}
+
+			stats_record(HIST_RECEIVE, read_start - receive_start);
+			stats_add(STAT_PACKETS_RECEIVED, 1);
+			stats_add(STAT_BYTES_RECEIVED, bytes_read);
+
 			read_packet(&y, one_packet, bytes_read);
 
+			stats_since(HIST_READ_PACKET, read_start);
+			stats_set(STAT_RECEIVE_RING, (unsigned short)(y.last_seq - y.oldest_seq));
+
 			while (get_frame(&y, compressed_video_buffer, sizeof(compressed_video_buffer), &size, &timestamp)) {
-				lag_In_milli_seconds = (unsigned int)((timestamp - first_time_stamp_ever) / 1000.0 - (get_time() - time_of_first_display));
-				vpxlog_dbg(FRAME, "Received frame %d, Lag: %d \n", timestamp, lag_In_milli_seconds);
+				unsigned long long complete_us = get_time_us();
 
 				if (!time_of_first_display) {
-					time_of_first_display = get_time();
+					time_of_first_display = get_time_us();
+				}
+
+				// media time (90 kHz) played so far against wall time passed
+				lag_In_milli_seconds = (int)((timestamp - first_time_stamp_ever) * 1000LL / RTP_CLOCK_RATE
+				                             - (long long)(get_time_us() - time_of_first_display) / 1000);
+				vpxlog_dbg(FRAME, "Received frame %u, Lag: %d \n", timestamp, lag_In_milli_seconds);
+
+				// bit 0 of the VP8 frame tag is clear on key frames
+				if (!seen_key) {
+					if (compressed_video_buffer[0] & 1) {
+						request_key(&vpx_sock2, &address2, y.last_seq);
+						continue;
+					}
+					seen_key = 1;
 				}
 
 				vpx_codec_iter_t iter = NULL;
 				vpx_image_t *img;
+				unsigned long long display_start_ns;
+				unsigned long long decode_start_ns = get_time_ns();
 
-				if (vpx_codec_decode(&decoder, compressed_video_buffer, sizeof(compressed_video_buffer), 0, 0)) {
+				if (vpx_codec_decode(&decoder, compressed_video_buffer, size, 0, 0)) {
+					stats_add(STAT_DECODE_ERRORS, 1);
 					vpxlog_dbg(FRAME, "Failed to decode frame: %s\n", vpx_codec_error(&decoder));
 					return -1;
 				}
 
+				// post processing happens when the frame is fetched
 				img = vpx_codec_get_frame(&decoder, &iter);
-				show_frame(img);
+				display_start_ns = get_time_ns();
+				stats_since(HIST_DECODE, decode_start_ns);
+				stats_add(STAT_FRAMES_DECODED, 1);
+				unsigned long long decoded_us = get_time_us();
+
+				// after giving up on a frame the references are stale until
+				// the recovery frame, the decoder can't know that by itself
+				int corrupted = 1;
+				if (!given_up && !vpx_codec_control(&decoder, VP8D_GET_FRAME_CORRUPTED, &corrupted) && !corrupted)
+					send_ack(&vpx_sock2, &address2, timestamp);
+
+				write_output(compressed_video_buffer, size, img);
+				report_probe(timestamp, complete_us, decoded_us, get_time_us());
+
+				adapt_postproc(&decoder, &pp,
+					(unsigned int)((display_start_ns - decode_start_ns) / 1000),
+					(unsigned int)((get_time_ns() - display_start_ns) / 1000));
+
+				if (quit_after_frames && frames_written >= quit_after_frames)
+					signalquit = 0;
 			}
 			;
 
@@ -997,19 +1848,49 @@ int main(int argc, char *argv[])
 		} else {
 			age_skip_store(&y, &vpx_sock2, &address2);
 		}
+
+		if (get_time() - report_time >= REPORT_INTERVAL_MS)
+			send_report(&vpx_sock2, &address2);
+
+		if (arrival_count == ARRIVAL_MAX || get_time() - arrival_time >= ARRIVAL_INTERVAL_MS)
+			send_arrivals(&vpx_sock2, &address2);
+
+		if (changing && (int)(get_time() - request_at) >= 0) {
+			send_request(&vpx_sock2, &address2);
+			request_at = session_retry(get_time(), &request_retry_ms);
+		}
 	}
 
 	signalquit = 0;
 
+	unsigned int session_time = get_time() - session_start;
+	printf("%d frames, %llu bytes in %d ms: %.2f fps %.3f Mbps\n",
+	       frames_written, bytes_written, session_time,
+	       frames_written * 1000.0 / (session_time ? session_time : 1),
+	       bytes_written * 8.0 / 1000.0 / (session_time ? session_time : 1));
+	close_output();
+
+	struct vpx_net_impairment_stats impairment_stats;
+
+	if (TC_OK == vpx_net_get_impairment_stats(&vpx_sock, &impairment_stats))
+		printf("impairment: %u received, %u lost (%u in bursts), %u duplicated, %u reordered, %u queue drops\n",
+		       impairment_stats.received, impairment_stats.lost, impairment_stats.burst_lost,
+		       impairment_stats.duplicated, impairment_stats.reordered, impairment_stats.queue_dropped);
+
 	if (vpx_codec_destroy(&decoder)) {
 		vpxlog_dbg(DISCARD, "Failed to destroy decoder: %s\n", vpx_codec_error(&decoder));
 		return -1;
 	}
 
 	free(buf);
+	free(y.store);
 
 	vpx_net_close(&vpx_sock);
 	vpx_net_destroy();
-	destroy_surface();
+	stats_stop();
+
+	if (output_mode == OUTPUT_SDL)
+		destroy_surface();
+
 	return 0;
 }
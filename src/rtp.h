@@ -8,8 +8,50 @@
  *  be found in the AUTHORS file in the root of the source tree.
  */
 
+#ifndef RTP_H
+#define RTP_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define LARGESTFRAMESIZE 1000000
+
+// Payload bytes per packet. The size in use is agreed on in the handshake
+// from the path MTU, PACKET_SIZE is what peers that can't negotiate use.
 #define PACKET_SIZE 1400
+#define MIN_PACKET_SIZE 256
+#define MAX_PACKET_SIZE 9152        // 9216 byte jumbo frames
+
+// Wire formats, agreed on when the session is set up
+#define WIRE_VERSION_RAW 1          // the PACKET struct as laid out in memory
+#define WIRE_VERSION_RTP 2          // RTP (RFC 3550) + VP8 descriptor (RFC 7741)
+#define WIRE_VERSION_REPORTS 3      // same packets, receiver reports on the feedback channel
+#define WIRE_VERSION_ARRIVALS 4     // and arrival times for congestion control
+#define WIRE_VERSION_ACKS 5         // and acknowledgements of decoded frames
+#define WIRE_VERSION WIRE_VERSION_ACKS      // the newest this build speaks
+#define WIRE_HEADROOM 64
+#define RAW_HEADER_SIZE 17
+
+#define RTP_HEADER_SIZE 12
+#define RTP_PT_VP8 96               // to 103: | parity follows << 2 | frame_type
+#define RTP_PT_XOR 104              // payload starts redundant_count << 2 | frame_type
+#define RTP_EXT_ONE_BYTE 0xBEDE     // RFC 8285
+#define RTP_EXT_PROBE_CAPTURE 2     // latency probe, 8 bytes each
+#define RTP_EXT_PROBE_ENCODED 3
+#define RTP_EXT_PROBE_SENT 4
+#define RTP_EXT_LAYER 5             // temporal layer, base layer frame index
+#define VP8_DESCRIPTOR_SIZE 1
+
+// the longest header either version writes, descriptor, probe and layer included
+#define WIRE_HEADER_MAX (RTP_HEADER_SIZE + 4 + 32 + VP8_DESCRIPTOR_SIZE)
+
+// version 1 carries the latency probe in a plain RFC 3550 extension
+#define RAW_PROBE_PROFILE 0x5650
+#define RAW_PROBE_SIZE (4 + 24)
+
+// RTP media clock for video (RFC 3551), ticks per second
+#define RTP_CLOCK_RATE 90000
 
 enum
 {
@@ -31,10 +73,11 @@ enum
     DISCARD = 8,
     FRAME   = 16,
     ERRORS = 32,
+    STATS  = 64,
 };
 
 
-#define LOG_MASK  ( ERRORS | SKIP|REBUILD|DISCARD ) // ( ERRORS|LOG_PACKET|FRAME|SKIP|REBUILD|DISCARD ) //
+#define LOG_MASK  ( ERRORS | SKIP|REBUILD|DISCARD|STATS ) // ( ERRORS|LOG_PACKET|FRAME|SKIP|REBUILD|DISCARD|STATS ) //
 
 typedef struct
 {
@@ -51,22 +94,705 @@ typedef struct
     unsigned int csrc ;  // repeated up to 15 times
 
     unsigned int type : 1;
-    unsigned int redundant_count : 3;
+    unsigned int redundant_count : 4;   // the version 1 header has room for 7
     unsigned int new_frame: 1;
     unsigned int end_frame: 1;
     unsigned int frame_type: 2;
 
-    unsigned char data[PACKET_SIZE];
+    // temporal layer, and which base layer frame (counting, 8 bit) the
+    // frame builds on; not in the version 1 header, there they stay 0
+    unsigned int layer: 2;
+    unsigned char tl0_index;
 
     // this value doesn't actually get written or read
     unsigned int size;
 
+    // the packet size's worth of payload, with WIRE_HEADROOM bytes in
+    // front of it to serialize the wire header into, see packets_alloc
+    unsigned char *data;
+
 } PACKET;
 
-#define PACKET_HEADER_SIZE offsetof(PACKET,data)
+// Latency probe: the sender's monotonic clock in us at capture, encode done
+// and first send, carried on the first packet of a frame. It only exists on
+// the wire, the receiver strips it before the packet is stored, so FEC never
+// covers it.
+typedef struct
+{
+    unsigned long long capture_us;
+    unsigned long long encoded_us;
+    unsigned long long sent_us;
+} LATENCY_PROBE;
+
+static inline void put_be16(unsigned char *b, unsigned int v)
+{
+    b[0] = (unsigned char)(v >> 8);
+    b[1] = (unsigned char)v;
+}
+
+static inline void put_be32(unsigned char *b, unsigned int v)
+{
+    put_be16(b, v >> 16);
+    put_be16(b + 2, v);
+}
+
+static inline void put_be64(unsigned char *b, unsigned long long v)
+{
+    put_be32(b, (unsigned int)(v >> 32));
+    put_be32(b + 4, (unsigned int)v);
+}
+
+static inline void put_le16(unsigned char *b, unsigned int v)
+{
+    b[0] = (unsigned char)v;
+    b[1] = (unsigned char)(v >> 8);
+}
+
+static inline void put_le32(unsigned char *b, unsigned int v)
+{
+    b[0] = (unsigned char)v;
+    b[1] = (unsigned char)(v >> 8);
+    b[2] = (unsigned char)(v >> 16);
+    b[3] = (unsigned char)(v >> 24);
+}
+
+static inline unsigned int get_le16(const unsigned char *b)
+{
+    return b[0] | (b[1] << 8);
+}
+
+static inline unsigned int get_le32(const unsigned char *b)
+{
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+}
+
+static inline unsigned int get_be16(const unsigned char *b)
+{
+    return (b[0] << 8) | b[1];
+}
+
+static inline unsigned int get_be32(const unsigned char *b)
+{
+    return (get_be16(b) << 16) | get_be16(b + 2);
+}
+
+static inline unsigned long long get_be64(const unsigned char *b)
+{
+    return ((unsigned long long)get_be32(b) << 32) | get_be32(b + 4);
+}
+
+/*
+    packet_write_header(PACKET* pkt, const LATENCY_PROBE* probe, int version)
+      pkt - packet to send, header fields and size filled in
+      probe - latency probe to attach or NULL
+      version - negotiated WIRE_VERSION
+    Serializes the wire header into pkt->head, ending right where pkt->data
+    starts, so the datagram is the contiguous pkt->data - length bytes.
+    Return: the header length
+*/
+static inline unsigned int packet_write_header(PACKET *pkt, const LATENCY_PROBE *probe, int version)
+{
+    unsigned char *h;
+    unsigned int ext, len, i;
+
+    if (version == WIRE_VERSION_RAW)
+    {
+        len = RAW_HEADER_SIZE + (probe ? RAW_PROBE_SIZE : 0);
+        h = pkt->data - len;
+
+        // the bitfield struct the way x86 compilers lay it out in memory
+        h[0] = (unsigned char)((pkt->version & 3) | (pkt->pad & 1) << 2 | (probe ? 1 << 3 : 0) | (pkt->csrccount & 15) << 4);
+        h[1] = (unsigned char)((pkt->marker & 1) | (pkt->payloadtype & 0x7f) << 1);
+        h[2] = (unsigned char)pkt->seq;
+        h[3] = (unsigned char)(pkt->seq >> 8);
+        put_le32(h + 4, pkt->timestamp);
+        put_le32(h + 8, pkt->ssrc);
+        put_le32(h + 12, pkt->csrc);
+        h[16] = (unsigned char)(pkt->type | (pkt->redundant_count & 7) << 1 | pkt->new_frame << 4 | pkt->end_frame << 5 | pkt->frame_type << 6);
+
+        if (probe)
+        {
+            put_be16(h + RAW_HEADER_SIZE, RAW_PROBE_PROFILE);
+            put_be16(h + RAW_HEADER_SIZE + 2, (RAW_PROBE_SIZE - 4) / 4);
+            put_be64(h + RAW_HEADER_SIZE + 4, probe->capture_us);
+            put_be64(h + RAW_HEADER_SIZE + 12, probe->encoded_us);
+            put_be64(h + RAW_HEADER_SIZE + 20, probe->sent_us);
+        }
+
+        return len;
+    }
+
+    // one-byte header extension elements, padded to 32 bit words, only for
+    // the probe and the layer element when it isn't all 0, what its absence
+    // reads as; the FEC fields ride in the payload type and the xor byte
+    ext = (probe ? 3 * 9 : 0) + (pkt->layer || pkt->tl0_index ? 3 : 0);
+    ext = ext ? 4 + ((ext + 3) & ~3) : 0;
+    len = RTP_HEADER_SIZE + ext + (pkt->type == DATAPACKET ? VP8_DESCRIPTOR_SIZE : 1);
+    h = pkt->data - len;
+
+    // RFC 3550 fixed header: V=2, no padding, no CSRCs
+    h[0] = 0x80 | (ext ? 0x10 : 0);
+
+    if (pkt->type == DATAPACKET)
+        h[1] = (unsigned char)(RTP_PT_VP8 | (pkt->redundant_count == 1) << 2 | pkt->frame_type);
+    else
+        h[1] = RTP_PT_XOR;
+
+    h[1] |= pkt->end_frame ? 0x80 : 0;
+    put_be16(h + 2, pkt->seq);
+    put_be32(h + 4, pkt->timestamp);
+    put_be32(h + 8, pkt->ssrc);
+
+    if (ext)
+    {
+        // RFC 8285 one-byte extension header
+        put_be16(h + 12, RTP_EXT_ONE_BYTE);
+        put_be16(h + 14, (ext - 4) / 4);
+        memset(h + 16, 0, ext - 4);
+    }
+
+    if (probe)
+    {
+        const unsigned long long v[3] = { probe->capture_us, probe->encoded_us, probe->sent_us };
+
+        for (i = 0; i < 3; i++)
+        {
+            h[16 + i * 9] = (unsigned char)((RTP_EXT_PROBE_CAPTURE + i) << 4 | 7);
+            put_be64(h + 17 + i * 9, v[i]);
+        }
+    }
+
+    if (pkt->layer || pkt->tl0_index)
+    {
+        i = 16 + (probe ? 3 * 9 : 0);
+        h[i] = RTP_EXT_LAYER << 4 | 1;
+        h[i + 1] = (unsigned char)pkt->layer;
+        h[i + 2] = pkt->tl0_index;
+    }
+
+    // RFC 7741 payload descriptor: S marks the start of the frame (PID 0)
+    if (pkt->type == DATAPACKET)
+        h[len - 1] = pkt->new_frame ? 0x10 : 0;
+    else
+        h[len - 1] = (unsigned char)(pkt->redundant_count << 2 | pkt->frame_type);
+
+    return len;
+}
+
+/*
+    packet_read(const unsigned char* wire, unsigned int len, int version,
+                PACKET* pkt, LATENCY_PROBE* probe, int* has_probe)
+      wire, len - one received datagram
+      version - negotiated WIRE_VERSION
+      pkt - receives header fields, payload and size, pkt->data must have
+            room for MAX_PACKET_SIZE bytes
+      probe, has_probe - receive the latency probe if the packet has one
+    Return: 0 on success, -1 if the datagram is not a valid packet
+*/
+static inline int packet_read(const unsigned char *wire, unsigned int len, int version,
+                              PACKET *pkt, LATENCY_PROBE *probe, int *has_probe)
+{
+    unsigned char *data = pkt->data;
+    unsigned int pos, end = len, pt;
+
+    *has_probe = 0;
+    memset(pkt, 0, sizeof(PACKET));
+    pkt->data = data;
+
+    if (version == WIRE_VERSION_RAW)
+    {
+        if (len < RAW_HEADER_SIZE)
+            return -1;
+
+        pkt->version = wire[0] & 3;
+        pkt->pad = (wire[0] >> 2) & 1;
+        pkt->csrccount = wire[0] >> 4;
+        pkt->marker = wire[1] & 1;
+        pkt->payloadtype = wire[1] >> 1;
+        pkt->seq = (unsigned short)(wire[2] | wire[3] << 8);
+        pkt->timestamp = get_le32(wire + 4);
+        pkt->ssrc = get_le32(wire + 8);
+        pkt->csrc = get_le32(wire + 12);
+        pkt->type = wire[16] & 1;
+        pkt->redundant_count = (wire[16] >> 1) & 7;
+        pkt->new_frame = (wire[16] >> 4) & 1;
+        pkt->end_frame = (wire[16] >> 5) & 1;
+        pkt->frame_type = wire[16] >> 6;
+        pos = RAW_HEADER_SIZE;
+
+        if ((wire[0] >> 3) & 1)
+        {
+            unsigned int ext;
+
+            if (len < pos + 4 || (ext = 4 + 4 * get_be16(wire + pos + 2)) > len - pos)
+                return -1;
+
+            if (get_be16(wire + pos) == RAW_PROBE_PROFILE && ext == RAW_PROBE_SIZE)
+            {
+                probe->capture_us = get_be64(wire + pos + 4);
+                probe->encoded_us = get_be64(wire + pos + 12);
+                probe->sent_us = get_be64(wire + pos + 20);
+                *has_probe = 1;
+            }
+
+            pos += ext;
+        }
+    }
+    else
+    {
+        if (len < RTP_HEADER_SIZE || (wire[0] >> 6) != 2)
+            return -1;
+
+        // padding count lives in the last byte
+        if (wire[0] & 0x20)
+        {
+            if (wire[len - 1] > len - RTP_HEADER_SIZE)
+                return -1;
+
+            end -= wire[len - 1];
+        }
+
+        pt = wire[1] & 0x7f;
+
+        if (pt == RTP_PT_XOR)
+            pkt->type = XORPACKET;
+        else if (pt >= RTP_PT_VP8 && pt < RTP_PT_VP8 + 8)
+        {
+            pkt->type = DATAPACKET;
+            pkt->redundant_count = (pt >> 2) & 1;
+            pkt->frame_type = pt & 3;
+        }
+        else
+            return -1;
+
+        pkt->end_frame = wire[1] >> 7;
+        pkt->seq = (unsigned short)get_be16(wire + 2);
+        pkt->timestamp = get_be32(wire + 4);
+        pkt->ssrc = get_be32(wire + 8);
+        pos = RTP_HEADER_SIZE + 4 * (wire[0] & 0x0f);
+
+        if (wire[0] & 0x10)
+        {
+            unsigned int ext_end, id, l;
+
+            if (end < pos + 4 || (ext_end = pos + 4 + 4 * get_be16(wire + pos + 2)) > end)
+                return -1;
+
+            if (get_be16(wire + pos) == RTP_EXT_ONE_BYTE)
+            {
+                for (pos += 4; pos < ext_end; pos += 1 + l)
+                {
+                    id = wire[pos] >> 4;
+                    l = (wire[pos] & 0x0f) + 1;
+
+                    if (id == 0)
+                    {
+                        l = 0;          // padding
+                        continue;
+                    }
+
+                    if (id == 15 || pos + 1 + l > ext_end)
+                        break;
+
+                    if (id >= RTP_EXT_PROBE_CAPTURE && id <= RTP_EXT_PROBE_SENT && l == 8)
+                    {
+                        unsigned long long v = get_be64(wire + pos + 1);
+
+                        if (id == RTP_EXT_PROBE_CAPTURE)
+                            probe->capture_us = v;
+                        else if (id == RTP_EXT_PROBE_ENCODED)
+                            probe->encoded_us = v;
+                        else
+                            probe->sent_us = v;
+
+                        *has_probe |= 1 << (id - RTP_EXT_PROBE_CAPTURE);
+                    }
+                    else if (id == RTP_EXT_LAYER && l == 2)
+                    {
+                        pkt->layer = wire[pos + 1] & 3;
+                        pkt->tl0_index = wire[pos + 2];
+                    }
+                }
+            }
+
+            pos = ext_end;
+            *has_probe = (*has_probe == 7);
+        }
+
+        // RFC 7741 payload descriptor, skipping the optional fields
+        if (pkt->type == DATAPACKET)
+        {
+            unsigned int d;
+
+            if (pos >= end)
+                return -1;
+
+            d = wire[pos++];
+
+            if (d & 0x80)
+            {
+                unsigned int x;
+
+                if (pos >= end)
+                    return -1;
+
+                x = wire[pos++];
+
+                if (x & 0x80)
+                    pos += (pos < end && (wire[pos] & 0x80)) ? 2 : 1;   // PictureID
+
+                if (x & 0x40)
+                    pos++;                                              // TL0PICIDX
+
+                if (x & 0x30)
+                    pos++;                                              // TID/KEYIDX
+            }
+
+            pkt->new_frame = (d & 0x10) && !(d & 0x07);
+        }
+        else
+        {
+            if (pos >= end)
+                return -1;
 
-unsigned int get_time(void);
+            pkt->redundant_count = (wire[pos] >> 2) & 15;
+            pkt->frame_type = wire[pos++] & 3;
+        }
+    }
+
+    if (pos > end || end - pos > MAX_PACKET_SIZE)
+        return -1;
+
+    pkt->size = end - pos;
+    memcpy(pkt->data, wire + pos, pkt->size);
+    return 0;
+}
+
+/*
+    packets_alloc(PACKET* p, unsigned int count, unsigned int size)
+      p, count - the packet store to set up
+      size - payload bytes per packet, a multiple of 8 for the FEC
+    Points every packet at a zeroed payload of size bytes with WIRE_HEADROOM
+    in front of it, all carved out of one allocation.
+    Return: the allocation to free when done, NULL if out of memory
+*/
+static inline unsigned char *packets_alloc(PACKET *p, unsigned int count, unsigned int size)
+{
+    unsigned char *store = (unsigned char *)calloc(count, WIRE_HEADROOM + size);
+    unsigned int i;
+
+    for (i = 0; store && i < count; i++)
+        p[i].data = store + (size_t)i * (WIRE_HEADROOM + size) + WIRE_HEADROOM;
+
+    return store;
+}
+
+// copies the header and size bytes of payload, to->data stays where it is
+static inline void packet_copy(PACKET *to, const PACKET *from, unsigned int size)
+{
+    unsigned char *data = to->data;
+
+    *to = *from;
+    to->data = data;
+    memcpy(data, from->data, size);
+}
+
+// the payload that fits into one datagram on a path with this MTU, rounded
+// down to whole 64 bit words for the FEC
+static inline unsigned int packet_size_for_mtu(int mtu, int ipv6)
+{
+    int size = mtu - (ipv6 ? 40 : 20) - 8 - WIRE_HEADER_MAX;
+
+    if (size < MIN_PACKET_SIZE)
+        size = MIN_PACKET_SIZE;
+
+    if (size > MAX_PACKET_SIZE)
+        size = MAX_PACKET_SIZE;
+
+    return size & ~7;
+}
+
+// Receiver report: what arrived since the last one, sent on the feedback
+// channel every REPORT_INTERVAL_MS from WIRE_VERSION_REPORTS on. On the wire it is
+// REPORT_COMMAND, then every count 16 bit little endian like the sequence
+// number of resend requests.
+#define REPORT_COMMAND 'l'
+#define REPORT_INTERVAL_MS 500
+#define REPORT_BURSTS 4             // loss runs of 1, 2, 3-4 and 5+ packets
+#define REPORT_SIZE (1 + 2 * (3 + REPORT_BURSTS))
+
+typedef struct
+{
+    unsigned short received;        // packets that arrived, duplicates not counted
+    unsigned short lost;            // holes in the sequence, reordering taken back
+    unsigned short rebuilt;         // holes filled from FEC
+    unsigned short bursts[REPORT_BURSTS];
+} RECEIVER_REPORT;
+
+// the bursts[] bucket of a run of n lost packets
+static inline unsigned int report_burst(unsigned int n)
+{
+    return n <= 2 ? n - 1 : n <= 4 ? 2 : 3;
+}
+
+static inline unsigned int report_write(const RECEIVER_REPORT *r, unsigned char *b)
+{
+    unsigned int i;
+
+    b[0] = REPORT_COMMAND;
+    b[1] = (unsigned char)r->received;
+    b[2] = (unsigned char)(r->received >> 8);
+    b[3] = (unsigned char)r->lost;
+    b[4] = (unsigned char)(r->lost >> 8);
+    b[5] = (unsigned char)r->rebuilt;
+    b[6] = (unsigned char)(r->rebuilt >> 8);
+
+    for (i = 0; i < REPORT_BURSTS; i++)
+    {
+        b[7 + 2 * i] = (unsigned char)r->bursts[i];
+        b[8 + 2 * i] = (unsigned char)(r->bursts[i] >> 8);
+    }
+
+    return REPORT_SIZE;
+}
+
+// returns -1 if b isn't a complete report
+static inline int report_read(const unsigned char *b, unsigned int len, RECEIVER_REPORT *r)
+{
+    unsigned int i;
+
+    if (len < REPORT_SIZE || b[0] != REPORT_COMMAND)
+        return -1;
+
+    r->received = b[1] | b[2] << 8;
+    r->lost = b[3] | b[4] << 8;
+    r->rebuilt = b[5] | b[6] << 8;
+
+    for (i = 0; i < REPORT_BURSTS; i++)
+        r->bursts[i] = b[7 + 2 * i] | b[8 + 2 * i] << 8;
+
+    return 0;
+}
+
+// Arrival feedback: when packets arrived on the receiver's clock, for the
+// sender's delay based congestion control. Sent every ARRIVAL_INTERVAL_MS,
+// or sooner once ARRIVAL_MAX packets are waiting, from WIRE_VERSION_ARRIVALS
+// on. On the wire it is ARRIVAL_COMMAND, a count, then per packet its 16 bit
+// sequence number and the low 32 bits of the arrival time in us, little
+// endian.
+#define ARRIVAL_COMMAND 'a'
+#define ARRIVAL_INTERVAL_MS 50
+#define ARRIVAL_MAX 64
+#define ARRIVAL_SIZE(n) (2 + 6 * (n))
+
+typedef struct
+{
+    unsigned short seq;
+    unsigned int arrival_us;
+} ARRIVAL;
+
+static inline unsigned int arrivals_write(const ARRIVAL *a, unsigned int n, unsigned char *b)
+{
+    unsigned int i;
+
+    b[0] = ARRIVAL_COMMAND;
+    b[1] = (unsigned char)n;
+
+    for (i = 0; i < n; i++)
+    {
+        b[2 + 6 * i] = (unsigned char)a[i].seq;
+        b[3 + 6 * i] = (unsigned char)(a[i].seq >> 8);
+        put_le32(b + 4 + 6 * i, a[i].arrival_us);
+    }
+
+    return ARRIVAL_SIZE(n);
+}
+
+// returns the number of arrivals, -1 if b isn't complete feedback
+static inline int arrivals_read(const unsigned char *b, unsigned int len, ARRIVAL *a)
+{
+    unsigned int i, n;
+
+    if (len < 2 || b[0] != ARRIVAL_COMMAND)
+        return -1;
+
+    n = b[1];
+    if (n > ARRIVAL_MAX || len < ARRIVAL_SIZE(n))
+        return -1;
+
+    for (i = 0; i < n; i++)
+    {
+        a[i].seq = b[2 + 6 * i] | b[3 + 6 * i] << 8;
+        a[i].arrival_us = get_le32(b + 4 + 6 * i);
+    }
+
+    return n;
+}
+
+// Frame acknowledgement: the receiver decoded the frame with this RTP
+// timestamp intact, from intact references, so it holds the reference
+// buffers that frame updated and the sender may recover from them. Sent for
+// every such frame from WIRE_VERSION_ACKS on: ACK_COMMAND, then the
+// timestamp 32 bit little endian.
+#define ACK_COMMAND 'k'
+#define ACK_SIZE 5
+
+static inline unsigned int ack_write(unsigned int timestamp, unsigned char *b)
+{
+    b[0] = ACK_COMMAND;
+    put_le32(b + 1, timestamp);
+
+    return ACK_SIZE;
+}
+
+// returns -1 if b isn't an acknowledgement
+static inline int ack_read(const unsigned char *b, unsigned int len, unsigned int *timestamp)
+{
+    if (len < ACK_SIZE || b[0] != ACK_COMMAND)
+        return -1;
+
+    *timestamp = get_le32(b + 1);
+
+    return 0;
+}
+
+// Key frame request: a receiver that holds none of the references the
+// sender knows acknowledged, one that joined through a relay mid-session,
+// asks for a key frame outright. Three bytes like a resend request, the
+// newest sequence number it saw after the command; older senders take it for
+// a resend of that packet.
+#define KEY_REQUEST_COMMAND 'i'
+
+// Session control: how a session is set up, and changed later, in fixed
+// size binary messages. The sender offers what it can do to the receiver's
+// video port, the receiver requests what it wants within that on the
+// sender's feedback port, and the sender confirms what the session uses on
+// the video port. Each side repeats its message, SESSION_RETRY_MIN_MS at
+// first and twice as long each time, until the answer comes. A request with
+// the next generation reconfigures a running session; its confirmation
+// carries the same generation. A confirmation also tells receivers that
+// join a multicast group late what the session is.
+//
+// On the wire: SESSION_MAGIC, the message type and SESSION_VERSION, then
+// the fields in the order of the struct, little endian.
+#define SESSION_MAGIC0 'V'
+#define SESSION_MAGIC1 'S'
+#define SESSION_VERSION 1
+#define SESSION_SIZE 28
+#define SESSION_RETRY_MIN_MS 10
+#define SESSION_RETRY_MAX_MS 1000
+
+enum
+{
+    SESSION_OFFER = 'O',
+    SESSION_REQUEST = 'R',
+    SESSION_CONFIRM = 'C'
+};
+
+// codecs
+#define SESSION_CODEC_VP8 0x01
+
+// forward error correction, what a receiver rebuilds from and what the
+// sender produces
+#define SESSION_FEC_XOR 0x01        // one parity packet per group
+#define SESSION_FEC_DUPLICATE 0x02  // packets sent twice or more, n/d >= 2
+#define SESSION_FEC_ADAPTIVE 0x04   // group sized per frame from the reports
+
+typedef struct
+{
+    unsigned char type;
+    unsigned char generation;       // counts reconfigurations
+    unsigned char wire_version;     // offered, requested: the newest it speaks
+    unsigned char codecs;
+    unsigned char fec;
+    unsigned char fec_numerator;    // what the receiver asks for, n/d
+    unsigned char fec_denominator;
+    unsigned char layers;           // temporal layers
+    unsigned char threads;          // sender: encoding, receiver: decoding
+    unsigned short width;
+    unsigned short height;
+    unsigned short frame_rate;
+    unsigned short packet_size;     // offered, requested: the largest it takes
+    unsigned short data_port;       // where the receiver takes video
+    unsigned int kbps;
+} SESSION;
+
+static inline unsigned int session_write(const SESSION *s, unsigned char *b)
+{
+    b[0] = SESSION_MAGIC0;
+    b[1] = SESSION_MAGIC1;
+    b[2] = s->type;
+    b[3] = SESSION_VERSION;
+    b[4] = s->generation;
+    b[5] = s->wire_version;
+    b[6] = s->codecs;
+    b[7] = s->fec;
+    b[8] = s->fec_numerator;
+    b[9] = s->fec_denominator;
+    b[10] = s->layers;
+    b[11] = s->threads;
+    put_le16(b + 12, s->width);
+    put_le16(b + 14, s->height);
+    put_le16(b + 16, s->frame_rate);
+    put_le16(b + 18, s->packet_size);
+    put_le16(b + 20, s->data_port);
+    put_le16(b + 22, 0);
+    put_le32(b + 24, s->kbps);
+
+    return SESSION_SIZE;
+}
+
+// returns -1 if b isn't a session message this build understands; the
+// values are the peer's, check them before use
+static inline int session_read(const unsigned char *b, unsigned int len, SESSION *s)
+{
+    if (len != SESSION_SIZE || b[0] != SESSION_MAGIC0 || b[1] != SESSION_MAGIC1 || b[3] != SESSION_VERSION)
+        return -1;
+
+    if (b[2] != SESSION_OFFER && b[2] != SESSION_REQUEST && b[2] != SESSION_CONFIRM)
+        return -1;
+
+    s->type = b[2];
+    s->generation = b[4];
+    s->wire_version = b[5];
+    s->codecs = b[6];
+    s->fec = b[7];
+    s->fec_numerator = b[8];
+    s->fec_denominator = b[9];
+    s->layers = b[10];
+    s->threads = b[11];
+    s->width = get_le16(b + 12);
+    s->height = get_le16(b + 14);
+    s->frame_rate = get_le16(b + 16);
+    s->packet_size = get_le16(b + 18);
+    s->data_port = get_le16(b + 20);
+    s->kbps = get_le32(b + 24);
+
+    return 0;
+}
+
+// the time to send again at after sending now, backing off
+static inline unsigned int session_retry(unsigned int now, unsigned int *retry_ms)
+{
+    unsigned int at = now + *retry_ms;
+
+    *retry_ms = *retry_ms * 2 < SESSION_RETRY_MAX_MS ? *retry_ms * 2 : SESSION_RETRY_MAX_MS;
+    return at;
+}
+
+unsigned int get_time(void);                // ms, wraps after 49 days
+unsigned long long get_time_us(void);
+unsigned long long get_time_ns(void);       // monotonic, not NTP slewed
 void Sleep(long t);
 
-void vpxlog_dbg_no_head(int level, const tc8 *format, ...);
-void vpxlog_dbg(int level, const tc8 *format, ...);
+void vpxlog_write(int level, int head, const tc8 *format, ...);
+void vpxlog_flush(void);
+
+// log records are queued and written by a background thread (vpxlog.c);
+// levels not in LOG_MASK compile away entirely
+#define vpxlog_dbg(level, ...) \
+    do { if ((level) & LOG_MASK) vpxlog_write((level), 1, __VA_ARGS__); } while (0)
+#define vpxlog_dbg_no_head(level, ...) \
+    do { if ((level) & LOG_MASK) vpxlog_write((level), 0, __VA_ARGS__); } while (0)
+
+#endif // RTP_H
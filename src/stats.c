@@ -0,0 +1,352 @@
+#include "stats.h"
+#include "tctypes.h"
+#include "rtp.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* where there is no MSG_NOSIGNAL, SO_NOSIGPIPE on the socket does its job */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* HDR style buckets: values below 2^SUB_BITS are exact, above that every
+ * power of two is split into 2^SUB_BITS linear sub-buckets. */
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKETS (64 * SUB_COUNT)
+
+typedef struct
+{
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long long bucket[BUCKETS];
+} HISTOGRAM;
+
+static const char *counter_names[STAT_COUNTERS] = {
+	"frames_captured",
+	"frames_encoded",
+	"frames_skipped",
+	"packets_sent",
+	"bytes_sent",
+	"fec_packets",
+	"packets_resent",
+	"nacks_received",
+	"give_ups_received",
+	"recovery_key",
+	"recovery_gold",
+	"recovery_altref",
+	"send_queue",
+	"resends_stale",
+	"resends_limited",
+	"resend_queue",
+	"fec_group",
+	"target_kbps",
+	"acked_kbps",
+	"frame_acks_received",
+	"simulcast_frames",
+	"receivers",
+	"members",
+	"nacks_suppressed",
+	"packets_thinned",
+	"encode_width",
+	"encode_load",
+	"cpu_used",
+	"noise_sensitivity",
+	"static_threshold",
+	"packets_received",
+	"bytes_received",
+	"packets_rebuilt",
+	"nacks_sent",
+	"give_ups_sent",
+	"given_up",
+	"frames_decoded",
+	"decode_errors",
+	"frames_shown",
+	"receive_ring",
+	"skip_store",
+	"frame_acks_sent",
+	"layer_drops",
+};
+
+static const char *histogram_names[HIST_COUNT] = {
+	"capture",
+	"convert",
+	"encode",
+	"scale",
+	"packetize",
+	"fec",
+	"send",
+	"receive",
+	"read_packet",
+	"rebuild",
+	"get_frame",
+	"decode",
+	"show_frame",
+	"probe_encode",
+	"probe_queue",
+	"probe_network",
+	"probe_reassembly",
+	"probe_decode",
+	"probe_display",
+	"glass_to_glass",
+};
+
+static long long counters[STAT_COUNTERS];
+static HISTOGRAM histograms[HIST_COUNT];
+
+static int serve_fd = -1;
+static int serving = 0;
+static char serve_path[108];
+static pthread_t serve_thread;
+
+static unsigned int bucket_index(unsigned long long v)
+{
+	unsigned int e;
+
+	if( v < SUB_COUNT ) {
+		return (unsigned int)v;
+	}
+
+	e = 63 - __builtin_clzll(v);
+	return (e - SUB_BITS + 1) * SUB_COUNT + (unsigned int)((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static unsigned long long bucket_value(unsigned int i)
+{
+	unsigned int e;
+
+	if( i < SUB_COUNT ) {
+		return i;
+	}
+
+	e = i / SUB_COUNT + SUB_BITS - 1;
+	return (unsigned long long)(SUB_COUNT + i % SUB_COUNT) << (e - SUB_BITS);
+}
+
+void stats_add(
+	enum stats_counter counter,
+	long long n )
+{
+	__atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void stats_set(
+	enum stats_counter counter,
+	long long value )
+{
+	__atomic_store_n(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void stats_record(
+	enum stats_histogram hist,
+	unsigned long long ns )
+{
+	HISTOGRAM *h = &histograms[hist];
+	unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&h->bucket[bucket_index(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+
+	while( ns > max
+	    && !__atomic_compare_exchange_n(&h->max, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) ) {
+	}
+}
+
+void stats_since(
+	enum stats_histogram hist,
+	unsigned long long start_ns )
+{
+	stats_record(hist, get_time_ns() - start_ns);
+}
+
+/* value at quantile q of a snapshot, reported at the bucket's midpoint */
+static double percentile(
+	const unsigned long long *bucket,
+	unsigned long long count,
+	double q )
+{
+	unsigned long long rank = (unsigned long long)(q * count + 0.5);
+	unsigned long long seen = 0;
+	unsigned int i;
+
+	if( rank < 1 ) {
+		rank = 1;
+	}
+
+	for( i = 0; i < BUCKETS; i++ ) {
+		seen += bucket[i];
+
+		if( seen >= rank ) {
+			return (bucket_value(i) + bucket_value(i + 1)) / 2.0;
+		}
+	}
+
+	return 0;
+}
+
+void stats_dump(
+	FILE *out,
+	int buckets )
+{
+	static unsigned long long snapshot[BUCKETS];
+	static pthread_mutex_t dump_mtx = PTHREAD_MUTEX_INITIALIZER;
+	unsigned int c, i;
+
+	pthread_mutex_lock(&dump_mtx);
+
+	for( c = 0; c < STAT_COUNTERS; c++ ) {
+		fprintf(out, "counter %s %lld\n",
+			counter_names[c],
+			__atomic_load_n(&counters[c], __ATOMIC_RELAXED));
+	}
+
+	for( c = 0; c < HIST_COUNT; c++ ) {
+		HISTOGRAM *h = &histograms[c];
+		unsigned long long count = 0;
+
+		// the buckets are the truth, count and sum may be a record ahead
+		for( i = 0; i < BUCKETS; i++ ) {
+			snapshot[i] = __atomic_load_n(&h->bucket[i], __ATOMIC_RELAXED);
+			count += snapshot[i];
+		}
+
+		fprintf(out, "histogram %s count=%llu mean_us=%.3f p50_us=%.3f p90_us=%.3f p99_us=%.3f p999_us=%.3f max_us=%.3f\n",
+			histogram_names[c],
+			count,
+			count ? __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1000.0 / count : 0,
+			percentile(snapshot, count, 0.5) / 1000,
+			percentile(snapshot, count, 0.9) / 1000,
+			percentile(snapshot, count, 0.99) / 1000,
+			percentile(snapshot, count, 0.999) / 1000,
+			__atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1000.0);
+
+		for( i = 0; buckets && i < BUCKETS; i++ ) {
+			if( snapshot[i] ) {
+				fprintf(out, "bucket %s %llu %llu\n",
+					histogram_names[c],
+					bucket_value(i),
+					snapshot[i]);
+			}
+		}
+	}
+
+	fflush(out);
+	pthread_mutex_unlock(&dump_mtx);
+}
+
+static void *serve_func(void *ptr)
+{
+	(void)ptr;
+
+	while( __atomic_load_n(&serving, __ATOMIC_ACQUIRE) ) {
+		struct pollfd pfd = { serve_fd, POLLIN, 0 };
+		FILE *out;
+		char *dump = NULL;
+		size_t size = 0, sent;
+		ssize_t n;
+		int fd;
+
+		if( poll(&pfd, 1, 200) <= 0 ) {
+			continue;
+		}
+
+		if( (fd = accept(serve_fd, NULL, NULL)) < 0 ) {
+			continue;
+		}
+
+		if( !(out = open_memstream(&dump, &size)) ) {
+			close(fd);
+			continue;
+		}
+
+		stats_dump(out, 1);
+		fclose(out);
+
+		// a client that hangs up before it has read everything must not
+		// take the process down with a SIGPIPE
+#ifdef SO_NOSIGPIPE
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+		for( sent = 0; sent < size; sent += n ) {
+			if( (n = send(fd, dump + sent, size - sent, MSG_NOSIGNAL)) <= 0 ) {
+				break;
+			}
+		}
+
+		free(dump);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int stats_serve(
+	const char *path )
+{
+	struct sockaddr_un sa;
+	struct stat st;
+
+	if( serving
+	 || strlen(path) >= sizeof(sa.sun_path) ) {
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	if( (serve_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+		return -1;
+	}
+
+	// a stale socket from an earlier run would make bind fail, anything
+	// else by that name stays and bind fails on it
+	if( !lstat(path, &st)
+	 && S_ISSOCK(st.st_mode) ) {
+		unlink(path);
+	}
+
+	if( bind(serve_fd, (struct sockaddr *)&sa, sizeof(sa))
+	 || listen(serve_fd, 4) ) {
+		close(serve_fd);
+		serve_fd = -1;
+		return -1;
+	}
+
+	strcpy(serve_path, path);
+	serving = 1;
+
+	if( pthread_create(&serve_thread, NULL, serve_func, NULL) ) {
+		serving = 0;
+		close(serve_fd);
+		unlink(serve_path);
+		serve_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void stats_stop(void)
+{
+	if( !serving ) {
+		return;
+	}
+
+	__atomic_store_n(&serving, 0, __ATOMIC_RELEASE);
+	pthread_join(serve_thread, NULL);
+	close(serve_fd);
+	unlink(serve_path);
+	serve_fd = -1;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/* Pipeline instrumentation shared by sender and receiver. Every update is a
+ * single relaxed atomic, so the calls can stay on the hot paths. */
+
+enum stats_counter
+{
+	/* sender */
+	STAT_FRAMES_CAPTURED,
+	STAT_FRAMES_ENCODED,
+	STAT_FRAMES_SKIPPED,        /* no room in the packet store */
+	STAT_PACKETS_SENT,
+	STAT_BYTES_SENT,
+	STAT_FEC_PACKETS,
+	STAT_PACKETS_RESENT,
+	STAT_NACKS_RECEIVED,
+	STAT_GIVE_UPS_RECEIVED,
+	STAT_RECOVERY_KEY,          /* recovery frames by type */
+	STAT_RECOVERY_GOLD,
+	STAT_RECOVERY_ALTREF,
+	STAT_SEND_QUEUE,            /* gauge: packets waiting to be sent */
+	STAT_RESENDS_STALE,         /* overwritten, too old or before a key frame */
+	STAT_RESENDS_LIMITED,       /* resent too often already or queue full */
+	STAT_RESEND_QUEUE,          /* gauge: resends waiting for budget */
+	STAT_FEC_GROUP,             /* gauge: packets per parity, 1 sends them twice */
+	STAT_TARGET_BITRATE,        /* gauge: kbps the congestion controller allows */
+	STAT_ACKED_BITRATE,         /* gauge: kbps the receiver is getting */
+	STAT_FRAME_ACKS_RECEIVED,
+	STAT_SIMULCAST_FRAMES,      /* frames encoded at the smaller resolutions */
+	STAT_RECEIVERS,             /* gauge: receivers served beyond the first */
+	STAT_MEMBERS,               /* gauge: multicast receivers heard from lately */
+	STAT_NACKS_SUPPRESSED,      /* answered by a resend already on its way */
+	STAT_PACKETS_THINNED,       /* relay: above the layers a receiver gets */
+	STAT_ENCODE_WIDTH,          /* gauge: width encoded at, less under congestion */
+	STAT_ENCODE_LOAD,           /* gauge: percent of the frame interval spent encoding */
+	STAT_CPU_USED,              /* gauge: encoder speed the load tuned it to */
+	STAT_NOISE_SENSITIVITY,     /* gauge: noise reduction the load left on */
+	STAT_STATIC_THRESHOLD,      /* gauge: static threshold the load tuned it to */
+
+	/* receiver */
+	STAT_PACKETS_RECEIVED,
+	STAT_BYTES_RECEIVED,
+	STAT_PACKETS_REBUILT,
+	STAT_NACKS_SENT,
+	STAT_GIVE_UPS_SENT,
+	STAT_GIVEN_UP,
+	STAT_FRAMES_DECODED,
+	STAT_DECODE_ERRORS,
+	STAT_FRAMES_SHOWN,
+	STAT_RECEIVE_RING,          /* gauge: packets between oldest and newest */
+	STAT_SKIP_STORE,            /* gauge: lost packets still being chased */
+	STAT_FRAME_ACKS_SENT,
+	STAT_LAYER_DROPS,           /* enhancement layer frames dropped, not chased */
+
+	STAT_COUNTERS
+};
+
+enum stats_histogram
+{
+	HIST_CAPTURE,               /* camera callback, entry to encoder queued */
+	HIST_CONVERT,
+	HIST_ENCODE,
+	HIST_SCALE,                 /* downscale, per simulcast layer and encode size */
+	HIST_PACKETIZE,             /* includes FEC */
+	HIST_FEC,
+	HIST_SEND,
+	HIST_RECEIVE,               /* recvfrom calls that returned a packet, incl. the wait */
+	HIST_READ_PACKET,
+	HIST_REBUILD,
+	HIST_GET_FRAME,
+	HIST_DECODE,
+	HIST_SHOW_FRAME,
+
+	/* per frame latency probe breakdown, needs a shared clock */
+	HIST_PROBE_ENCODE,          /* capture to encode done */
+	HIST_PROBE_QUEUE,           /* encode done to first packet sent */
+	HIST_PROBE_NETWORK,         /* first packet sent to received */
+	HIST_PROBE_REASSEMBLY,      /* first packet received to frame complete */
+	HIST_PROBE_DECODE,          /* frame complete to decoded */
+	HIST_PROBE_DISPLAY,         /* decoded to shown */
+	HIST_GLASS_TO_GLASS,        /* capture to shown */
+
+	HIST_COUNT
+};
+
+void stats_add(
+	enum stats_counter counter,
+	long long n );
+
+void stats_set(
+	enum stats_counter counter,
+	long long value );
+
+/* latencies are in ns, log-linear buckets with ~6% resolution */
+void stats_record(
+	enum stats_histogram hist,
+	unsigned long long ns );
+
+/* stats_record(hist, get_time_ns() - start_ns) */
+void stats_since(
+	enum stats_histogram hist,
+	unsigned long long start_ns );
+
+void stats_dump(
+	FILE *out,
+	int buckets );
+
+/* Serves stats_dump on a Unix-domain stream socket: every connection gets
+ * one text snapshot and is closed, e.g. `socat - UNIX-CONNECT:path`.
+ * Returns 0 on success, -1 if the socket could not be set up. */
+int stats_serve(
+	const char *path );
+
+void stats_stop(void);
+
+#endif/*STATS_H*/
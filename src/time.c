@@ -12,34 +12,30 @@
 #ifdef WINDOWS
 #include <windows.h>
 #include <mmsystem.h>
-unsigned int get_time(void)
+unsigned long long get_time_ns(void)
 {
-    LARGE_INTEGER pf;
-    long long now;
-    QueryPerformanceCounter((LARGE_INTEGER *) &now);
+    LARGE_INTEGER pf, now;
+    QueryPerformanceCounter(&now);
     QueryPerformanceFrequency(&pf);
-    return (unsigned int)(now * 1000 /  pf.LowPart);
+    return (unsigned long long)(now.QuadPart / pf.QuadPart) * 1000000000
+           + (unsigned long long)(now.QuadPart % pf.QuadPart) * 1000000000 / pf.QuadPart;
 }
 #else
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
 
-unsigned int get_time(void)
+unsigned long long get_time_ns(void)
 {
     struct timespec  ts;
-    unsigned long long tv;
 
-#if 1 || _POSIX_TIMERS > 0
-    clock_gettime(CLOCK_MONOTONIC, &ts);
+#if defined(CLOCK_MONOTONIC_RAW)
+    // not slewed by NTP, so short intervals measure what actually happened
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
 #else
-struct timeval tv2;
-gettimeofday(&tv2, NULL);
-ts.tv_sec = tv2.tv_sec;
-ts.tv_nsec = tv2.tv_usec * 1000;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 #endif
-    tv = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-    return tv & 0xffffffff;
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 int _kbhit(void)
@@ -67,40 +63,12 @@ void Sleep(long t) {
 
 #endif
 
-#include "tctypes.h"
-#include "rtp.h"
-#include <stdarg.h>
-#include <stdio.h>
-
-unsigned int start_time = 0;
-
-void vpxlog_dbg_no_head(int level, const tc8 *format, ...)
+unsigned long long get_time_us(void)
 {
-    va_list list;
-
-    if (!(level & LOG_MASK))
-        return;
-
-    va_start(list, format);
-
-    vprintf(format, list);
-    va_end(list);
+    return get_time_ns() / 1000;
 }
 
-void vpxlog_dbg(int level, const tc8 *format, ...)
+unsigned int get_time(void)
 {
-    va_list list;
-
-    if (!(level & LOG_MASK))
-        return;
-
-    if (start_time == 0)
-        start_time = get_time();
-
-    printf("%8d ", get_time() - start_time);
-    va_start(list, format);
-
-    vprintf(format, list);
-    va_end(list);
+    return (unsigned int)(get_time_ns() / 1000000);
 }
-
@@ -11,6 +11,7 @@
 #include "tctypes.h"
 #include "rtp.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>  //for tolower
 #include <string.h>
 
@@ -21,6 +22,17 @@
 
 #include "vpx_network.h"
 
+#if defined(LINUX) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#  if defined(__NR_io_uring_setup) && defined(IORING_RECV_MULTISHOT)
+#   define vpx_NET_URING 1
+#  endif
+# endif
+#endif
+
 #if ENABLE_LOGGING
 # ifndef vpx_NO_GLOBALS
 static int module_loglevel = 0;
@@ -71,6 +83,43 @@ static TCRV socket_option(struct vpxsocket *vpx_sock, tc8 set, tc32 level,
 
 static tc32 set_nonblocking_io(struct vpxsocket *vpx_sock, tc32 on);
 
+static TCRV recvfrom_raw(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                         tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from);
+
+static TCRV impaired_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                              tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from);
+
+#if defined(LINUX)
+/* a coalesced GRO read, handed out one segment per recvfrom */
+struct vpx_net_gro_state
+{
+    tc8 buf[65536];
+    tc32 len;
+    tc32 pos;
+    tc32 segment;
+    union vpx_sockaddr_x from;
+};
+
+static tc32 wait_fd(tc32 fd, tc32 timeout_ms, tc32 write);
+
+static TCRV gro_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                         tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from);
+#endif
+
+#if defined(vpx_NET_URING)
+static void uring_teardown(struct vpxsocket *vpx_sock);
+
+static TCRV uring_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                           tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from);
+
+static TCRV uring_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                         tc32 *bytes_sent, union vpx_sockaddr_x vpx_sa_to);
+
+static tc32 uring_submit(struct vpxsocket *vpx_sock);
+
+static tc32 uring_receives(struct vpxsocket *vpx_sock);
+#endif
+
 /*
  *
  * Exposed library functions
@@ -255,6 +304,10 @@ TCRV vpx_net_close(struct vpxsocket *vpx_sock)
 
     if (vpx_sock && (vpx_sock->state & kInited))
     {
+#if defined(vpx_NET_URING)
+        // the ring lets go of the socket and its buffers first
+        uring_teardown(vpx_sock);
+#endif
 #if defined(WIN32) || defined(_WIN32_WCE)
         rv = closesocket(vpx_sock->sock) ? TC_ERROR : TC_OK;
 #else
@@ -266,6 +319,9 @@ TCRV vpx_net_close(struct vpxsocket *vpx_sock)
                    vpx_sock->sock, ret, errno);
 #endif
 
+        vpx_net_set_impairment(vpx_sock, NULL);
+        free(vpx_sock->gro);
+        vpx_sock->gro = NULL;
         vpx_sock->state = 0;
     }
 
@@ -733,8 +789,8 @@ TCRV vpx_net_read(struct vpxsocket *vpx_sock, tc8 *buffer,
 
             if (vpx_sock->read_timeout_ms != vpx_NET_NO_TIMEOUT)
             {
-                tv.tv_sec  = 0;
-                tv.tv_usec = vpx_sock->read_timeout_ms * 1000;
+                tv.tv_sec  = vpx_sock->read_timeout_ms / 1000;
+                tv.tv_usec = (vpx_sock->read_timeout_ms % 1000) * 1000;
 
 #if !defined(__SYMBIAN32__)
                 ret = select(vpx_sock->sock + 1, &read_fds, NULL, NULL, &tv);
@@ -916,9 +972,31 @@ TCRV vpx_net_read(struct vpxsocket *vpx_sock, tc8 *buffer,
 */
 TCRV vpx_net_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
                       tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from)
+{
+    if (vpx_sock && vpx_sock->impairment)
+        return impaired_recvfrom(vpx_sock, buffer, buf_len, bytes_read, vpx_sa_from);
+
+    return recvfrom_raw(vpx_sock, buffer, buf_len, bytes_read, vpx_sa_from);
+}
+
+static TCRV recvfrom_raw(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                         tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from)
 {
     TCRV rv = TC_INVALID_PARAMS;
 
+#if defined(vpx_NET_URING)
+
+    if (vpx_sock && uring_receives(vpx_sock))
+        return uring_recvfrom(vpx_sock, buffer, buf_len, bytes_read, vpx_sa_from);
+
+#endif
+#if defined(LINUX)
+
+    if (vpx_sock && vpx_sock->gro)
+        return gro_recvfrom(vpx_sock, buffer, buf_len, bytes_read, vpx_sa_from);
+
+#endif
+
     if (vpx_sock && (vpx_sock->state & kInited) && buffer && (buf_len > 0))
     {
 
@@ -936,8 +1014,8 @@ TCRV vpx_net_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
 
             if (vpx_sock->read_timeout_ms != vpx_NET_NO_TIMEOUT)
             {
-                tv.tv_sec  = 0;
-                tv.tv_usec = vpx_sock->read_timeout_ms * 1000;
+                tv.tv_sec  = vpx_sock->read_timeout_ms / 1000;
+                tv.tv_usec = (vpx_sock->read_timeout_ms % 1000) * 1000;
 
 #if !defined(__SYMBIAN32__)
                 ret = select(vpx_sock->sock + 1, &read_fds, NULL, NULL, &tv);
@@ -1182,6 +1260,8 @@ TCRV vpx_net_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
                    operation could not be completed in the specified time
       TC_WOULDBLOCK: if the send timeout has been set to 0 and the operation
                      could not be completed immediately
+      TC_MSG_TOO_LARGE: if the datagram is larger than the path MTU and may
+                        not be fragmented, see vpx_net_pmtu_discover
       TC_ERROR: if an error other than timed out or would block is encountered
                 trying to complete the operation, more information can be
                 obtained through calling vpx_net_get_error
@@ -1266,11 +1346,13 @@ TCRV vpx_net_send(struct vpxsocket *vpx_sock, tc8 *buffer,
 #endif
                         rv = TC_WOULDBLOCK;
                         break;
-                    case EFAULT:
-                    case EINTR:
 #ifdef EMSGSIZE
                     case EMSGSIZE:
+                        rv = TC_MSG_TOO_LARGE;
+                        break;
 #endif
+                    case EFAULT:
+                    case EINTR:
 #ifdef ENOBUFS
                     case ENOBUFS:
 #endif
@@ -1361,6 +1443,8 @@ TCRV vpx_net_send(struct vpxsocket *vpx_sock, tc8 *buffer,
                    operation could not be completed in the specified time
       TC_WOULDBLOCK: if the send timeout has been set to 0 and the operation
                      could not be completed immediately
+      TC_MSG_TOO_LARGE: if the datagram is larger than the path MTU and may
+                        not be fragmented, see vpx_net_pmtu_discover
       TC_ERROR: if an error other than timed out or would block is encountered
                 trying to complete the operation, more information can be
                 obtained through calling vpx_net_get_error
@@ -1370,6 +1454,19 @@ TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
 {
     TCRV rv = TC_INVALID_PARAMS;
 
+#if defined(vpx_NET_URING)
+
+    if (vpx_sock && vpx_sock->uring && (vpx_sock->state & kInited))
+    {
+        if (buf_len <= vpx_NET_URING_SLOT_SIZE)
+            return uring_sendto(vpx_sock, buffer, buf_len, bytes_sent, vpx_sa_to);
+
+        // too big for a send buffer, after what is queued it goes out directly
+        uring_submit(vpx_sock);
+    }
+
+#endif
+
     if (vpx_sock && (vpx_sock->state & kInited) && buffer && (buf_len > 0))
     {
 
@@ -1432,6 +1529,17 @@ TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
 
                 rv = (n == SOCKET_ERROR) ? TC_ERROR : TC_OK;
 
+#if defined(LINUX) || defined(VXWORKS) || defined(__uClinux__)
+
+                if (n == SOCKET_ERROR && errno == EMSGSIZE)
+                    rv = TC_MSG_TOO_LARGE;
+
+#elif defined(WIN32) || defined(_WIN32_WCE)
+
+                if (n == SOCKET_ERROR && WSAGetLastError() == WSAEMSGSIZE)
+                    rv = TC_MSG_TOO_LARGE;
+
+#endif
             }
             else if (ret < 0)
             {
@@ -1481,11 +1589,13 @@ TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
 #endif
                         rv = TC_WOULDBLOCK;
                         break;
-                    case EFAULT:
-                    case EINTR:
 #ifdef EMSGSIZE
                     case EMSGSIZE:
+                        rv = TC_MSG_TOO_LARGE;
+                        break;
 #endif
+                    case EFAULT:
+                    case EINTR:
 #ifdef ENOBUFS
                     case ENOBUFS:
 #endif
@@ -1554,6 +1664,243 @@ TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
     return rv;
 }
 
+#if defined(LINUX)
+/* 1 when fd is ready (or the timeout is 0 and the caller will not
+   block), 0 on timeout, -1 on error */
+static tc32 wait_fd(tc32 fd, tc32 timeout_ms, tc32 write)
+{
+    struct timeval tv;
+    fd_set fds;
+
+    if (!timeout_ms)
+        return 1;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    if (timeout_ms == vpx_NET_NO_TIMEOUT)
+        return select(fd + 1, write ? NULL : &fds,
+                      write ? &fds : NULL, NULL, NULL);
+
+    tv.tv_sec  = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+    return select(fd + 1, write ? NULL : &fds,
+                  write ? &fds : NULL, NULL, &tv);
+}
+
+static TCRV gro_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                         tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from)
+{
+    struct vpx_net_gro_state *g = vpx_sock->gro;
+    tc32 n;
+
+    if (!(vpx_sock->state & kInited) || !buffer || (buf_len <= 0))
+        return TC_INVALID_PARAMS;
+
+    if (g->pos >= g->len)
+    {
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr msg;
+        struct cmsghdr *cm = NULL;
+        struct iovec iov;
+
+        n = wait_fd(vpx_sock->sock, vpx_sock->read_timeout_ms, 0);
+
+        if (n == 0)
+            return TC_TIMEDOUT;
+
+        if (n < 0)
+            return TC_ERROR;
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = g->buf;
+        iov.iov_len = sizeof(g->buf);
+        msg.msg_name = &g->from;
+        msg.msg_namelen = sizeof(g->from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(vpx_sock->sock, &msg, vpx_sock->read_timeout_ms ? 0 : MSG_DONTWAIT);
+
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return TC_WOULDBLOCK;
+
+            vpxlog_dbg(LOG_PACKET, "gro_recvfrom: recvmsg failed, eno=%d\n", errno);
+            return TC_ERROR;
+        }
+
+        g->len = n;
+        g->pos = 0;
+        g->segment = n;
+
+#if defined(UDP_GRO)
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if ((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO))
+                g->segment = *(int *)CMSG_DATA(cm);
+        }
+
+#endif
+
+        if (g->segment <= 0)
+            g->segment = n;
+    }
+
+    // every segment but the last is g->segment bytes long
+    n = g->len - g->pos;
+
+    if (n > g->segment)
+        n = g->segment;
+
+    if (n > buf_len)
+    {
+        g->pos += n;
+        return TC_MSG_TOO_LARGE;
+    }
+
+    memcpy(buffer, g->buf + g->pos, n);
+    g->pos += n;
+
+    if (vpx_sa_from)
+        *vpx_sa_from = g->from;
+
+    if (bytes_read)
+        *bytes_read = n;
+
+    return TC_OK;
+}
+#endif
+
+/*
+    vpx_net_sendto_segments(struct vpxsocket* vpx_sock, tc8** buffers,
+                            tc32* lengths, tc32 count, tc32* bytes_sent,
+                            union vpx_sockaddr_x vpx_sa_to)
+      vpx_sock - pointer to a properly initialized udp vpxsocket
+      buffers, lengths - count datagrams, all of lengths[0] bytes except
+                         the last, which may be shorter
+      count - 1 to vpx_NET_MAX_SEGMENTS
+      bytes_sent - pointer to an integer that will receive the total
+                   amount of data sent or NULL
+      vpx_sa_to - vpx_sockaddr_x containing the address of the target
+    Sends count datagrams to vpx_sa_to. Where the system supports UDP
+    segmentation offload (Linux UDP_SEGMENT) this is a single sendmsg
+    that the kernel or the NIC splits up, elsewhere, or if the kernel
+    refuses, the datagrams go out one vpx_net_sendto at a time.
+    Return:
+      as vpx_net_sendto, for the first datagram that failed
+*/
+TCRV vpx_net_sendto_segments(struct vpxsocket *vpx_sock, tc8 **buffers,
+                             tc32 *lengths, tc32 count, tc32 *bytes_sent,
+                             union vpx_sockaddr_x vpx_sa_to)
+{
+    TCRV rv = TC_INVALID_PARAMS;
+    tc32 i, n, total = 0;
+
+    if (!vpx_sock || !(vpx_sock->state & kInited) || (vpx_sock->tl != vpx_UDP)
+        || !buffers || !lengths || (count < 1) || (count > vpx_NET_MAX_SEGMENTS))
+        return rv;
+
+#if defined(LINUX) && defined(UDP_SEGMENT)
+
+    // on an io_uring the queued sends already share one system call
+    if ((count > 1) && !vpx_sock->no_gso && !vpx_sock->uring)
+    {
+        struct iovec iov[vpx_NET_MAX_SEGMENTS];
+        char control[CMSG_SPACE(sizeof(tcu16))];
+        struct msghdr msg;
+        struct cmsghdr *cm;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+
+        for (i = 0; i < count; i++)
+        {
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = lengths[i];
+        }
+
+        switch (vpx_sock->nl)
+        {
+        case vpx_IPv4:
+            msg.msg_name = &vpx_sa_to.sa_in;
+            msg.msg_namelen = sizeof(struct sockaddr_in);
+            break;
+        case vpx_IPv6:
+# if vpx_NET_SUPPORT_IPV6
+            msg.msg_name = &vpx_sa_to.sa_in6;
+            msg.msg_namelen = sizeof(struct sockaddr_in6);
+# endif
+            break;
+        }
+
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // the kernel cuts the payload into lengths[0] sized datagrams
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(tcu16));
+        *(tcu16 *)CMSG_DATA(cm) = (tcu16)lengths[0];
+
+        if (wait_fd(vpx_sock->sock, vpx_sock->send_timeout_ms, 1) <= 0)
+            return TC_TIMEDOUT;
+
+        n = sendmsg(vpx_sock->sock, &msg, vpx_sock->send_timeout_ms ? 0 : MSG_DONTWAIT);
+
+        if (n >= 0)
+        {
+            if (bytes_sent)
+                *bytes_sent = n;
+
+            return TC_OK;
+        }
+
+        switch (errno)
+        {
+        case EAGAIN:
+# if defined(EWOULDBLOCK) && EAGAIN != EWOULDBLOCK
+        case EWOULDBLOCK:
+# endif
+            return TC_WOULDBLOCK;
+        case EMSGSIZE:
+            return TC_MSG_TOO_LARGE;
+        case EIO:           // the device can't checksum segments
+        case EINVAL:
+        case ENOPROTOOPT:   // kernel older than 4.18
+            vpxlog_dbg(LOG_PACKET, "vpx_net_sendto_segments: no UDP GSO, eno=%d\n", errno);
+            vpx_sock->no_gso = 1;
+            break;
+        default:
+            return TC_ERROR;
+        }
+    }
+
+#endif
+
+    // one at a time
+    for (i = 0, rv = TC_OK; (i < count) && (rv == TC_OK); i++)
+    {
+        rv = vpx_net_sendto(vpx_sock, buffers[i], lengths[i], &n, vpx_sa_to);
+
+        if (rv == TC_OK)
+            total += n;
+    }
+
+    if (bytes_sent)
+        *bytes_sent = total;
+
+    return rv;
+}
+
 /*
     vpx_net_is_readable(struct vpxsocket* vpx_sock)
       vpx_sock - pointer to a properly initialized vpxsocket structure to
@@ -2326,6 +2673,11 @@ TCRV vpx_net_join_multicast_addr(struct vpxsocket *vpx_sock
         if (!rv)
         {
             tc32 ret = 0;
+            tc32 on = 1;
+
+            //others on this host may take the same group and port, which
+            //has to be allowed before binding
+            vpx_net_reuse_addr(vpx_sock, 1, &on);
 
             ret = vpx_net_bind(vpx_sock,
                                NULL,
@@ -2408,45 +2760,1194 @@ TCRV vpx_net_leave_multicast(struct vpxsocket *vpx_sock)
     return rv;
 }
 
-/* END - udp only functions */
-
 /*
- *
- * END - Exposed library functions
- *
+    vpx_net_pmtu_discover(struct vpxsocket* vpx_sock, tc8 set, tc32* value)
+      vpx_sock - pointer to a properly initialized vpxsocket structure
+      set - flag indicating whether to set (non-zero value) or
+            query (0) the option
+      value - depending on the value of set, 1 to send every datagram with
+              the don't fragment bit and 0 for the system default, or
+              receives the current setting
+    With discovery on, datagrams over the path MTU are not fragmented:
+    sends fail with TC_MSG_TOO_LARGE and vpx_net_path_mtu picks up the
+    smaller MTU the router reported.
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sock is NULL, was not initialized via
+                         vpx_net_open, the socket is not a udp socket or
+                         value is NULL
+      TC_ERROR: if the option could not be queried/set or path MTU discovery
+                is not supported on this platform
 */
+TCRV vpx_net_pmtu_discover(struct vpxsocket *vpx_sock, tc8 set, tc32 *value)
+{
+    TCRV rv = TC_INVALID_PARAMS;
+#if defined(LINUX) && defined(IP_MTU_DISCOVER)
+    tc32 mode;
+
+    if (vpx_sock && (vpx_sock->state & kInited) && (vpx_sock->tl == vpx_UDP) && value)
+    {
+        switch (vpx_sock->nl)
+        {
+        case vpx_IPv4:
+            mode = *value ? IP_PMTUDISC_DO : IP_PMTUDISC_WANT;
+            rv = socket_option(vpx_sock, set, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode));
+
+            if (!set)
+                *value = (mode == IP_PMTUDISC_DO);
+
+            break;
+        case vpx_IPv6:
+# if vpx_NET_SUPPORT_IPV6
+            mode = *value ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_WANT;
+            rv = socket_option(vpx_sock, set, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &mode, sizeof(mode));
+
+            if (!set)
+                *value = (mode == IPV6_PMTUDISC_DO);
+# endif
+            break;
+        }
+    }
+
+#else
+
+    if (vpx_sock && (vpx_sock->state & kInited) && (vpx_sock->tl == vpx_UDP) && value)
+        rv = TC_ERROR;
+
+#endif
+    return rv;
+}
 
 /*
- *
- * Internal library functions
- *
+    vpx_net_path_mtu(enum network_layer net_layer,
+                     union vpx_sockaddr_x* vpx_sa_to, tc32* mtu)
+      net_layer - network layer of vpx_sa_to
+      vpx_sa_to - the address datagrams will be sent to
+      mtu - receives the path MTU in bytes, IP and UDP headers included
+    Looks up the MTU towards vpx_sa_to: that of the outgoing interface, or
+    the smaller one learned through path MTU discovery on the way there.
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sa_to or mtu is NULL
+      TC_ERROR: if the MTU could not be determined or this platform does
+                not report it
 */
+TCRV vpx_net_path_mtu(enum network_layer net_layer,
+                      union vpx_sockaddr_x *vpx_sa_to, tc32 *mtu)
+{
+    TCRV rv = TC_INVALID_PARAMS;
+#if defined(LINUX) && defined(IP_MTU)
+    struct vpxsocket probe;
+    tc32 on = 1;
+
+    if (!vpx_sa_to || !mtu)
+        return rv;
+
+    // the kernel only reports the MTU on a connected socket, so ask a
+    // throwaway one rather than connecting the caller's
+    if ((rv = vpx_net_open(&probe, net_layer, vpx_UDP)) != TC_OK)
+        return rv;
+
+    vpx_net_pmtu_discover(&probe, 1, &on);
+    rv = TC_ERROR;
+
+    switch (net_layer)
+    {
+    case vpx_IPv4:
+
+        if (connect(probe.sock, (struct sockaddr *)&vpx_sa_to->sa_in,
+                    sizeof(struct sockaddr_in)) != SOCKET_ERROR)
+            rv = socket_option(&probe, 0, IPPROTO_IP, IP_MTU, mtu, sizeof(*mtu));
+
+        break;
+    case vpx_IPv6:
+# if vpx_NET_SUPPORT_IPV6
+
+        if (connect(probe.sock, (struct sockaddr *)&vpx_sa_to->sa_in6,
+                    sizeof(struct sockaddr_in6)) != SOCKET_ERROR)
+            rv = socket_option(&probe, 0, IPPROTO_IPV6, IPV6_MTU, mtu, sizeof(*mtu));
+
+# endif
+        break;
+    }
+
+    vpx_net_close(&probe);
+
+#else
+
+    if (vpx_sa_to && mtu)
+        rv = TC_ERROR;
+
+#endif
+    return rv;
+}
 
 /*
-    socket_option(struct vpxsocket* vpx_sock, tc8 set, tc32 level,
-                  tc32 option, void* value, tc32 optlen)
-    Generic function used to wrap set/getsockopt. Used by exposed library
-    functions to set/get socket options
+    vpx_net_udp_gro(struct vpxsocket* vpx_sock, tc8 set, tc32* value)
+      vpx_sock - pointer to a properly initialized udp vpxsocket
+      set - flag indicating whether to set (non-zero value) or
+            query (0) the option
+      value - depending on the value of set, 1 to have the kernel
+              coalesce runs of equal sized datagrams from one sender
+              (Linux UDP_GRO) and 0 to turn it off, or receives the
+              current setting
+    vpx_net_recvfrom still returns one datagram per call: a coalesced
+    read is split up again and handed out one segment at a time.
+    Not available while vpx_sock is on an io_uring, see vpx_net_uring.
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sock is NULL, was not initialized via
+                         vpx_net_open, the socket is not a udp socket or
+                         value is NULL
+      TC_NO_MEM: if the receive buffer could not be allocated
+      TC_ERROR: if the option could not be set or is not supported on
+                this platform
 */
-static TCRV socket_option(struct vpxsocket *vpx_sock, tc8 set, tc32 level,
-                          tc32 option, void *value, tc32 optlen)
+TCRV vpx_net_udp_gro(struct vpxsocket *vpx_sock, tc8 set, tc32 *value)
 {
     TCRV rv = TC_INVALID_PARAMS;
-    tc32 ret;
 
-    if (vpx_sock && (vpx_sock->state & kInited) && value)
+    if (!vpx_sock || !(vpx_sock->state & kInited) || (vpx_sock->tl != vpx_UDP) || !value)
+        return rv;
+
+#if defined(LINUX) && defined(UDP_GRO)
+
+    if (!set)
     {
-        if (set)
-            ret = setsockopt(vpx_sock->sock, level, option, value, optlen);
-        else
-            ret = getsockopt(vpx_sock->sock, level, option, value, (tcu32 *)&optlen);
+        *value = (vpx_sock->gro != NULL);
+        return TC_OK;
+    }
 
-        rv = (ret == SOCKET_ERROR) ? TC_ERROR : TC_OK;
+    if (*value && vpx_sock->uring)
+        return TC_ERROR;
+
+    if (*value && !vpx_sock->gro)
+    {
+        if (!(vpx_sock->gro = (struct vpx_net_gro_state *)calloc(1, sizeof(struct vpx_net_gro_state))))
+            return TC_NO_MEM;
     }
 
+    rv = socket_option(vpx_sock, 1, SOL_UDP, UDP_GRO, value, sizeof(*value));
+
+    if (rv != TC_OK || !*value)
+    {
+        free(vpx_sock->gro);
+        vpx_sock->gro = NULL;
+    }
+
+#else
+
+    rv = set ? TC_ERROR : TC_OK;
+
+    if (!set)
+        *value = 0;
+
+#endif
     return rv;
 }
 
+#if defined(vpx_NET_URING)
+
+#define URING_RX_TAG     0xffffffffffffffffULL  //user_data of the multishot receive
+#define URING_CANCEL_TAG 0xfffffffffffffffeULL
+#define URING_BGID       1                      //buffer group of the receive buffers
+
+struct uring_send_slot
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union vpx_sockaddr_x to;
+    tc32 busy;
+    tc8 data[vpx_NET_URING_SLOT_SIZE];
+};
+
+struct uring_received
+{
+    tcu16 bid;
+    tc32 len;
+};
+
+struct vpx_net_uring
+{
+    tc32 fd;
+    tc32 depth;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    tc32 queued;                    //written to the SQ, not yet submitted
+
+    struct uring_send_slot *send;
+    tc32 send_next;
+    tc32 send_busy;
+    TCRV send_error;                //first failure since the last vpx_net_flush
+
+    struct io_uring_buf_ring *br;
+    tcu16 br_tail;
+    tc8 *rx_buf;
+    tc32 rx_size;
+    struct msghdr rx_msg;           //template the multishot receive fills in
+    tc32 rx_armed;
+    tc32 rx_error;
+    tc32 rx_seen;                   //a datagram came in through the ring
+    tc32 rx_plain;                  //no multishot receives, read with recvfrom
+    struct uring_received *rx_ready;
+    tc32 rx_head, rx_count;
+};
+
+static struct io_uring_sqe *uring_sqe(struct vpxsocket *vpx_sock)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    unsigned tail = *r->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= *r->sq_entries)
+    {
+        uring_submit(vpx_sock);
+
+        if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= *r->sq_entries)
+            return NULL;
+    }
+
+    sqe = &r->sqes[tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void uring_push(struct vpx_net_uring *r)
+{
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+}
+
+static void uring_recycle(struct vpx_net_uring *r, tcu16 bid)
+{
+    struct io_uring_buf *b = &r->br->bufs[r->br_tail & (r->depth - 1)];
+
+    b->addr = (unsigned long)(r->rx_buf + bid * r->rx_size);
+    b->len = r->rx_size;
+    b->bid = bid;
+    __atomic_store_n(&r->br->tail, ++r->br_tail, __ATOMIC_RELEASE);
+}
+
+/* takes every completion off the CQ: frees send buffers, remembers errors,
+   and queues received datagrams for uring_recvfrom */
+static void uring_reap(struct vpxsocket *vpx_sock)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+        if (cqe->user_data == URING_RX_TAG)
+        {
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                r->rx_armed = 0;
+
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+            {
+                struct uring_received *e =
+                    &r->rx_ready[(r->rx_head + r->rx_count++) & (r->depth - 1)];
+
+                e->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                e->len = cqe->res;
+                r->rx_seen = 1;
+            }
+            else if ((cqe->res < 0) && (cqe->res != -ENOBUFS) && (cqe->res != -ECANCELED))
+                r->rx_error = -cqe->res;
+        }
+        else if (cqe->user_data < (unsigned)r->depth)
+        {
+            r->send[cqe->user_data].busy = 0;
+            r->send_busy--;
+
+            if ((cqe->res < 0) && (r->send_error == TC_OK))
+            {
+                vpxlog_dbg(LOG_PACKET, "uring_reap: send failed, eno=%d\n", -cqe->res);
+                r->send_error = (cqe->res == -EMSGSIZE) ? TC_MSG_TOO_LARGE : TC_ERROR;
+            }
+        }
+    }
+
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* hands the queued SQEs to the kernel, returns -1 on failure */
+static tc32 uring_submit(struct vpxsocket *vpx_sock)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    tc32 n;
+
+    while (r->queued)
+    {
+        n = syscall(__NR_io_uring_enter, r->fd, r->queued, 0, 0, NULL, 0);
+
+        if (n > 0)
+            r->queued -= n;
+        else if ((n < 0) && (errno == EBUSY))
+            uring_reap(vpx_sock);   //CQ overflowed, make room
+        else if (!((n < 0) && (errno == EINTR)))
+            return -1;
+    }
+
+    return 0;
+}
+
+static void uring_arm(struct vpxsocket *vpx_sock)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    struct io_uring_sqe *sqe = uring_sqe(vpx_sock);
+
+    if (!sqe)
+        return;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = vpx_sock->sock;
+    sqe->addr = (unsigned long)&r->rx_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_RX_TAG;
+    uring_push(r);
+    r->rx_armed = 1;
+}
+
+/* whether vpx_sock reads through its ring rather than with recvfrom */
+static tc32 uring_receives(struct vpxsocket *vpx_sock)
+{
+    return vpx_sock->uring && !vpx_sock->uring->rx_plain;
+}
+
+static TCRV uring_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                           tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    struct io_uring_recvmsg_out *out;
+    struct uring_received *e;
+    tc8 *b, *payload;
+    TCRV rv = TC_OK;
+    tc32 n;
+
+    if (!(vpx_sock->state & kInited) || !buffer || (buf_len <= 0))
+        return TC_INVALID_PARAMS;
+
+    uring_reap(vpx_sock);
+
+    while (!r->rx_count)
+    {
+        // a kernel before 6.0 refuses the multishot receive outright, this
+        // socket reads with plain system calls from then on
+        if ((r->rx_error == EINVAL) && !r->rx_seen)
+        {
+            vpxlog_dbg(LOG_PACKET, "uring_recvfrom: no multishot recvmsg, reading directly\n");
+            r->rx_error = 0;
+            r->rx_plain = 1;
+            return recvfrom_raw(vpx_sock, buffer, buf_len, bytes_read, vpx_sa_from);
+        }
+
+        if (r->rx_error)
+        {
+            vpxlog_dbg(LOG_PACKET, "uring_recvfrom: receive failed, eno=%d\n", r->rx_error);
+            r->rx_error = 0;
+            return TC_ERROR;
+        }
+
+        // rearm after the kernel ran out of buffers or ended the receive
+        if (!r->rx_armed)
+            uring_arm(vpx_sock);
+
+        if (r->queued)
+        {
+            uring_submit(vpx_sock);
+            uring_reap(vpx_sock);
+            continue;
+        }
+
+        if (!vpx_sock->read_timeout_ms)
+            return TC_WOULDBLOCK;
+
+        n = wait_fd(r->fd, vpx_sock->read_timeout_ms, 0);
+
+        if (n == 0)
+            return TC_TIMEDOUT;
+
+        if (n < 0)
+            return TC_ERROR;
+
+        uring_reap(vpx_sock);
+    }
+
+    e = &r->rx_ready[r->rx_head];
+    r->rx_head = (r->rx_head + 1) & (r->depth - 1);
+    r->rx_count--;
+
+    // the buffer holds the recvmsg_out header, the address, then the payload
+    b = r->rx_buf + e->bid * r->rx_size;
+    out = (struct io_uring_recvmsg_out *)b;
+    payload = b + sizeof(*out) + r->rx_msg.msg_namelen;
+    n = out->payloadlen;
+
+    if ((out->flags & MSG_TRUNC) || (n > buf_len))
+        rv = TC_MSG_TOO_LARGE;
+    else
+    {
+        memcpy(buffer, payload, n);
+
+        if (vpx_sa_from)
+        {
+            memset(vpx_sa_from, 0, sizeof(*vpx_sa_from));
+            memcpy(vpx_sa_from, b + sizeof(*out),
+                   out->namelen < sizeof(*vpx_sa_from) ? out->namelen : sizeof(*vpx_sa_from));
+        }
+
+        if (bytes_read)
+            *bytes_read = n;
+    }
+
+    uring_recycle(r, e->bid);
+    return rv;
+}
+
+static TCRV uring_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                         tc32 *bytes_sent, union vpx_sockaddr_x vpx_sa_to)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    struct uring_send_slot *slot = &r->send[r->send_next];
+    struct io_uring_sqe *sqe;
+    tc32 n;
+
+    uring_reap(vpx_sock);
+
+    // every buffer is in flight, wait for the oldest
+    while (slot->busy)
+    {
+        if (uring_submit(vpx_sock))
+            return TC_ERROR;
+
+        uring_reap(vpx_sock);
+
+        if (!slot->busy)
+            break;
+
+        if (!vpx_sock->send_timeout_ms)
+            return TC_WOULDBLOCK;
+
+        n = wait_fd(r->fd, vpx_sock->send_timeout_ms, 0);
+
+        if (n == 0)
+            return TC_TIMEDOUT;
+
+        if (n < 0)
+            return TC_ERROR;
+
+        uring_reap(vpx_sock);
+    }
+
+    if (!(sqe = uring_sqe(vpx_sock)))
+        return TC_ERROR;
+
+    memcpy(slot->data, buffer, buf_len);
+    slot->iov.iov_base = slot->data;
+    slot->iov.iov_len = buf_len;
+    slot->to = vpx_sa_to;
+    slot->msg.msg_name = &slot->to;
+    slot->msg.msg_namelen = (vpx_sock->nl == vpx_IPv4) ? sizeof(struct sockaddr_in)
+                            : sizeof(slot->to);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = vpx_sock->sock;
+    sqe->addr = (unsigned long)&slot->msg;
+    sqe->len = 1;
+    sqe->user_data = r->send_next;
+    uring_push(r);
+
+    slot->busy = 1;
+    r->send_busy++;
+    r->send_next = (r->send_next + 1) & (r->depth - 1);
+
+    if (bytes_sent)
+        *bytes_sent = buf_len;
+
+    return TC_OK;
+}
+
+/* waits (a bounded while) for the kernel to be done with every buffer,
+   then unmaps and frees the ring; buffers the kernel may still write to
+   or read from are left allocated */
+static void uring_teardown(struct vpxsocket *vpx_sock)
+{
+    struct vpx_net_uring *r = vpx_sock->uring;
+    struct io_uring_buf_reg reg;
+    struct io_uring_sqe *sqe;
+    tc32 tries;
+
+    if (!r)
+        return;
+
+    // only once the rings are mapped
+    if (r->sq_head)
+    {
+        if (r->rx_armed && (sqe = uring_sqe(vpx_sock)))
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = URING_RX_TAG;
+            sqe->user_data = URING_CANCEL_TAG;
+            uring_push(r);
+        }
+
+        uring_submit(vpx_sock);
+
+        for (tries = 0; (r->rx_armed || r->send_busy) && (tries < 10); tries++)
+        {
+            wait_fd(r->fd, 100, 0);
+            uring_reap(vpx_sock);
+        }
+    }
+
+    if (r->br && !r->rx_armed)
+    {
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = URING_BGID;
+        syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+
+    if (r->cq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_size);
+
+    if (r->fd >= 0)
+        close(r->fd);
+
+    vpx_sock->uring = NULL;
+    free(r->rx_ready);
+
+    // the cancel or a send didn't complete, the kernel may still own them
+    if (r->rx_armed || r->send_busy)
+    {
+        vpxlog_dbg(ERRORS, "uring_teardown: %d sends and the receive still pending, leaking their buffers\n",
+                   r->send_busy);
+        return;
+    }
+
+    free(r->br);
+    free(r->rx_buf);
+    free(r->send);
+    free(r);
+}
+
+static TCRV uring_setup(struct vpxsocket *vpx_sock, tc32 depth)
+{
+    struct vpx_net_uring *r;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    void *br = NULL;
+    tc32 i;
+
+    if (!(r = (struct vpx_net_uring *)calloc(1, sizeof(*r))))
+        return TC_NO_MEM;
+
+    vpx_sock->uring = r;
+    r->depth = depth;
+    r->send_error = TC_OK;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, depth, &p);
+
+    if (r->fd < 0)
+    {
+        vpxlog_dbg(LOG_PACKET, "uring_setup: no io_uring, eno=%d\n", errno);
+        uring_teardown(vpx_sock);
+        return TC_ERROR;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+    if ((r->sq_ring == MAP_FAILED) || (r->cq_ring == MAP_FAILED) || (r->sqes == MAP_FAILED))
+    {
+        if (r->sq_ring == MAP_FAILED)
+            r->sq_ring = NULL;
+
+        if (r->cq_ring == MAP_FAILED)
+            r->cq_ring = NULL;
+
+        if (r->sqes == MAP_FAILED)
+            r->sqes = NULL;
+
+        uring_teardown(vpx_sock);
+        return TC_ERROR;
+    }
+
+    r->sq_head = (unsigned *)((tc8 *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned *)((tc8 *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((tc8 *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_entries = (unsigned *)((tc8 *)r->sq_ring + p.sq_off.ring_entries);
+    r->cq_head = (unsigned *)((tc8 *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *)((tc8 *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((tc8 *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((tc8 *)r->cq_ring + p.cq_off.cqes);
+
+    // SQ slot i always holds SQE i
+    for (i = 0; i < (tc32)p.sq_entries; i++)
+        ((unsigned *)((tc8 *)r->sq_ring + p.sq_off.array))[i] = i;
+
+    // room for the recvmsg_out header and the address in front of a datagram
+    r->rx_size = (sizeof(struct io_uring_recvmsg_out) + sizeof(union vpx_sockaddr_x)
+                  + vpx_NET_URING_SLOT_SIZE + 63) & ~63;
+    r->rx_msg.msg_namelen = sizeof(union vpx_sockaddr_x);
+
+    r->send = (struct uring_send_slot *)calloc(depth, sizeof(*r->send));
+    r->rx_buf = (tc8 *)malloc(depth * r->rx_size);
+    r->rx_ready = (struct uring_received *)calloc(depth, sizeof(*r->rx_ready));
+
+    if (posix_memalign(&br, 4096, depth * sizeof(struct io_uring_buf)) == 0)
+    {
+        memset(br, 0, depth * sizeof(struct io_uring_buf));
+        r->br = (struct io_uring_buf_ring *)br;
+    }
+
+    if (!r->send || !r->rx_buf || !r->rx_ready || !r->br)
+    {
+        uring_teardown(vpx_sock);
+        return TC_NO_MEM;
+    }
+
+    // the kernel picks a free receive buffer from this ring for each datagram
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)r->br;
+    reg.ring_entries = depth;
+    reg.bgid = URING_BGID;
+
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        vpxlog_dbg(LOG_PACKET, "uring_setup: no provided buffer rings, eno=%d\n", errno);
+        free(r->br);
+        r->br = NULL;
+        uring_teardown(vpx_sock);
+        return TC_ERROR;
+    }
+
+    for (i = 0; i < depth; i++)
+        uring_recycle(r, (tcu16)i);
+
+    // the multishot receive is armed by the first vpx_net_recvfrom, a socket
+    // that only sends never hands the kernel its receive buffers
+    return TC_OK;
+}
+
+#endif
+
+/*
+    vpx_net_uring(struct vpxsocket* vpx_sock, tc8 set, tc32* value)
+      vpx_sock - pointer to a properly initialized udp vpxsocket
+      set - flag indicating whether to set (non-zero value) or
+            query (0) the option
+      value - depending on the value of set, the depth of the Linux
+              io_uring to move vpx_sock's traffic through (rounded up to
+              a power of two, at most 4096) and 0 to go back to plain
+              system calls, or receives the current depth
+    On the ring vpx_net_sendto copies the datagram into one of depth send
+    buffers and queues it; the queue goes to the kernel in one system call
+    with vpx_net_flush, or when it is full. Receives are a multishot
+    recvmsg into depth kernel selected buffers, armed by the first
+    vpx_net_recvfrom, so vpx_net_recvfrom only enters the kernel once
+    everything that arrived has been read; a kernel without multishot
+    receives (before Linux 6.0) reads with plain system calls. Both calls
+    keep their semantics and timeouts otherwise. Datagrams larger than
+    vpx_NET_URING_SLOT_SIZE are sent directly, after the queue.
+    Turns vpx_net_udp_gro off.
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sock is NULL, was not initialized via
+                         vpx_net_open, the socket is not a udp socket or
+                         value is NULL
+      TC_NO_MEM: if the buffers could not be allocated
+      TC_ERROR: if the kernel has no io_uring with provided buffer rings
+                (Linux 5.19) or this platform has none at all
+*/
+TCRV vpx_net_uring(struct vpxsocket *vpx_sock, tc8 set, tc32 *value)
+{
+    TCRV rv = TC_INVALID_PARAMS;
+
+    if (!vpx_sock || !(vpx_sock->state & kInited) || (vpx_sock->tl != vpx_UDP) || !value)
+        return rv;
+
+#if defined(vpx_NET_URING)
+
+    if (!set)
+    {
+        *value = vpx_sock->uring ? vpx_sock->uring->depth : 0;
+        return TC_OK;
+    }
+
+    uring_teardown(vpx_sock);
+
+    if (*value <= 0)
+        return TC_OK;
+
+    // a coalesced read would not fit the receive buffers
+    if (vpx_sock->gro)
+    {
+        tc32 off = 0;
+        vpx_net_udp_gro(vpx_sock, 1, &off);
+    }
+
+    if (*value > 4096)
+        *value = 4096;
+
+    // the buffer ring wants a power of two
+    for (rv = 1; rv < *value; rv <<= 1);
+
+    *value = rv;
+    rv = uring_setup(vpx_sock, *value);
+
+#else
+
+    rv = set ? TC_ERROR : TC_OK;
+
+    if (!set)
+        *value = 0;
+
+#endif
+    return rv;
+}
+
+/*
+    vpx_net_flush(struct vpxsocket* vpx_sock)
+      vpx_sock - pointer to a properly initialized vpxsocket
+    Submits the datagrams vpx_net_sendto queued on vpx_sock's io_uring,
+    without waiting for them to go out. Does nothing for a socket that
+    is not on a ring.
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sock is NULL or was not initialized via
+                         vpx_net_open
+      TC_MSG_TOO_LARGE: if a datagram sent since the last call was larger
+                        than the path MTU, see vpx_net_pmtu_discover
+      TC_ERROR: if submitting or an earlier queued send failed
+*/
+TCRV vpx_net_flush(struct vpxsocket *vpx_sock)
+{
+    TCRV rv = TC_INVALID_PARAMS;
+
+    if (!vpx_sock || !(vpx_sock->state & kInited))
+        return rv;
+
+    rv = TC_OK;
+
+#if defined(vpx_NET_URING)
+
+    if (vpx_sock->uring)
+    {
+        if (uring_submit(vpx_sock))
+            rv = TC_ERROR;
+
+        // UDP sends mostly complete inside the submit
+        uring_reap(vpx_sock);
+
+        if (vpx_sock->uring->send_error != TC_OK)
+        {
+            rv = vpx_sock->uring->send_error;
+            vpx_sock->uring->send_error = TC_OK;
+        }
+    }
+
+#endif
+    return rv;
+}
+
+/* END - udp only functions */
+
+/* impairment emulation */
+
+#define IMPAIR_QUEUE_MAX 4096
+#define IMPAIR_MAX_DATAGRAM 65536
+
+struct impaired_packet
+{
+    tc64 due_us;
+    tc32 len;
+    union vpx_sockaddr_x from;
+    tc8 *data;
+};
+
+struct vpx_net_impairment_state
+{
+    struct vpx_net_impairment cfg;
+    struct vpx_net_impairment_stats stats;
+    tcu32 rng;
+    tc32 bad;
+    tc64 link_free_us;
+    tc32 count;
+    struct impaired_packet q[IMPAIR_QUEUE_MAX];
+    tc8 scratch[IMPAIR_MAX_DATAGRAM];
+};
+
+/*
+    vpx_net_set_impairment(struct vpxsocket* vpx_sock,
+                           const struct vpx_net_impairment* impairment)
+      vpx_sock - pointer to a properly initialized vpxsocket structure
+      impairment - the impairment to emulate on data received through
+                   vpx_sock, or NULL to turn emulation off
+    Routes datagrams read with vpx_net_recvfrom through the impairment
+    emulator. Packets already waiting in the emulator are discarded
+    when it is turned off or reconfigured.
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sock is NULL or was not initialized
+                         via vpx_net_open
+      TC_NO_MEM: if the emulator state could not be allocated
+*/
+TCRV vpx_net_set_impairment(struct vpxsocket *vpx_sock,
+                            const struct vpx_net_impairment *impairment)
+{
+    struct vpx_net_impairment_state *s;
+    tc32 i;
+
+    if (!vpx_sock || !(vpx_sock->state & kInited))
+        return TC_INVALID_PARAMS;
+
+    if ((s = vpx_sock->impairment))
+    {
+        for (i = 0; i < s->count; i++)
+            free(s->q[i].data);
+
+        free(s);
+        vpx_sock->impairment = NULL;
+    }
+
+    if (!impairment)
+        return TC_OK;
+
+    if (!(s = calloc(1, sizeof(*s))))
+        return TC_NO_MEM;
+
+    s->cfg = *impairment;
+    s->rng = impairment->seed ? impairment->seed : 1;
+
+    if (!s->cfg.queue_packets || s->cfg.queue_packets > IMPAIR_QUEUE_MAX)
+        s->cfg.queue_packets = IMPAIR_QUEUE_MAX;
+
+    vpx_sock->impairment = s;
+    return TC_OK;
+}
+
+/*
+    vpx_net_parse_impairment(const tc8* spec,
+                             struct vpx_net_impairment* impairment)
+      spec - comma separated key=value list
+      impairment - receives the parsed settings
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if spec contains an unknown key or bad value
+*/
+TCRV vpx_net_parse_impairment(const tc8 *spec,
+                              struct vpx_net_impairment *impairment)
+{
+    if (!spec || !impairment)
+        return TC_INVALID_PARAMS;
+
+    memset(impairment, 0, sizeof(*impairment));
+    impairment->queue_packets = 1000;
+
+    while (*spec)
+    {
+        tc8 key[32];
+        double value;
+        tc32 used = 0;
+        tcu32 percent;
+
+        if (sscanf(spec, "%31[^=]=%lf%n", key, &value, &used) != 2 || value < 0)
+            return TC_INVALID_PARAMS;
+
+        spec += used;
+        percent = (tcu32)(value * 10000 + 0.5);
+
+        if (!strcmp(key, "seed"))               impairment->seed = (tcu32)value;
+        else if (!strcmp(key, "loss"))          impairment->loss_good = percent;
+        else if (!strcmp(key, "bad_loss"))      impairment->loss_bad = percent;
+        else if (!strcmp(key, "p_gb"))          impairment->good_to_bad = percent;
+        else if (!strcmp(key, "p_bg"))          impairment->bad_to_good = percent;
+        else if (!strcmp(key, "dup"))           impairment->duplicate = percent;
+        else if (!strcmp(key, "reorder"))       impairment->reorder = percent;
+        else if (!strcmp(key, "reorder_delay")) impairment->reorder_ms = (tcu32)value;
+        else if (!strcmp(key, "delay"))         impairment->delay_ms = (tcu32)value;
+        else if (!strcmp(key, "jitter"))        impairment->jitter_ms = (tcu32)value;
+        else if (!strcmp(key, "rate"))          impairment->rate_kbps = (tcu32)value;
+        else if (!strcmp(key, "queue"))         impairment->queue_packets = (tcu32)value;
+        else
+            return TC_INVALID_PARAMS;
+
+        if (*spec == ',')
+            spec++;
+        else if (*spec)
+            return TC_INVALID_PARAMS;
+    }
+
+    return TC_OK;
+}
+
+/*
+    vpx_net_get_impairment_stats(struct vpxsocket* vpx_sock,
+                                 struct vpx_net_impairment_stats* stats)
+      vpx_sock - pointer to a vpxsocket with impairment emulation on
+      stats - receives the emulator's packet counters
+    Return:
+      TC_OK: on success
+      TC_INVALID_PARAMS: if vpx_sock or stats is NULL or emulation is off
+*/
+TCRV vpx_net_get_impairment_stats(struct vpxsocket *vpx_sock,
+                                  struct vpx_net_impairment_stats *stats)
+{
+    if (!vpx_sock || !vpx_sock->impairment || !stats)
+        return TC_INVALID_PARAMS;
+
+    *stats = vpx_sock->impairment->stats;
+    return TC_OK;
+}
+
+/* END - impairment emulation */
+
+/*
+ *
+ * END - Exposed library functions
+ *
+*/
+
+/*
+ *
+ * Internal library functions
+ *
+*/
+
+/*
+    socket_option(struct vpxsocket* vpx_sock, tc8 set, tc32 level,
+                  tc32 option, void* value, tc32 optlen)
+    Generic function used to wrap set/getsockopt. Used by exposed library
+    functions to set/get socket options
+*/
+static TCRV socket_option(struct vpxsocket *vpx_sock, tc8 set, tc32 level,
+                          tc32 option, void *value, tc32 optlen)
+{
+    TCRV rv = TC_INVALID_PARAMS;
+    tc32 ret;
+
+    if (vpx_sock && (vpx_sock->state & kInited) && value)
+    {
+        if (set)
+            ret = setsockopt(vpx_sock->sock, level, option, value, optlen);
+        else
+            ret = getsockopt(vpx_sock->sock, level, option, value, (tcu32 *)&optlen);
+
+        rv = (ret == SOCKET_ERROR) ? TC_ERROR : TC_OK;
+    }
+
+    return rv;
+}
+
+/*
+    impair_random(struct vpx_net_impairment_state* s)
+    xorshift32, so a given seed always produces the same impairment
+*/
+static tcu32 impair_random(struct vpx_net_impairment_state *s)
+{
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    return s->rng;
+}
+
+static tc32 impair_chance(struct vpx_net_impairment_state *s, tcu32 per_million)
+{
+    return per_million && (impair_random(s) % 1000000) < per_million;
+}
+
+/*
+    impair_packet(struct vpx_net_impairment_state* s, tc8* data, tc32 len,
+                  union vpx_sockaddr_x* from, tc64 now_us)
+    Runs one received datagram through the loss model and queues whatever
+    survives, ordered by the time it is due to be handed to the caller.
+*/
+static void impair_packet(struct vpx_net_impairment_state *s, tc8 *data, tc32 len,
+                          union vpx_sockaddr_x *from, tc64 now_us)
+{
+    tc32 copies = 1;
+
+    s->stats.received++;
+
+    if (s->bad ? impair_chance(s, s->cfg.bad_to_good) : impair_chance(s, s->cfg.good_to_bad))
+        s->bad = !s->bad;
+
+    if (impair_chance(s, s->bad ? s->cfg.loss_bad : s->cfg.loss_good))
+    {
+        s->stats.lost++;
+
+        if (s->bad)
+            s->stats.burst_lost++;
+
+        return;
+    }
+
+    if (impair_chance(s, s->cfg.duplicate))
+    {
+        s->stats.duplicated++;
+        copies++;
+    }
+
+    while (copies--)
+    {
+        struct impaired_packet p;
+        tc32 i;
+
+        if ((tcu32)s->count >= s->cfg.queue_packets || !(p.data = malloc(len)))
+        {
+            s->stats.queue_dropped++;
+            continue;
+        }
+
+        p.due_us = now_us;
+
+        // serialize onto the bottleneck link
+        if (s->cfg.rate_kbps)
+        {
+            if (s->link_free_us < now_us)
+                s->link_free_us = now_us;
+
+            s->link_free_us += (tc64)len * 8 * 1000 / s->cfg.rate_kbps;
+            p.due_us = s->link_free_us;
+        }
+
+        p.due_us += (tc64)s->cfg.delay_ms * 1000;
+
+        if (s->cfg.jitter_ms)
+        {
+            tc64 jitter_us = (tc64)s->cfg.jitter_ms * 1000;
+            p.due_us += (tc64)(impair_random(s) % (2 * jitter_us + 1)) - jitter_us;
+
+            if (p.due_us < now_us)
+                p.due_us = now_us;
+        }
+
+        if (impair_chance(s, s->cfg.reorder))
+        {
+            s->stats.reordered++;
+            p.due_us += (tc64)s->cfg.reorder_ms * 1000;
+        }
+
+        p.len = len;
+        p.from = *from;
+        memcpy(p.data, data, len);
+
+        // insert after everything due at the same time to keep order stable
+        for (i = s->count; i > 0 && s->q[i - 1].due_us > p.due_us; i--)
+            s->q[i] = s->q[i - 1];
+
+        s->q[i] = p;
+        s->count++;
+    }
+}
+
+/*
+    impaired_recvfrom(struct vpxsocket* vpx_sock, tc8* buffer, tc32 buf_len,
+                      tc32* bytes_read, union vpx_sockaddr_x* vpx_sa_from)
+    vpx_net_recvfrom for sockets with impairment emulation. Drains the
+    socket into the emulator and hands out queued packets once they are due,
+    waiting no longer than the socket's read timeout.
+*/
+static TCRV impaired_recvfrom(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
+                              tc32 *bytes_read, union vpx_sockaddr_x *vpx_sa_from)
+{
+    struct vpx_net_impairment_state *s = vpx_sock->impairment;
+    tcu32 timeout = vpx_sock->read_timeout_ms;
+    tc64 start_us = (tc64)get_time_us();
+    TCRV rv = TC_OK;
+
+    if (!(vpx_sock->state & kInited) || !buffer || buf_len <= 0)
+        return TC_INVALID_PARAMS;
+
+    if (bytes_read)
+        *bytes_read = -1;
+
+    for (;;)
+    {
+        tc64 now_us = (tc64)get_time_us();
+        tc64 wait_us;
+        tc32 n = 0;
+        union vpx_sockaddr_x from;
+
+        // pull in everything the kernel has already queued
+        vpx_sock->read_timeout_ms = 0;
+
+        while (recvfrom_raw(vpx_sock, s->scratch, IMPAIR_MAX_DATAGRAM, &n, &from) == TC_OK && n > 0)
+            impair_packet(s, s->scratch, n, &from, now_us);
+
+        vpx_sock->read_timeout_ms = timeout;
+
+        if (s->count && s->q[0].due_us <= now_us)
+        {
+            struct impaired_packet p = s->q[0];
+
+            s->count--;
+            memmove(&s->q[0], &s->q[1], s->count * sizeof(struct impaired_packet));
+
+            if (p.len > buf_len)
+                p.len = buf_len;
+
+            memcpy(buffer, p.data, p.len);
+            free(p.data);
+
+            if (vpx_sa_from)
+                *vpx_sa_from = p.from;
+
+            if (bytes_read)
+                *bytes_read = p.len;
+
+            s->stats.delivered++;
+            return TC_OK;
+        }
+
+        if (timeout != vpx_NET_NO_TIMEOUT && now_us - start_us >= (tc64)timeout * 1000)
+            return timeout ? TC_TIMEDOUT : TC_WOULDBLOCK;
+
+        // sleep until the next arrival, the head of the queue is due or we time out
+        wait_us = (timeout == vpx_NET_NO_TIMEOUT) ? -1 : (tc64)timeout * 1000 - (now_us - start_us);
+
+        if (s->count && (wait_us < 0 || s->q[0].due_us - now_us < wait_us))
+            wait_us = s->q[0].due_us - now_us;
+
+        vpx_sock->read_timeout_ms = (wait_us < 0) ? vpx_NET_NO_TIMEOUT : (tcu32)((wait_us + 999) / 1000);
+        rv = recvfrom_raw(vpx_sock, s->scratch, IMPAIR_MAX_DATAGRAM, &n, &from);
+        vpx_sock->read_timeout_ms = timeout;
+
+        if (rv == TC_OK && n > 0)
+            impair_packet(s, s->scratch, n, &from, (tc64)get_time_us());
+        else if (rv != TC_OK && rv != TC_TIMEDOUT && rv != TC_WOULDBLOCK)
+            return rv;
+    }
+}
+
 /*
     set_nonblocking_io(struct vpxsocket* vpx_sock, tc32 on)
       vpx_sock - pointer to an vpxsocket structure
@@ -53,6 +53,9 @@
 # include <arpa/inet.h>   //inet_addr
 # include <netdb.h>       //for addrinfo
 # include <errno.h>
+# if defined(__linux__) || defined(LINUX)
+#  include <netinet/udp.h> //UDP_SEGMENT, UDP_GRO
+# endif
 #elif defined(VXWORKS)
 # include <hostLib.h>
 # include <sockLib.h>
@@ -73,6 +76,13 @@
 
 #define vpx_NET_NO_TIMEOUT 0xffffffff
 
+//most datagrams vpx_net_sendto_segments hands the kernel at once
+#define vpx_NET_MAX_SEGMENTS 64
+
+//largest datagram that goes through the io_uring send and receive buffers,
+//bigger sends bypass the ring
+#define vpx_NET_URING_SLOT_SIZE 9216
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -132,6 +142,43 @@ extern "C" {
 
         union vpx_sockaddr_x local_addr,
                 remote_addr;
+
+        struct vpx_net_impairment_state *impairment;
+        struct vpx_net_gro_state *gro;
+        tc32 no_gso;
+        struct vpx_net_uring *uring;
+    };
+
+    /*
+        Network impairment applied to received datagrams, see
+        vpx_net_set_impairment. Probabilities are in parts per million,
+        times in milliseconds.
+    */
+    struct vpx_net_impairment
+    {
+        tcu32 seed;
+        tcu32 loss_good,        // loss while the Gilbert-Elliott channel is good
+              loss_bad,         // loss while it is bad
+              good_to_bad,      // per packet state transition probabilities
+              bad_to_good;
+        tcu32 duplicate;
+        tcu32 reorder,          // probability a packet is held back
+              reorder_ms;       // and for how long
+        tcu32 delay_ms,
+              jitter_ms;        // uniform, +/- around delay_ms
+        tcu32 rate_kbps;        // bottleneck rate, 0 = unlimited
+        tcu32 queue_packets;    // bottleneck queue, tail drop when full
+    };
+
+    struct vpx_net_impairment_stats
+    {
+        tcu32 received,
+              lost,
+              burst_lost,
+              duplicated,
+              reordered,
+              queue_dropped,
+              delivered;
     };
 
     /*
@@ -370,6 +417,8 @@ extern "C" {
                        operation could not be completed in the specified time
           TC_WOULDBLOCK: if the send timeout has been set to 0 and the operation
                          could not be completed immediately
+          TC_MSG_TOO_LARGE: if the datagram is larger than the path MTU and may
+                            not be fragmented, see vpx_net_pmtu_discover
           TC_ERROR: if an error other than timed out or would block is encountered
                     trying to complete the operation, more information can be
                     obtained through calling vpx_net_get_error
@@ -399,6 +448,8 @@ extern "C" {
                        operation could not be completed in the specified time
           TC_WOULDBLOCK: if the send timeout has been set to 0 and the operation
                          could not be completed immediately
+          TC_MSG_TOO_LARGE: if the datagram is larger than the path MTU and may
+                            not be fragmented, see vpx_net_pmtu_discover
           TC_ERROR: if an error other than timed out or would block is encountered
                     trying to complete the operation, more information can be
                     obtained through calling vpx_net_get_error
@@ -406,6 +457,28 @@ extern "C" {
     TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
                         tc32 *bytes_sent, union vpx_sockaddr_x vpx_sa_to);
 
+    /*
+        vpx_net_sendto_segments(struct vpxsocket* vpx_sock, tc8** buffers,
+                                tc32* lengths, tc32 count, tc32* bytes_sent,
+                                union vpx_sockaddr_x vpx_sa_to)
+          vpx_sock - pointer to a properly initialized udp vpxsocket
+          buffers, lengths - count datagrams, all of lengths[0] bytes except
+                             the last, which may be shorter
+          count - 1 to vpx_NET_MAX_SEGMENTS
+          bytes_sent - pointer to an integer that will receive the total
+                       amount of data sent or NULL
+          vpx_sa_to - vpx_sockaddr_x containing the address of the target
+        Sends count datagrams to vpx_sa_to. Where the system supports UDP
+        segmentation offload (Linux UDP_SEGMENT) this is a single sendmsg
+        that the kernel or the NIC splits up, elsewhere, or if the kernel
+        refuses, the datagrams go out one vpx_net_sendto at a time.
+        Return:
+          as vpx_net_sendto, for the first datagram that failed
+    */
+    TCRV vpx_net_sendto_segments(struct vpxsocket *vpx_sock, tc8 **buffers,
+                                 tc32 *lengths, tc32 count, tc32 *bytes_sent,
+                                 union vpx_sockaddr_x vpx_sa_to);
+
     /*
         vpx_net_is_readable(struct vpxsocket* vpx_sock)
           vpx_sock - pointer to a properly initialized vpxsocket structure to
@@ -632,6 +705,158 @@ extern "C" {
     */
     TCRV vpx_net_leave_multicast(struct vpxsocket *vpx_sock);
 
+    /*
+        vpx_net_pmtu_discover(struct vpxsocket* vpx_sock, tc8 set, tc32* value)
+          vpx_sock - pointer to a properly initialized vpxsocket structure
+          set - flag indicating whether to set (non-zero value) or
+                query (0) the option
+          value - depending on the value of set, 1 to send every datagram with
+                  the don't fragment bit and 0 for the system default, or
+                  receives the current setting
+        With discovery on, datagrams over the path MTU are not fragmented:
+        sends fail with TC_MSG_TOO_LARGE and vpx_net_path_mtu picks up the
+        smaller MTU the router reported.
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sock is NULL, was not initialized via
+                             vpx_net_open, the socket is not a udp socket or
+                             value is NULL
+          TC_ERROR: if the option could not be queried/set or path MTU discovery
+                    is not supported on this platform
+    */
+    TCRV vpx_net_pmtu_discover(struct vpxsocket *vpx_sock, tc8 set, tc32 *value);
+
+    /*
+        vpx_net_path_mtu(enum network_layer net_layer,
+                         union vpx_sockaddr_x* vpx_sa_to, tc32* mtu)
+          net_layer - network layer of vpx_sa_to
+          vpx_sa_to - the address datagrams will be sent to
+          mtu - receives the path MTU in bytes, IP and UDP headers included
+        Looks up the MTU towards vpx_sa_to: that of the outgoing interface, or
+        the smaller one learned through path MTU discovery on the way there.
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sa_to or mtu is NULL
+          TC_ERROR: if the MTU could not be determined or this platform does
+                    not report it
+    */
+    TCRV vpx_net_path_mtu(enum network_layer net_layer,
+                          union vpx_sockaddr_x *vpx_sa_to, tc32 *mtu);
+
+    /*
+        vpx_net_udp_gro(struct vpxsocket* vpx_sock, tc8 set, tc32* value)
+          vpx_sock - pointer to a properly initialized udp vpxsocket
+          set - flag indicating whether to set (non-zero value) or
+                query (0) the option
+          value - depending on the value of set, 1 to have the kernel
+                  coalesce runs of equal sized datagrams from one sender
+                  (Linux UDP_GRO) and 0 to turn it off, or receives the
+                  current setting
+        vpx_net_recvfrom still returns one datagram per call: a coalesced
+        read is split up again and handed out one segment at a time.
+        Not available while vpx_sock is on an io_uring, see vpx_net_uring.
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sock is NULL, was not initialized via
+                             vpx_net_open, the socket is not a udp socket or
+                             value is NULL
+          TC_NO_MEM: if the receive buffer could not be allocated
+          TC_ERROR: if the option could not be set or is not supported on
+                    this platform
+    */
+    TCRV vpx_net_udp_gro(struct vpxsocket *vpx_sock, tc8 set, tc32 *value);
+
+    /*
+        vpx_net_uring(struct vpxsocket* vpx_sock, tc8 set, tc32* value)
+          vpx_sock - pointer to a properly initialized udp vpxsocket
+          set - flag indicating whether to set (non-zero value) or
+                query (0) the option
+          value - depending on the value of set, the depth of the Linux
+                  io_uring to move vpx_sock's traffic through (rounded up to
+                  a power of two, at most 4096) and 0 to go back to plain
+                  system calls, or receives the current depth
+        On the ring vpx_net_sendto copies the datagram into one of depth send
+        buffers and queues it; the queue goes to the kernel in one system call
+        with vpx_net_flush, or when it is full. Receives are a multishot
+        recvmsg into depth kernel selected buffers, armed by the first
+        vpx_net_recvfrom, so vpx_net_recvfrom only enters the kernel once
+        everything that arrived has been read; a kernel without multishot
+        receives (before Linux 6.0) reads with plain system calls. Both calls
+        keep their semantics and timeouts otherwise. Datagrams larger than
+        vpx_NET_URING_SLOT_SIZE are sent directly, after the queue.
+        Turns vpx_net_udp_gro off.
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sock is NULL, was not initialized via
+                             vpx_net_open, the socket is not a udp socket or
+                             value is NULL
+          TC_NO_MEM: if the buffers could not be allocated
+          TC_ERROR: if the kernel has no io_uring with provided buffer rings
+                    (Linux 5.19) or this platform has none at all
+    */
+    TCRV vpx_net_uring(struct vpxsocket *vpx_sock, tc8 set, tc32 *value);
+
+    /*
+        vpx_net_flush(struct vpxsocket* vpx_sock)
+          vpx_sock - pointer to a properly initialized vpxsocket
+        Submits the datagrams vpx_net_sendto queued on vpx_sock's io_uring,
+        without waiting for them to go out. Does nothing for a socket that
+        is not on a ring.
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sock is NULL or was not initialized via
+                             vpx_net_open
+          TC_MSG_TOO_LARGE: if a datagram sent since the last call was larger
+                            than the path MTU, see vpx_net_pmtu_discover
+          TC_ERROR: if submitting or an earlier queued send failed
+    */
+    TCRV vpx_net_flush(struct vpxsocket *vpx_sock);
+
+    /*
+        vpx_net_set_impairment(struct vpxsocket* vpx_sock,
+                               const struct vpx_net_impairment* impairment)
+          vpx_sock - pointer to a properly initialized vpxsocket structure
+          impairment - the impairment to emulate on data received through
+                       vpx_sock, or NULL to turn emulation off
+        Routes datagrams read with vpx_net_recvfrom through the impairment
+        emulator. Packets already waiting in the emulator are discarded
+        when it is turned off or reconfigured.
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sock is NULL or was not initialized
+                             via vpx_net_open
+          TC_NO_MEM: if the emulator state could not be allocated
+    */
+    TCRV vpx_net_set_impairment(struct vpxsocket *vpx_sock,
+                                const struct vpx_net_impairment *impairment);
+
+    /*
+        vpx_net_parse_impairment(const tc8* spec,
+                                 struct vpx_net_impairment* impairment)
+          spec - comma separated key=value list, e.g. "loss=1,delay=40,jitter=10".
+                 Keys: seed; loss, bad_loss, p_gb, p_bg, dup, reorder in
+                 percent; delay, jitter, reorder_delay in ms; rate in kbit/s;
+                 queue in packets (default 1000)
+          impairment - receives the parsed settings
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if spec contains an unknown key or bad value
+    */
+    TCRV vpx_net_parse_impairment(const tc8 *spec,
+                                  struct vpx_net_impairment *impairment);
+
+    /*
+        vpx_net_get_impairment_stats(struct vpxsocket* vpx_sock,
+                                     struct vpx_net_impairment_stats* stats)
+          vpx_sock - pointer to a vpxsocket with impairment emulation on
+          stats - receives the emulator's packet counters
+        Return:
+          TC_OK: on success
+          TC_INVALID_PARAMS: if vpx_sock or stats is NULL or emulation is off
+    */
+    TCRV vpx_net_get_impairment_stats(struct vpxsocket *vpx_sock,
+                                      struct vpx_net_impairment_stats *stats);
+
 #else //!defined(vpx_NET_STUBS)
     struct vpxsocket
     {
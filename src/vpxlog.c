@@ -0,0 +1,445 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+/*
+ * Asynchronous logger behind vpxlog_dbg.
+ *
+ * The calling thread only captures the format pointer, a timestamp and the
+ * raw arguments into a slot of a fixed ring and returns; a background thread
+ * does all of the formatting and the stdio. The ring is a bounded multi
+ * producer / single consumer queue that never blocks: when it is full the
+ * record is counted and dropped. Format strings must be literals (or at
+ * least outlive the process), %s arguments are copied.
+ */
+
+#include "tctypes.h"
+#include "rtp.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define VPXLOG_RING  4096       // records, power of 2
+#define VPXLOG_RM    (VPXLOG_RING - 1)
+#define VPXLOG_ARGS  10
+#define VPXLOG_TEXT  128        // bytes for copies of %s arguments
+#define VPXLOG_LINE  2048
+
+enum
+{
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_STRING,
+    ARG_POINTER,
+    ARG_IGNORE,
+};
+
+typedef union
+{
+    long long i;
+    double d;
+    const void *p;
+} vpxlog_arg;
+
+typedef struct
+{
+    // lap of the ring this slot belongs to, +1 once the record is complete
+    unsigned int seq;
+
+    int level;
+    int head;
+    unsigned int time;
+    const tc8 *format;
+    int nargs;
+    vpxlog_arg arg[VPXLOG_ARGS];
+    tc8 text[VPXLOG_TEXT];
+} vpxlog_record;
+
+static vpxlog_record ring[VPXLOG_RING];
+static unsigned int write_pos = 0;
+static unsigned int read_pos = 0;
+static unsigned int dropped = 0;
+static int started = 0;
+static int running = 0;
+static pthread_t log_thread;
+
+// the log thread sleeps on wake_cnd while the ring is empty; writers only
+// take wake_mtx to signal it when it says it is sleeping
+static pthread_mutex_t wake_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cnd = PTHREAD_COND_INITIALIZER;
+static int sleeping = 0;
+
+static unsigned int start_time = 0;
+
+/*
+    next_conversion(const tc8* f, const tc8** spec, int* stars, int* type)
+    Finds the next printf conversion in f. On return *spec points at its
+    '%', *stars holds the number of '*' width/precision arguments it takes
+    and *type the kind of argument it converts. Returns the character after
+    the conversion, or NULL when there is none left.
+*/
+static const tc8 *next_conversion(const tc8 *f, const tc8 **spec, int *stars, int *type)
+{
+    int length = 0;
+
+    for (;;)
+    {
+        if (!(f = strchr(f, '%')))
+            return NULL;
+
+        if (f[1] != '%')
+            break;
+
+        f += 2;
+    }
+
+    *spec = f++;
+    *stars = 0;
+
+    while (*f && strchr("-+ #0'", *f))
+        f++;
+
+    for (; *f == '*' || *f == '.' || (*f >= '0' && *f <= '9'); f++)
+        if (*f == '*')
+            (*stars)++;
+
+    for (; *f && strchr("hlLqjzt", *f); f++)
+        length = (*f == 'l' && length == 'l') ? 'q' : *f;
+
+    switch (*f)
+    {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        *type = length == 'l' ? ARG_LONG :
+                length == 'q' ? ARG_LLONG :
+                length == 'z' ? ARG_SIZE :
+                length == 'j' ? ARG_INTMAX :
+                length == 't' ? ARG_PTRDIFF : ARG_INT;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        *type = length == 'L' ? ARG_LDOUBLE : ARG_DOUBLE;
+        break;
+    case 's':
+        *type = ARG_STRING;
+        break;
+    case 'p':
+        *type = ARG_POINTER;
+        break;
+    case 'n':
+        *type = ARG_IGNORE;
+        break;
+    default:
+        return NULL;
+    }
+
+    return f + 1;
+}
+
+static void format_record(vpxlog_record *r, FILE *out)
+{
+    tc8 line[VPXLOG_LINE];
+    const tc8 *f = r->format;
+    const tc8 *spec, *next;
+    tc32 len = 0, a = 0;
+    int stars, type;
+
+    if (r->head)
+    {
+        if (start_time == 0)
+            start_time = r->time;
+
+        len = snprintf(line, sizeof(line), "%8d ", r->time - start_time);
+    }
+
+    while ((next = next_conversion(f, &spec, &stars, &type)) && a + stars < r->nargs)
+    {
+        tc8 fmt[32];
+        tc32 room, n, i, s = 0;
+        int w[2] = { 0, 0 };
+        vpxlog_arg v;
+
+        // literal text, folding %% the way printf would
+        for (; f < spec && len < VPXLOG_LINE - 1; f++)
+        {
+            line[len++] = *f;
+
+            if (f[0] == '%' && f[1] == '%')
+                f++;
+        }
+
+        // the conversion on its own, minus long double 'L' (we store double)
+        for (i = 0; spec + i < next && s < (tc32)sizeof(fmt) - 1; i++)
+            if (spec[i] != 'L')
+                fmt[s++] = spec[i];
+
+        fmt[s] = 0;
+
+        for (i = 0; i < stars; i++)
+            w[i & 1] = (int)r->arg[a++].i;
+
+        v = r->arg[a++];
+        f = next;
+        room = VPXLOG_LINE - len;
+
+        if (type == ARG_IGNORE)
+            continue;
+
+#define EMIT(val) \
+        (stars == 2 ? snprintf(line + len, room, fmt, w[0], w[1], val) : \
+         stars == 1 ? snprintf(line + len, room, fmt, w[0], val) : \
+                      snprintf(line + len, room, fmt, val))
+
+        switch (type)
+        {
+        case ARG_INT:     n = EMIT((int)v.i); break;
+        case ARG_LONG:    n = EMIT((long)v.i); break;
+        case ARG_LLONG:   n = EMIT(v.i); break;
+        case ARG_SIZE:    n = EMIT((size_t)v.i); break;
+        case ARG_INTMAX:  n = EMIT((intmax_t)v.i); break;
+        case ARG_PTRDIFF: n = EMIT((ptrdiff_t)v.i); break;
+        case ARG_DOUBLE:
+        case ARG_LDOUBLE: n = EMIT(v.d); break;
+        case ARG_STRING:  n = EMIT(r->text + v.i); break;
+        default:          n = EMIT(v.p); break;
+        }
+
+#undef EMIT
+
+        if (n > 0)
+            len = (len + n < VPXLOG_LINE - 1) ? len + n : VPXLOG_LINE - 1;
+    }
+
+    // trailing text
+    for (; *f && len < VPXLOG_LINE - 1; f++)
+    {
+        line[len++] = *f;
+
+        if (f[0] == '%' && f[1] == '%')
+            f++;
+    }
+
+    fwrite(line, 1, len, out);
+}
+
+static void *log_thread_func(void *arg)
+{
+    unsigned int reported = 0;
+
+    (void)arg;
+
+    for (;;)
+    {
+        vpxlog_record *r = &ring[read_pos & VPXLOG_RM];
+        unsigned int lost;
+
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == (read_pos & ~VPXLOG_RM) + 1)
+        {
+            format_record(r, stdout);
+            __atomic_store_n(&r->seq, (read_pos & ~VPXLOG_RM) + VPXLOG_RING, __ATOMIC_RELEASE);
+            __atomic_store_n(&read_pos, read_pos + 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+
+        if (lost != reported)
+        {
+            printf("vpxlog: %u records dropped\n", lost - reported);
+            reported = lost;
+        }
+
+        fflush(stdout);
+
+        if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)
+            && read_pos == __atomic_load_n(&write_pos, __ATOMIC_ACQUIRE))
+            break;
+
+        // say so before looking at the ring again, a writer that published
+        // after the look sees it and signals
+        pthread_mutex_lock(&wake_mtx);
+        __atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&r->seq, __ATOMIC_SEQ_CST) != (read_pos & ~VPXLOG_RM) + 1
+            && __atomic_load_n(&running, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&wake_cnd, &wake_mtx);
+
+        __atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&wake_mtx);
+    }
+
+    return NULL;
+}
+
+static void vpxlog_wake(void)
+{
+    if (!__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST))
+        return;
+
+    pthread_mutex_lock(&wake_mtx);
+    pthread_cond_signal(&wake_cnd);
+    pthread_mutex_unlock(&wake_mtx);
+}
+
+static void vpxlog_stop(void)
+{
+    pthread_mutex_lock(&wake_mtx);
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&wake_cnd);
+    pthread_mutex_unlock(&wake_mtx);
+    pthread_join(log_thread, NULL);
+}
+
+static void vpxlog_start(void)
+{
+    int expected = 0;
+
+    if (!__atomic_compare_exchange_n(&started, &expected, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+
+    // without the thread nothing drains the ring, a later write tries again
+    if (pthread_create(&log_thread, NULL, log_thread_func, NULL))
+    {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&started, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    atexit(vpxlog_stop);
+}
+
+/*
+    vpxlog_write(int level, int head, const tc8* format, ...)
+    Queues one record for the log thread. Use vpxlog_dbg and
+    vpxlog_dbg_no_head, which drop levels outside LOG_MASK at compile time.
+*/
+void vpxlog_write(int level, int head, const tc8 *format, ...)
+{
+    unsigned int pos = __atomic_load_n(&write_pos, __ATOMIC_RELAXED);
+    const tc8 *f = format, *spec;
+    vpxlog_record *r;
+    tc32 text = 0;
+    int stars, type;
+    va_list list;
+
+    if (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+        vpxlog_start();
+
+    // claim a slot
+    for (;;)
+    {
+        int diff;
+
+        r = &ring[pos & VPXLOG_RM];
+        diff = (int)(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - (pos & ~VPXLOG_RM));
+
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&write_pos, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+            pos = __atomic_load_n(&write_pos, __ATOMIC_RELAXED);
+    }
+
+    r->level = level;
+    r->head = head;
+    r->time = head ? get_time() : 0;
+    r->format = format;
+    r->nargs = 0;
+
+    va_start(list, format);
+
+    while ((f = next_conversion(f, &spec, &stars, &type)))
+    {
+        vpxlog_arg *a;
+
+        if (r->nargs + stars >= VPXLOG_ARGS)
+            break;
+
+        while (stars--)
+            r->arg[r->nargs++].i = va_arg(list, int);
+
+        a = &r->arg[r->nargs++];
+
+        switch (type)
+        {
+        case ARG_INT:     a->i = va_arg(list, int); break;
+        case ARG_LONG:    a->i = va_arg(list, long); break;
+        case ARG_LLONG:   a->i = va_arg(list, long long); break;
+        case ARG_SIZE:    a->i = (long long)va_arg(list, size_t); break;
+        case ARG_INTMAX:  a->i = va_arg(list, intmax_t); break;
+        case ARG_PTRDIFF: a->i = va_arg(list, ptrdiff_t); break;
+        case ARG_DOUBLE:  a->d = va_arg(list, double); break;
+        case ARG_LDOUBLE: a->d = (double)va_arg(list, long double); break;
+        case ARG_STRING:
+        {
+            const tc8 *s = va_arg(list, const tc8 *);
+            tc32 n;
+
+            if (!s)
+                s = "(null)";
+
+            n = strlen(s);
+
+            if (text + n >= VPXLOG_TEXT)
+                n = VPXLOG_TEXT - 1 - text;
+
+            a->i = text;
+            memcpy(r->text + text, s, n);
+            r->text[text + n] = 0;
+            text += n + (text + n < VPXLOG_TEXT - 1);
+            break;
+        }
+        default:
+            a->p = va_arg(list, void *);
+            break;
+        }
+    }
+
+    va_end(list);
+
+    // publish
+    __atomic_store_n(&r->seq, (pos & ~VPXLOG_RM) + 1, __ATOMIC_SEQ_CST);
+    vpxlog_wake();
+}
+
+/*
+    vpxlog_flush()
+    Waits until the log thread has written everything queued so far.
+*/
+void vpxlog_flush(void)
+{
+    unsigned int pos = __atomic_load_n(&write_pos, __ATOMIC_ACQUIRE);
+
+    // nothing drains the ring once the log thread is gone, or never came
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)
+           && (int)(__atomic_load_n(&read_pos, __ATOMIC_ACQUIRE) - pos) < 0)
+        usleep(1000);
+
+    fflush(stdout);
+}
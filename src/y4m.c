@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "y4m.h"
+
+void y4m_write_file_header(
+	FILE *outfile,
+	unsigned int width,
+	unsigned int height,
+	unsigned int rate,
+	unsigned int scale )
+{
+	fprintf(outfile, "YUV4MPEG2 W%u H%u F%u:%u Ip A0:0 C420jpeg\n",
+		width, height, rate, scale);
+}
+
+void y4m_write_frame(
+	FILE *outfile,
+	const vpx_image_t *img )
+{
+	fputs("FRAME\n", outfile);
+	i420_write_frame(outfile, img);
+}
+
+void i420_write_frame(
+	FILE *outfile,
+	const vpx_image_t *img )
+{
+	int plane;
+
+	for( plane = VPX_PLANE_Y; plane <= VPX_PLANE_V; plane++ ) {
+		const unsigned char *row = img->planes[plane];
+		unsigned int w = img->d_w;
+		unsigned int h = img->d_h;
+		unsigned int y;
+
+		if( plane != VPX_PLANE_Y ) {
+			w = (w + img->x_chroma_shift) >> img->x_chroma_shift;
+			h = (h + img->y_chroma_shift) >> img->y_chroma_shift;
+		}
+
+		/* rows are padded to the stride in the decoder's buffers */
+		if( img->stride[plane] == (int)w ) {
+			fwrite(row, 1, w * h, outfile);
+			continue;
+		}
+
+		for( y = 0; y < h; y++, row += img->stride[plane] ) {
+			fwrite(row, 1, w, outfile);
+		}
+	}
+}
+
+int y4m_read_file_header(
+	FILE *infile,
+	unsigned int *width,
+	unsigned int *height,
+	unsigned int *rate,
+	unsigned int *scale )
+{
+	char line[256];
+	char *tag;
+
+	if( !fgets(line, sizeof(line), infile)
+	 || strncmp(line, "YUV4MPEG2 ", 10) ) {
+		return -1;
+	}
+
+	*width = *height = 0;
+	*rate = 30;
+	*scale = 1;
+
+	for( tag = strtok(line + 10, " \n"); tag; tag = strtok(NULL, " \n") ) {
+		switch( tag[0] ) {
+		case 'W': *width  = strtoul(tag + 1, NULL, 10); break;
+		case 'H': *height = strtoul(tag + 1, NULL, 10); break;
+		case 'F': sscanf(tag + 1, "%u:%u", rate, scale); break;
+		case 'C':
+			/* only 8 bit 4:2:0 can go to the encoder as is */
+			if( strncmp(tag + 1, "420", 3) || strstr(tag, "p1") ) {
+				fprintf(stderr, "unsupported y4m colourspace %s\n", tag + 1);
+				return -1;
+			}
+			break;
+		default: break;
+		}
+	}
+
+	return (*width && *height && *rate && *scale) ? 0 : -1;
+}
+
+int y4m_read_frame(
+	FILE *infile,
+	vpx_image_t *img )
+{
+	char line[256];
+
+	/* FRAME may carry parameters up to the newline */
+	if( !fgets(line, sizeof(line), infile)
+	 || strncmp(line, "FRAME", 5) ) {
+		return -1;
+	}
+
+	return i420_read_frame(infile, img);
+}
+
+int i420_read_frame(
+	FILE *infile,
+	vpx_image_t *img )
+{
+	int plane;
+
+	for( plane = VPX_PLANE_Y; plane <= VPX_PLANE_V; plane++ ) {
+		unsigned char *row = img->planes[plane];
+		unsigned int w = img->d_w;
+		unsigned int h = img->d_h;
+		unsigned int y;
+
+		if( plane != VPX_PLANE_Y ) {
+			w = (w + img->x_chroma_shift) >> img->x_chroma_shift;
+			h = (h + img->y_chroma_shift) >> img->y_chroma_shift;
+		}
+
+		for( y = 0; y < h; y++, row += img->stride[plane] ) {
+			if( fread(row, 1, w, infile) != w ) {
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#ifndef Y4M_H
+#define Y4M_H
+
+#include <stdio.h>
+
+#include <vpx/vpx_image.h>
+
+void y4m_write_file_header(
+	FILE *outfile,
+	unsigned int width,
+	unsigned int height,
+	unsigned int rate,
+	unsigned int scale );
+
+void y4m_write_frame(
+	FILE *outfile,
+	const vpx_image_t *img );
+
+void i420_write_frame(
+	FILE *outfile,
+	const vpx_image_t *img );
+
+int y4m_read_file_header(
+	FILE *infile,
+	unsigned int *width,
+	unsigned int *height,
+	unsigned int *rate,
+	unsigned int *scale );
+
+int y4m_read_frame(
+	FILE *infile,
+	vpx_image_t *img );
+
+int i420_read_frame(
+	FILE *infile,
+	vpx_image_t *img );
+
+#endif/*Y4M_H*/